@@ -8,8 +8,13 @@
 #include <SFML/Window.hpp>
 #include <SFML/Network.hpp> 
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include "../Common/AllocationCounter.h"
+#include "../Common/ClientPrediction.h"
+#include "../Common/ParticleTable.h"
+#include "../Common/PlayerMovement.h"
+#include "../Common/Protocol.h"
+#include "../Common/ServerLink.h"
+#include "../Common/SnapshotBuffer.h"
 
 #include "imgui.h"
 #include "imgui-SFML.h"
@@ -29,7 +34,6 @@
 #include <utility>
 #include <filesystem>
 #include <stdexcept>
-#include <Windows.h>
 
 
 #include <ctime>
@@ -111,352 +115,282 @@ class Particle {
         }
 };
 
+// Every wall as one list of line segments, drawn in a single call. The
+// caller keeps vertices so its buffer is reused from frame to frame.
 void renderWalls(sf::RenderWindow& window,
     const std::vector<sf::VertexArray>& walls,
     std::mutex& mutex,
-    float scale) {
+    float scale,
+    std::vector<sf::Vertex>& vertices) {
     std::lock_guard<std::mutex> lock(mutex);
+    vertices.clear();
     for (const auto& wall : walls) {
-        // Create a transformed copy of the wall vertices with the given scale
-        sf::VertexArray scaledWall(wall.getPrimitiveType());
-        for (size_t i = 0; i < wall.getVertexCount(); ++i) {
-            scaledWall.append(sf::Vertex(sf::Vector2f(wall[i].position.x * scale, wall[i].position.y * scale)));
+        for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+            vertices.emplace_back(wall[i].position * scale);
+            vertices.emplace_back(wall[i + 1].position * scale);
         }
-        window.draw(scaledWall);
+    }
+    if (!vertices.empty()) {
+        window.draw(vertices.data(), vertices.size(), sf::Lines);
     }
 }
 
+// The shapes are made once by the caller, since building one allocates
 void renderParticles(const std::vector<Particle>& particles,
     sf::RenderWindow& window,
     std::mutex& mutex,
-    float scale) {
+    sf::CircleShape& particleShape) {
     std::lock_guard<std::mutex> lock(mutex);
     for (const auto& particle : particles) {
-        sf::CircleShape particleShape(5.0f * scale); // Adjust particle size based on scale
-        sf::Vector2f particlePosition = particle.getPosition();
-        particleShape.setPosition(particlePosition);
-        particleShape.setFillColor(sf::Color::Green);
+        particleShape.setPosition(particle.getPosition());
         window.draw(particleShape);
     }
 }
 
 
-float dot(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-    return v1.x * v2.x + v1.y * v2.y;
-}
-
-float distance(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-    return std::sqrt((v1.x - v2.x) * (v1.x - v2.x) + (v1.y - v2.y) * (v1.y - v2.y));
-}
+// What the client knows about the world. The link's receive thread fills the
+// snapshot buffer and the render loop samples it once per frame. The input
+// thread predicts this player's sprite and the receive thread reconciles it.
+// The walls come from the server and are replaced whole once every piece of
+// a new set has arrived.
+struct ServerView {
+    PlayerId playerId = 0;
+    SnapshotBuffer snapshots;
+    ParticleTable particleTable;   // for servers that send budgeted updates
+    std::vector<sf::VertexArray> walls;    // as the server last sent them
+    WallSegments wallSegments;             // the same walls, which the prediction collides with
+    ClientPrediction prediction;
+    uint64_t reconciledTick = 0;
+    std::vector<Particle> particles;
+    std::vector<sf::Vector2f> otherPlayers;
+    // Filled by each frame's sample, kept so their buffers are reused
+    std::vector<sf::Vector2f> sampledParticles;
+    std::vector<PlayerState> sampledPlayers;
 
-sf::Vector2f getClosestPointOnSegment(const sf::Vector2f& point, const sf::Vector2f& segmentStart, const sf::Vector2f& segmentEnd) {
-    sf::Vector2f segment = segmentEnd - segmentStart;
-    float lengthSquared = segment.x * segment.x + segment.y * segment.y; // Compute squared length directly
-    if (lengthSquared == 0) {
-        return segmentStart;
-    }
-    float t = std::max(0.0f, std::min(1.0f, dot(point - segmentStart, segment) / lengthSquared));
-    return segmentStart + t * segment;
-}
+    ServerView(float canvasWidth, float canvasHeight)
+        : prediction(playerSpawnPoint, wallSegments, canvasWidth, canvasHeight) {}
+};
 
-bool collidesWithWalls(const sf::Vector2f& position, const std::vector<sf::VertexArray>& walls, float canvasWidth, float canvasHeight) {
-    for (const auto& wall : walls) {
-        for (size_t i = 0; i < wall.getVertexCount() - 1; ++i) {
-            sf::Vector2f p1 = wall[i].position;
-            sf::Vector2f p2 = wall[i + 1].position;
-            p1.x -= RADIUS;
-            p1.y -= RADIUS;
-            p2.x -= RADIUS;
-            p2.y -= RADIUS;
-            sf::Vector2f closestPoint = getClosestPointOnSegment(position, p1, p2);
+// The wall set being received, only touched by the link's receive thread
+struct IncomingWalls {
+    uint32_t version = 0;
+    uint32_t segmentCount = 0;
+    std::vector<sf::VertexArray> walls;
+};
 
+// Seconds on the client's steady clock
+double clientTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
+// Apply one message from the server to the local view
+void applyServerMessage(const char* data, size_t size, ServerView& view, IncomingWalls& incoming, std::mutex& mutex, ServerLink& link) {
+    MessageType type;
+    if (!peekMessageType(data, size, type)) {
+        return;
+    }
 
-            if (distance(position, closestPoint) < RADIUS) {
-                return true; 
-            }
+    if (type == MessageType::Welcome) {
+        PlayerId playerId;
+        if (decodeWelcome(data, size, playerId)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            view.playerId = playerId;
+            std::cout << "Assigned player ID: " << playerId << std::endl;
         }
     }
-    if (position.x < 0 || position.x >= canvasWidth || position.y < 0 || position.y >= canvasHeight) {
-        return true;
+    else if (type == MessageType::Walls) {
+        WallsMessage message;
+        if (!decodeWalls(data, size, message)) {
+            return;
+        }
+        // Pieces arrive in order; one that does not continue the set being
+        // received is dropped until the next set starts
+        if (message.firstSegment == 0) {
+            incoming.version = message.version;
+            incoming.segmentCount = message.segmentCount;
+            incoming.walls.clear();
+        }
+        else if (message.version != incoming.version || message.firstSegment != incoming.walls.size()) {
+            return;
+        }
+        for (size_t i = 0; i + 1 < message.ends.size(); i += 2) {
+            sf::VertexArray wall(sf::LinesStrip, 2);
+            wall[0].position = message.ends[i];
+            wall[1].position = message.ends[i + 1];
+            incoming.walls.push_back(wall);
+        }
+        if (incoming.walls.size() == incoming.segmentCount) {
+            std::lock_guard<std::mutex> lock(mutex);
+            view.walls = incoming.walls;
+            view.wallSegments.assign(view.walls, playerRadius);
+        }
     }
-    return false; 
-}
-
-void handleInput(const std::string& clientId, sf::CircleShape& ball, float canvasWidth, float canvasHeight, const std::vector<sf::VertexArray>& walls, SOCKET clientSocket, sf::RenderWindow& window) {
-    const float speed = 5.0f;
-    std::cout << "Client ID: " << clientId << std::endl;
-
-    while (true) {
-        if (window.hasFocus()) {
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::W) && ball.getPosition().y >= 0) {
-                sf::Vector2f nextPosition = ball.getPosition();
-
-                nextPosition.y -= speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(0, -speed);
-                }
-
-                sf::Vector2f ballPosition = ball.getPosition(); // Get updated ball position
-                // Create a string to hold the serialized data
-                std::ostringstream oss;
-
-                // Serialize the data into the string
-                oss << clientId << " " << ballPosition.x << " " << ballPosition.y;
-
-                // Convert the stringstream to a string
-                std::string serializedData = oss.str();
-
-                // Print the serialized data
-                std::cout << "Before sending: " << serializedData << std::endl;
-
-                // Send the serialized data to the server (non-blocking)
-                const char* data = serializedData.c_str(); // Get pointer to the data
-                std::size_t dataSize = serializedData.size(); // Get size of the data
-
-                int bytesSent = send(clientSocket, data, dataSize, 0);
-                if (bytesSent == SOCKET_ERROR) {
-                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                        std::cerr << "Failed to send position data to the server!" << std::endl;
-                    }
-                }
-                else {
-                    std::cout << "Position data sent to server." << std::endl;
-                }
-
+    else if (type == MessageType::Snapshot || type == MessageType::ParticleUpdate) {
+        // Decode outside the lock
+        SnapshotMessage snapshot;
+        ParticleUpdateMessage update;
+        bool decoded = type == MessageType::Snapshot ? decodeSnapshot(data, size, snapshot) : decodeParticleUpdate(data, size, update);
+        if (!decoded) {
+            return;
+        }
 
+        {
+            // Lock the mutex before accessing the view
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // A budgeted update only carries some particles; fill in the rest
+            // from what earlier updates said. One older than the last applied
+            // would undo it.
+            if (type == MessageType::ParticleUpdate && !view.particleTable.apply(update, snapshot)) {
+                return;
             }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::A) && ball.getPosition().x >= 0) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.x -= speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(-speed, 0);
-                }
 
-                sf::Vector2f ballPosition = ball.getPosition(); // Get updated ball position
-                // Create a string to hold the serialized data
-                std::ostringstream oss;
-
-                // Serialize the data into the string
-                oss << clientId << " " << ballPosition.x << " " << ballPosition.y;
-
-                // Convert the stringstream to a string
-                std::string serializedData = oss.str();
-
-                // Print the serialized data
-                std::cout << "Before sending: " << serializedData << std::endl;
-
-                // Send the serialized data to the server (non-blocking)
-                const char* data = serializedData.c_str(); // Get pointer to the data
-                std::size_t dataSize = serializedData.size(); // Get size of the data
-
-                int bytesSent = send(clientSocket, data, dataSize, 0);
-                if (bytesSent == SOCKET_ERROR) {
-                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                        std::cerr << "Failed to send position data to the server!" << std::endl;
+            // Correct the predicted sprite with the newest authoritative state
+            if (view.playerId != 0 && snapshot.tick > view.reconciledTick) {
+                for (const auto& player : snapshot.players) {
+                    if (player.id == view.playerId) {
+                        view.prediction.reconcile(player.position, player.lastInput);
+                        break;
                     }
                 }
-                else {
-                    std::cout << "Position data sent to server." << std::endl;
-                }
-
+                view.reconciledTick = snapshot.tick;
             }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::S) && ball.getPosition().y + ball.getRadius() + RADIUS < canvasHeight) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.y += speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(0, speed);
-                }
-
-                sf::Vector2f ballPosition = ball.getPosition(); // Get updated ball position
-                // Create a string to hold the serialized data
-                std::ostringstream oss;
 
-                // Serialize the data into the string
-                oss << clientId << " " << ballPosition.x << " " << ballPosition.y;
-
-                // Convert the stringstream to a string
-                std::string serializedData = oss.str();
+            view.snapshots.push(std::move(snapshot), clientTime());
+        }
 
-                // Print the serialized data
-                std::cout << "Before sending: " << serializedData << std::endl;
+        // Tells the server which removals have arrived
+        if (type == MessageType::ParticleUpdate) {
+            link.send(encodeUpdateAck(update.tick));
+        }
+    }
+}
 
-                // Send the serialized data to the server (non-blocking)
-                const char* data = serializedData.c_str(); // Get pointer to the data
-                std::size_t dataSize = serializedData.size(); // Get size of the data
+// Sample the keyboard once per input tick, move the sprite locally and send
+// the commands to the server in small batches
+void handleInput(ServerView& view, std::mutex& mutex, ServerLink& link, sf::RenderWindow& window, std::atomic<bool>& running) {
+    const uint32_t ticksPerBatch = 3;
+    std::vector<InputCommand> batch;
+    uint32_t tick = 0;
+    auto nextTick = std::chrono::steady_clock::now();
 
-                int bytesSent = send(clientSocket, data, dataSize, 0);
-                if (bytesSent == SOCKET_ERROR) {
-                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                        std::cerr << "Failed to send position data to the server!" << std::endl;
-                    }
-                }
-                else {
-                    std::cout << "Position data sent to server." << std::endl;
-                }
+    while (running) {
+        uint8_t keys = 0;
+        if (window.hasFocus()) {
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::W)) {
+                keys |= inputUp;
             }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::D) &&
-                ball.getPosition().x + ball.getRadius() + RADIUS < canvasWidth) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.x += speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(speed, 0);
-                }
-
-                sf::Vector2f ballPosition = ball.getPosition(); // Get updated ball position
-                // Create a string to hold the serialized data
-                std::ostringstream oss;
-
-                // Serialize the data into the string
-                oss << clientId << " " << ballPosition.x << " " << ballPosition.y;
-
-                // Convert the stringstream to a string
-                std::string serializedData = oss.str();
-
-                // Print the serialized data
-                //std::cout << "Before sending: " << serializedData << std::endl;
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::A)) {
+                keys |= inputLeft;
+            }
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::S)) {
+                keys |= inputDown;
+            }
+            if (sf::Keyboard::isKeyPressed(sf::Keyboard::D)) {
+                keys |= inputRight;
+            }
+        }
 
-                // Send the serialized data to the server (non-blocking)
-                const char* data = serializedData.c_str(); // Get pointer to the data
-                std::size_t dataSize = serializedData.size(); // Get size of the data
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            InputCommand command;
+            if (view.prediction.step(keys, tick, command)) {
+                batch.push_back(command);
+            }
+        }
+        ++tick;
 
-                int bytesSent = send(clientSocket, data, dataSize, 0);
-                if (bytesSent == SOCKET_ERROR) {
-                    if (WSAGetLastError() != WSAEWOULDBLOCK) {
-                        std::cerr << "Failed to send position data to the server!" << std::endl;
-                    }
-                }
-                else {
-                    std::cout << "Position data sent to server." << std::endl;
-                }
+        // Send every few ticks, or straight away once the keys are released
+        if (!batch.empty() && (tick % ticksPerBatch == 0 || keys == 0)) {
+            if (!link.send(encodeInputBatch(batch.data(), batch.size()))) {
+                std::cerr << "Failed to send input to the server!" << std::endl;
             }
+            batch.clear();
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        nextTick += std::chrono::milliseconds(inputTickMilliseconds);
+        std::this_thread::sleep_until(nextTick);
     }
 }
 
+// Interpolate the buffered snapshots to the current frame
+void updateServerView(ServerView& view, std::mutex& mutex) {
+    std::vector<sf::Vector2f>& positions = view.sampledParticles;
+    std::vector<PlayerState>& players = view.sampledPlayers;
 
-// Function to receive serialized data from the server
-std::string receiveSerializedData(SOCKET clientSocket) {
-    std::string serializedData;
-
-    // Receive the length of the serialized data
-    int dataLength;
-    if (recv(clientSocket, reinterpret_cast<char*>(&dataLength), sizeof(dataLength), 0) == SOCKET_ERROR) {
-        std::cerr << "Error receiving data length." << std::endl;
-        return serializedData;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!view.snapshots.sample(clientTime(), positions, players)) {
+        return;
     }
 
-    // Resize the string to hold the received data
-    serializedData.resize(dataLength);
-
-    // Receive the serialized data
-    int totalReceived = 0;
-    while (totalReceived < dataLength) {
-        int bytesReceived = recv(clientSocket, &serializedData[totalReceived], dataLength - totalReceived, 0);
-        if (bytesReceived == SOCKET_ERROR) {
-            std::cerr << "Error receiving serialized data." << std::endl;
-            serializedData.clear();
-            break;
-        }
-        totalReceived += bytesReceived;
+    // Replace existing particles with the sampled ones
+    view.particles.clear();
+    for (const auto& position : positions) {
+        view.particles.emplace_back(position.x, position.y);
     }
 
-    return serializedData;
-}
-
-// Function to receive data from the server
-void receiveDataFromServer(SOCKET clientSocket, std::vector<Particle>& particles, std::mutex& mutex, sf::Vector2f& neighborSprite) {
-    while (true) {
-        // Receive serialized data from the server
-        std::string serializedData = receiveSerializedData(clientSocket);
-
-        // Deserialize the received data
-        std::istringstream iss(serializedData);
-        float receivedX, receivedY;
-        iss >> receivedX >> receivedY;
-
-        // Lock the mutex before accessing the particles vector
-        std::lock_guard<std::mutex> lock(mutex);
-
-        // Update neighborSprite with received position
-        neighborSprite.x = receivedX;
-        neighborSprite.y = receivedY;
-
-
-        // Clear existing particles
-        particles.clear();
-
-        // Add received particles to the vector
-        float x, y;
-        while (iss >> x >> y) {
-            particles.emplace_back(x, y);
+    // Every player except this one
+    view.otherPlayers.clear();
+    for (const auto& player : players) {
+        if (player.id != view.playerId) {
+            view.otherPlayers.push_back(player.position);
         }
     }
 }
 
+void renderPlayers(const std::vector<sf::Vector2f>& otherPlayers,
+    sf::RenderWindow& window,
+    std::mutex& mutex,
+    sf::CircleShape& playerShape) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-class IDGenerator {
-private:
-    int counter;
-
-public:
-    IDGenerator() : counter(0) {}
-
-    std::string generateID() {
-        counter++;
-        return "A" + std::to_string(counter);
+    for (const auto& position : otherPlayers) {
+        playerShape.setPosition(position);
+        window.draw(playerShape);
     }
-};
-
-
+}
 
-int main() {
-    IDGenerator idGenerator;
 
-    // Initialize WSA variables
-    WSADATA wsaData;
-    int wsaerr;
-    WORD wVersionRequested = MAKEWORD(2, 2);
-    wsaerr = WSAStartup(wVersionRequested, &wsaData);
-    if (wsaerr != 0) {
-        std::cout << "The Winsock dll not found" << std::endl;
+int main(int argc, char* argv[]) {
+    // Started for the whole run, cleaned up when main returns
+    SocketLibrary sockets;
+    if (!sockets.ok()) {
+        std::cout << "The socket library could not be started" << std::endl;
         return 0;
     }
     else {
-        std::cout << "Client_A is on" << std::endl << "The Winsock dll found" << std::endl;
-        std::cout << "The status: " << wsaData.szSystemStatus << std::endl;
+        std::cout << "Client_A is on" << std::endl;
+        std::cout << "The status: " << sockets.description() << std::endl;
     }
 
-    // Create socket
-    SOCKET clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (clientSocket == INVALID_SOCKET) {
-        std::cout << "Error at socket(): " << WSAGetLastError() << std::endl;
-        WSACleanup();
-        return 0;
-    }
-    else {
-        std::cout << "Socket is on" << std::endl;
+    // Command line: [--server <ip>] [--port <port>] [--udp]
+    // UDP uses the port after the TCP one; point these at a relay to spectate
+    std::string serverAddress = "192.168.68.110"; // Change to server IP address
+    uint16_t serverPort = 55555;
+    bool useUdp = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--server" && i + 1 < argc) {
+            serverAddress = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            serverPort = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--udp") {
+            useUdp = true;
+        }
     }
 
-    // Connect to server
-    sockaddr_in service;
-    service.sin_family = AF_INET;
-    service.sin_addr.s_addr = inet_addr("192.168.68.110"); // Change to server IP address
-    service.sin_port = htons(55555); // Change to server port
-    if (connect(clientSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
-        std::cout << "Failed to connect." << std::endl;
-        closesocket(clientSocket);
-        WSACleanup();
+    // Connect to server; snapshots over UDP avoid TCP head-of-line blocking
+    ServerLink link;
+    bool linked = useUdp ? link.connectUdp(serverAddress, serverPort + 1) : link.connectTcp(serverAddress, serverPort);
+    if (!linked) {
         return 0;
     }
     else {
         std::cout << "Connected to server." << std::endl;
     }
 
-    std::string id = idGenerator.generateID();
-    std::cout << "Generated ID: " << id << std::endl;
-
     /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
     sf::RenderWindow window(sf::VideoMode(1280 + 10, 720 + 10), "Particle Bouncing Application"); // adjusting size for aesthetic purposes, canvas walls are still 1280 x 720
@@ -469,10 +403,17 @@ int main() {
     float fps = 0;
     auto lastFpsTime = std::chrono::steady_clock::now();
 
+    // Kept across frames so drawing allocates nothing once running
+    sf::CircleShape particleShape(5.0f);
+    particleShape.setFillColor(sf::Color::Green);
+    sf::CircleShape playerShape(RADIUS);
+    playerShape.setFillColor(sf::Color::Blue);
+    std::vector<sf::Vertex> wallVertices;
+    AllocationLap frameAllocations;
+    uint64_t lastFrameAllocations = 0;
+
     ImGui::SFML::Init(window);
 
-    std::vector<Particle> particles;
-    sf::Vector2f neighborSprite(-1000, -1000); // Initialize neighborSprite
     float canvasWidth = 1280.0f;
     float canvasHeight = 720.0f;
     float speed = 100.0f;
@@ -481,7 +422,6 @@ int main() {
 
     float angle = 45.0f * M_PI / 180.0f; // Convert angle to radians
     int numParticles = 1;
-    std::vector<sf::VertexArray> walls;
 
     bool isDrawingLine = false;
     sf::Vector2f lineStart(100.0f, 360.0f); // Default line start point
@@ -492,43 +432,7 @@ int main() {
     sf::CircleShape ball(RADIUS);
     bool developerMode = true; // Default to developer mode
     ball.setFillColor(sf::Color::Red);
-    ball.setPosition(640, 360); // Initial position
-
-    std::thread inputThread(&handleInput,
-        id,
-        std::ref(ball),
-        canvasWidth,
-        canvasHeight,
-        std::ref(walls), clientSocket, std::ref(window));
-
-    // Create a packet to send ball position
-    sf::Vector2f ballPosition = ball.getPosition();
-    // Create a string to hold the serialized data
-    std::ostringstream oss;
-
-    // Serialize the data into the string
-    oss << id << " " << ballPosition.x << " " << ballPosition.y;
-
-    // Convert the stringstream to a string
-    std::string serializedData = oss.str();
-
-    // Print the serialized data
-    std::cout << "Before sending: " << serializedData << std::endl;
-
-    // Send the serialized data to the server (non-blocking)
-    const char* data = serializedData.c_str(); // Get pointer to the data
-    std::size_t dataSize = serializedData.size(); // Get size of the data
-
-    int bytesSent = send(clientSocket, data, dataSize, 0);
-    if (bytesSent == SOCKET_ERROR) {
-        if (WSAGetLastError() != WSAEWOULDBLOCK) {
-            std::cerr << "Failed to send position data to the server!" << std::endl;
-        }
-    }
-    else {
-        std::cout << "Position data sent to server." << std::endl;
-    }
-
+    ball.setPosition(playerSpawnPoint); // The server spawns every player here
 
     unsigned int numThreads = std::thread::hardware_concurrency();
     ThreadPool threadPool(numThreads);
@@ -536,11 +440,19 @@ int main() {
     // Mutex for synchronization
     std::mutex mutex;
 
-    std::thread receiveThread(receiveDataFromServer, clientSocket, std::ref(particles), std::ref(mutex), std::ref(neighborSprite));
-    // Create a secondary ball based on neighborSprite
-    sf::CircleShape secondaryBall(RADIUS);
-    secondaryBall.setFillColor(sf::Color::Blue);
-    secondaryBall.setPosition(neighborSprite);
+    ServerView view(canvasWidth, canvasHeight);
+    IncomingWalls incomingWalls;
+    link.setMessageHandler([&view, &incomingWalls, &mutex, &link](const char* data, size_t size) {
+        applyServerMessage(data, size, view, incomingWalls, mutex, link);
+    });
+
+    std::atomic<bool> running(true);
+    std::thread inputThread(&handleInput,
+        std::ref(view),
+        std::ref(mutex),
+        std::ref(link),
+        std::ref(window),
+        std::ref(running));
 
 
     while (window.isOpen()) {
@@ -572,6 +484,15 @@ int main() {
             lastFpsTime = currentTime;
         }
         ImGui::Text("FPS: %.1f", fps);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ImGui::Text("Render delay: %.0f ms (jitter %.1f ms)", view.snapshots.renderDelay() * 1000.0, view.snapshots.measuredJitter() * 1000.0);
+            ImGui::Text("Unacknowledged inputs: %zu (last correction %.1f px)", view.prediction.unacknowledged(), view.prediction.correction());
+            ball.setPosition(view.prediction.position());
+        }
+        if (countingAllocations) {
+            ImGui::Text("Allocations: %llu last frame", static_cast<unsigned long long>(lastFrameAllocations));
+        }
 
         ImGui::End();
         
@@ -590,27 +511,27 @@ int main() {
             zoomedInBottom - zoomedInTop));
         window.setView(zoomedInView);
 
-        renderWalls(window, walls, mutex, 1.0f);
-        renderParticles(particles, window, mutex, 1.0f);
+        renderWalls(window, view.walls, mutex, 1.0f, wallVertices);
+        updateServerView(view, mutex);
+        renderParticles(view.particles, window, mutex, particleShape);
 
+        renderPlayers(view.otherPlayers, window, mutex, playerShape);
         window.draw(ball);
-        window.draw(secondaryBall);
-
-        particles.clear();
 
         ImGui::SFML::Render(window);
 
         window.display();
 
         frameCount++;
+        lastFrameAllocations = frameAllocations.lap();
     }
 
     ImGui::SFML::Shutdown();
+    running = false;
     inputThread.join();
 
-    // Cleanup and close socket
-    closesocket(clientSocket);
-    WSACleanup();
+    // Cleanup and close the connection
+    link.close();
 
     return 0;
 }
\ No newline at end of file
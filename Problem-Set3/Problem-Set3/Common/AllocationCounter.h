@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Counts heap allocations per thread, to check that the frame and tick loops
+// reuse their buffers instead of allocating. On in Debug builds, or anywhere
+// COUNT_ALLOCATIONS is defined, by replacing the global operator new; the
+// count is a thread-local increment, so it costs next to nothing.
+//
+// Replacement operators must be defined exactly once per program. Every
+// program here is a single source file, which includes this header once;
+// one made of several would need the two definitions moved into a .cpp.
+#if defined(_DEBUG) && !defined(COUNT_ALLOCATIONS)
+#define COUNT_ALLOCATIONS
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+constexpr bool countingAllocations = true;
+#else
+constexpr bool countingAllocations = false;
+#endif
+
+// Allocations made on the calling thread since it started
+inline thread_local uint64_t threadAllocations = 0;
+
+// The allocations made on one thread between calls to lap(), such as one
+// frame's worth
+class AllocationLap {
+public:
+    uint64_t lap() {
+        uint64_t now = threadAllocations;
+        uint64_t count = now - last;
+        last = now;
+        return count;
+    }
+
+private:
+    uint64_t last = threadAllocations;
+};
+
+#ifdef COUNT_ALLOCATIONS
+// The array and nothrow forms call these by default. The sized delete is
+// replaced too, or compilers warn that it no longer matches the new.
+void* operator new(std::size_t size) {
+    ++threadAllocations;
+    if (void* memory = std::malloc(size > 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "PlayerMovement.h"
+#include "Protocol.h"
+#include "WallSegments.h"
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+
+// Client-side prediction of the player's own sprite. Each input tick is
+// applied locally straight away and kept until the server acknowledges it.
+// When an authoritative position arrives the unacknowledged commands are
+// replayed on top of it; any difference from what was shown is blended out
+// over a few ticks instead of snapping, unless it is too large to hide.
+class ClientPrediction {
+public:
+    ClientPrediction(sf::Vector2f start, const WallSegments& walls, float canvasWidth, float canvasHeight)
+        : walls(walls), canvasWidth(canvasWidth), canvasHeight(canvasHeight),
+        predicted(start), smoothing(0, 0), nextSequence(1), lastCorrection(0) {}
+
+    // Called once per input tick. Returns true and fills in command if any
+    // key was held, in which case the command must be sent to the server.
+    bool step(uint8_t keys, uint32_t tick, InputCommand& command) {
+        smoothing *= 0.8f;
+        if (std::abs(smoothing.x) < 0.01f && std::abs(smoothing.y) < 0.01f) {
+            smoothing = sf::Vector2f(0, 0);
+        }
+        if (keys == 0) {
+            return false;
+        }
+
+        command = { nextSequence++, tick, keys };
+        pending.push_back(command);
+        predicted = movePlayer(predicted, keys, walls, canvasWidth, canvasHeight);
+        return true;
+    }
+
+    // The server's position for this player after applying lastInput
+    void reconcile(sf::Vector2f serverPosition, uint32_t lastInput) {
+        while (!pending.empty() && pending.front().sequence <= lastInput) {
+            pending.pop_front();
+        }
+
+        sf::Vector2f shown = position();
+        predicted = serverPosition;
+        for (const InputCommand& command : pending) {
+            predicted = movePlayer(predicted, command.keys, walls, canvasWidth, canvasHeight);
+        }
+
+        sf::Vector2f error = shown - predicted;
+        lastCorrection = std::sqrt(error.x * error.x + error.y * error.y);
+        smoothing = lastCorrection > maxSmoothedCorrection ? sf::Vector2f(0, 0) : error;
+    }
+
+    // Where to draw the sprite
+    sf::Vector2f position() const {
+        return predicted + smoothing;
+    }
+
+    size_t unacknowledged() const {
+        return pending.size();
+    }
+
+    // Distance between prediction and server at the last reconciliation
+    float correction() const {
+        return lastCorrection;
+    }
+
+private:
+    static constexpr float maxSmoothedCorrection = 50.0f;
+
+    const WallSegments& walls;
+    float canvasWidth;
+    float canvasHeight;
+    sf::Vector2f predicted;
+    sf::Vector2f smoothing;
+    uint32_t nextSequence;
+    float lastCorrection;
+    std::deque<InputCommand> pending;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Socket.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Every message on the TCP stream is a 4-byte length followed by the payload.
+constexpr size_t frameHeaderSize = sizeof(uint32_t);
+constexpr uint32_t maxFrameSize = 4 * 1024 * 1024;
+
+inline void appendFrame(std::string& out, const char* data, size_t size) {
+    uint32_t length = static_cast<uint32_t>(size);
+    out.append(reinterpret_cast<const char*>(&length), frameHeaderSize);
+    out.append(data, size);
+}
+
+inline void appendFrame(std::string& out, const std::string& payload) {
+    appendFrame(out, payload.data(), payload.size());
+}
+
+// Blocking send of one whole frame, used by the clients
+inline bool sendFrame(SOCKET socket, const std::string& payload) {
+    std::string frame;
+    frame.reserve(frameHeaderSize + payload.size());
+    appendFrame(frame, payload);
+
+    size_t totalSent = 0;
+    while (totalSent < frame.size()) {
+        int bytesSent = send(socket, frame.data() + totalSent, static_cast<int>(frame.size() - totalSent), socketSendFlags);
+        if (bytesSent == SOCKET_ERROR) {
+            if (socketWouldBlock()) {
+                continue;
+            }
+            return false;
+        }
+        totalSent += bytesSent;
+    }
+    return true;
+}
+
+// Blocking receive of exactly size bytes
+inline bool receiveExact(SOCKET socket, char* data, size_t size) {
+    size_t totalReceived = 0;
+    while (totalReceived < size) {
+        int bytesReceived = recv(socket, data + totalReceived, static_cast<int>(size - totalReceived), 0);
+        if (bytesReceived <= 0) {
+            if (bytesReceived == SOCKET_ERROR && socketWouldBlock()) {
+                continue;
+            }
+            return false;
+        }
+        totalReceived += bytesReceived;
+    }
+    return true;
+}
+
+// Blocking receive of one whole frame, used by the clients
+inline bool receiveFrame(SOCKET socket, std::string& payload) {
+    uint32_t length;
+    if (!receiveExact(socket, reinterpret_cast<char*>(&length), frameHeaderSize) || length > maxFrameSize) {
+        return false;
+    }
+    payload.resize(length);
+    return length == 0 || receiveExact(socket, &payload[0], length);
+}
@@ -0,0 +1,605 @@
+#pragma once
+
+#include "Framing.h"
+#include "NetStats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+// Event-driven TCP server core. One I/O thread owns the listening socket and
+// every client socket (epoll on Linux, poll/WSAPoll elsewhere). Other threads
+// never touch a socket: they queue outgoing frames with send() and receive
+// complete incoming frames through the onMessage callback.
+class NetReactor {
+public:
+    using ConnectionId = uint32_t;
+
+    // An encoded message that many connections can send without copying it
+    using SharedPayload = std::shared_ptr<const std::string>;
+
+    // Reliable frames are always delivered in order; a client that lets too
+    // many pile up is disconnected. Latest frames (snapshots) sit in a small
+    // per-client queue that keeps the newest and drops stale ones when the
+    // client falls behind.
+    enum class SendPolicy {
+        Reliable,
+        Latest
+    };
+
+    // Callbacks run on the I/O thread, so they must be cheap
+    std::function<void(ConnectionId)> onConnect;
+    std::function<void(ConnectionId)> onDisconnect;
+    std::function<void(ConnectionId, const char*, size_t)> onMessage;
+
+    // maxQueuedFrames bounds how many Latest frames a slow client may have
+    // waiting before the oldest is dropped
+    explicit NetReactor(size_t maxQueuedFrames = 2)
+        : maxQueuedFrames(maxQueuedFrames), running(false), nextId(1), listenSocket(INVALID_SOCKET) {}
+
+    ~NetReactor() {
+        stop();
+    }
+
+    NetReactor(const NetReactor&) = delete;
+    NetReactor& operator=(const NetReactor&) = delete;
+
+    bool listen(uint16_t port) {
+        listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSocket == INVALID_SOCKET) {
+            std::cerr << "Error at socket(): " << socketError() << std::endl;
+            return false;
+        }
+
+        int reuse = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        // Accepted sockets inherit these, and the receive window is agreed
+        // during the handshake, so they must be set before listening
+        setBufferSizes(listenSocket, sendBufferBytes, receiveBufferBytes);
+
+        sockaddr_in service{};
+        service.sin_family = AF_INET;
+        service.sin_addr.s_addr = INADDR_ANY; // Bind to all available interfaces
+        service.sin_port = htons(port);
+        if (bind(listenSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
+            std::cerr << "bind() failed: " << socketError() << std::endl;
+            closesocket(listenSocket);
+            listenSocket = INVALID_SOCKET;
+            return false;
+        }
+        if (::listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+            std::cerr << "listen(): Error listening on socket: " << socketError() << std::endl;
+            closesocket(listenSocket);
+            listenSocket = INVALID_SOCKET;
+            return false;
+        }
+        setNonBlocking(listenSocket);
+        return true;
+    }
+
+    void start() {
+        if (running.exchange(true)) {
+            return;
+        }
+#ifdef __linux__
+        epollFd = epoll_create1(0);
+        wakeFd = eventfd(0, EFD_NONBLOCK);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = listenerKey;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenSocket, &event);
+        event.data.u64 = wakeKey;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+#endif
+        ioThread = std::thread(&NetReactor::run, this);
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        wake();
+        if (ioThread.joinable()) {
+            ioThread.join();
+        }
+        for (auto& entry : connections) {
+            closesocket(entry.second.socket);
+        }
+        connections.clear();
+        activeConnections = 0;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            publishedStats.clear();
+        }
+        if (listenSocket != INVALID_SOCKET) {
+            closesocket(listenSocket);
+            listenSocket = INVALID_SOCKET;
+        }
+#ifdef __linux__
+        ::close(wakeFd);
+        ::close(epollFd);
+#endif
+    }
+
+    // Queue one payload for a client. Safe to call from any thread; the frame
+    // is written by the I/O thread as soon as the socket accepts it.
+    void send(ConnectionId id, const std::string& payload, SendPolicy policy = SendPolicy::Reliable) {
+        send(id, std::make_shared<const std::string>(payload), policy);
+    }
+
+    // Queue a payload that is shared with other connections. The reactor
+    // only keeps a reference; each connection adds its own 4-byte header and
+    // writes header and body together with one gathered send.
+    void send(ConnectionId id, SharedPayload payload, SendPolicy policy = SendPolicy::Reliable) {
+        if (!payload || payload->size() > maxFrameSize) {
+            return;
+        }
+        // Only the first frame after a drain wakes the I/O thread; the rest
+        // are picked up by the same drain
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> lock(outboxMutex);
+            wasEmpty = outbox.empty();
+            outbox.push_back({ id, policy, std::move(payload) });
+        }
+        if (wasEmpty) {
+            wake();
+        }
+    }
+
+    size_t connectionCount() const {
+        return activeConnections.load();
+    }
+
+    // Stale Latest frames discarded because a client could not keep up
+    uint64_t droppedFrameCount() const {
+        return droppedFrames.load();
+    }
+
+    // Counters for every open connection as of the last publish, at most
+    // statsInterval old
+    std::vector<ConnectionStats> connectionStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return publishedStats;
+    }
+
+private:
+    struct Frame {
+        uint32_t header;
+        SharedPayload body;
+
+        size_t size() const {
+            return frameHeaderSize + body->size();
+        }
+    };
+
+    // Frames taken off the queues per gathered send; each uses two buffers
+    static constexpr size_t maxFramesPerSend = maxSendBuffers / 2;
+
+    struct Connection {
+        SOCKET socket = INVALID_SOCKET;
+        std::string readBuffer;
+        std::deque<Frame> sending;  // Frames being written, in order
+        size_t sendOffset = 0;      // Bytes of sending.front() already written
+        std::deque<Frame> reliableFrames;
+        std::deque<Frame> latestFrames;
+        bool wantWrite = false;
+        ConnectionStats stats;
+    };
+
+    struct OutgoingFrame {
+        ConnectionId id;
+        SendPolicy policy;
+        SharedPayload payload;
+    };
+
+    static constexpr uint64_t listenerKey = 0;
+    static constexpr uint64_t wakeKey = ~0ull;
+    static constexpr double statsInterval = 0.25;
+
+    // Reliable frames a client may have waiting before it is treated as
+    // stalled and disconnected, since none of them can be dropped
+    static constexpr size_t maxReliableFrames = 1024;
+
+    // Room for a few full snapshots per client; clients only send inputs
+    static constexpr int sendBufferBytes = 1024 * 1024;
+    static constexpr int receiveBufferBytes = 64 * 1024;
+
+    size_t maxQueuedFrames;
+    std::atomic<bool> running;
+    std::atomic<size_t> activeConnections{ 0 };
+    std::atomic<uint64_t> droppedFrames{ 0 };
+    ConnectionId nextId;
+    SOCKET listenSocket;
+    std::thread ioThread;
+
+    // Owned by the I/O thread
+    std::unordered_map<ConnectionId, Connection> connections;
+
+    std::mutex outboxMutex;
+    std::vector<OutgoingFrame> outbox;
+    std::vector<OutgoingFrame> draining;
+
+    mutable std::mutex statsMutex;
+    std::vector<ConnectionStats> publishedStats;
+    std::chrono::steady_clock::time_point lastPublish;
+
+#ifdef __linux__
+    int epollFd = -1;
+    int wakeFd = -1;
+#else
+#ifdef _WIN32
+    typedef WSAPOLLFD PollFd;
+#else
+    typedef pollfd PollFd;
+#endif
+    std::vector<PollFd> pollFds;
+    std::vector<uint64_t> pollKeys;
+#endif
+
+    struct ReadyEvent {
+        uint64_t key;
+        bool readable;
+        bool writable;
+        bool failed;
+    };
+
+    void wake() {
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t ignored = ::write(wakeFd, &one, sizeof(one));
+        (void)ignored;
+#endif
+        // The poll backends use a short timeout instead of a wakeup handle
+    }
+
+    void run() {
+        std::vector<ReadyEvent> ready;
+        while (running) {
+            waitForEvents(ready);
+            drainOutbox();
+            publishStats();
+
+            for (const ReadyEvent& event : ready) {
+                if (event.key == listenerKey) {
+                    acceptPending();
+                    continue;
+                }
+                if (event.key == wakeKey) {
+                    continue;
+                }
+                ConnectionId id = static_cast<ConnectionId>(event.key);
+                if (event.readable || event.failed) {
+                    if (!handleReadable(id)) {
+                        continue;
+                    }
+                }
+                if (event.writable) {
+                    auto it = connections.find(id);
+                    if (it != connections.end()) {
+                        flush(id, it->second);
+                    }
+                }
+            }
+        }
+    }
+
+    void waitForEvents(std::vector<ReadyEvent>& ready) {
+        ready.clear();
+#ifdef __linux__
+        epoll_event events[256];
+        int count = epoll_wait(epollFd, events, 256, 100);
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.u64 == wakeKey) {
+                uint64_t value;
+                ssize_t ignored = ::read(wakeFd, &value, sizeof(value));
+                (void)ignored;
+            }
+            ready.push_back({ events[i].data.u64,
+                (events[i].events & EPOLLIN) != 0,
+                (events[i].events & EPOLLOUT) != 0,
+                (events[i].events & (EPOLLERR | EPOLLHUP)) != 0 });
+        }
+#else
+        pollFds.clear();
+        pollKeys.clear();
+        PollFd listener{};
+        listener.fd = listenSocket;
+        listener.events = POLLIN;
+        pollFds.push_back(listener);
+        pollKeys.push_back(listenerKey);
+        for (const auto& entry : connections) {
+            PollFd fd{};
+            fd.fd = entry.second.socket;
+            fd.events = POLLIN | (entry.second.wantWrite ? POLLOUT : 0);
+            pollFds.push_back(fd);
+            pollKeys.push_back(entry.first);
+        }
+#ifdef _WIN32
+        int count = WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 5);
+#else
+        int count = ::poll(pollFds.data(), pollFds.size(), 5);
+#endif
+        for (size_t i = 0; count > 0 && i < pollFds.size(); ++i) {
+            if (pollFds[i].revents != 0) {
+                ready.push_back({ pollKeys[i],
+                    (pollFds[i].revents & POLLIN) != 0,
+                    (pollFds[i].revents & POLLOUT) != 0,
+                    (pollFds[i].revents & (POLLERR | POLLHUP)) != 0 });
+            }
+        }
+#endif
+    }
+
+    void updateInterest(ConnectionId id, Connection& connection, bool wantWrite) {
+        if (connection.wantWrite == wantWrite) {
+            return;
+        }
+        connection.wantWrite = wantWrite;
+#ifdef __linux__
+        epoll_event event{};
+        event.events = wantWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        event.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.socket, &event);
+#else
+        (void)id;
+#endif
+    }
+
+    void acceptPending() {
+        while (true) {
+            SOCKET clientSocket = accept(listenSocket, NULL, NULL);
+            if (clientSocket == INVALID_SOCKET) {
+                if (!socketWouldBlock()) {
+                    std::cerr << "accept failed: " << socketError() << std::endl;
+                }
+                return;
+            }
+
+            setNonBlocking(clientSocket);
+            setNoDelay(clientSocket);
+
+            ConnectionId id = nextId++;
+            Connection& connection = connections[id];
+            connection.socket = clientSocket;
+            connection.stats.id = id;
+#ifdef __linux__
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = id;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &event);
+#endif
+            ++activeConnections;
+            std::cout << "Client connected" << std::endl;
+            if (onConnect) {
+                onConnect(id);
+            }
+        }
+    }
+
+    // Returns false if the connection was closed
+    bool handleReadable(ConnectionId id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return false;
+        }
+        Connection& connection = it->second;
+
+        char buffer[64 * 1024];
+        while (true) {
+            int bytesReceived;
+            {
+                ScopedTimer timer(connection.stats.syscallSeconds);
+                bytesReceived = recv(connection.socket, buffer, sizeof(buffer), 0);
+            }
+            if (bytesReceived > 0) {
+                connection.readBuffer.append(buffer, bytesReceived);
+                connection.stats.bytesIn += bytesReceived;
+                continue;
+            }
+            if (bytesReceived == SOCKET_ERROR && socketWouldBlock()) {
+                break;
+            }
+            // Orderly shutdown or hard error
+            closeConnection(id);
+            return false;
+        }
+
+        // Hand every complete frame to the owner
+        size_t offset = 0;
+        while (connection.readBuffer.size() - offset >= frameHeaderSize) {
+            uint32_t length;
+            std::memcpy(&length, connection.readBuffer.data() + offset, frameHeaderSize);
+            if (length > maxFrameSize) {
+                std::cerr << "Oversized frame from client " << id << ", closing." << std::endl;
+                closeConnection(id);
+                return false;
+            }
+            if (connection.readBuffer.size() - offset - frameHeaderSize < length) {
+                break;
+            }
+            ++connection.stats.messagesIn;
+            if (onMessage) {
+                onMessage(id, connection.readBuffer.data() + offset + frameHeaderSize, length);
+            }
+            offset += frameHeaderSize + length;
+        }
+        connection.readBuffer.erase(0, offset);
+        return true;
+    }
+
+    void drainOutbox() {
+        {
+            std::lock_guard<std::mutex> lock(outboxMutex);
+            draining.swap(outbox);
+        }
+        for (OutgoingFrame& outgoing : draining) {
+            auto it = connections.find(outgoing.id);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection& connection = it->second;
+            Frame frame{ static_cast<uint32_t>(outgoing.payload->size()), std::move(outgoing.payload) };
+            if (outgoing.policy == SendPolicy::Reliable) {
+                if (connection.reliableFrames.size() >= maxReliableFrames) {
+                    std::cerr << "Client " << outgoing.id << " stopped reading, closing." << std::endl;
+                    closeConnection(outgoing.id);
+                    continue;
+                }
+                connection.reliableFrames.push_back(std::move(frame));
+                continue;
+            }
+            // Backpressure: a client that stops reading only ever holds the
+            // newest few snapshots instead of an ever-growing backlog
+            if (connection.latestFrames.size() >= maxQueuedFrames) {
+                connection.latestFrames.pop_front();
+                ++droppedFrames;
+            }
+            connection.latestFrames.push_back(std::move(frame));
+        }
+        for (OutgoingFrame& outgoing : draining) {
+            auto it = connections.find(outgoing.id);
+            if (it != connections.end() && !it->second.wantWrite) {
+                flush(outgoing.id, it->second);
+            }
+        }
+        draining.clear();
+    }
+
+    // Take up to maxFramesPerSend queued frames for the next gathered send,
+    // reliable ones first. Frames are only taken once the previous batch is
+    // fully written, so Latest frames stay replaceable until the last moment.
+    static bool takeFrames(Connection& connection) {
+        while (connection.sending.size() < maxFramesPerSend) {
+            std::deque<Frame>& queue = !connection.reliableFrames.empty() ? connection.reliableFrames : connection.latestFrames;
+            if (queue.empty()) {
+                break;
+            }
+            connection.sending.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+        connection.sendOffset = 0;
+        return !connection.sending.empty();
+    }
+
+    // Write as much as the socket takes; a partial write leaves the rest in
+    // place until the socket is writable again
+    void flush(ConnectionId id, Connection& connection) {
+        SendBuffer buffers[maxSendBuffers];
+        while (true) {
+            if (connection.sending.empty() && !takeFrames(connection)) {
+                updateInterest(id, connection, false);
+                return;
+            }
+
+            // Header and shared body of every frame in the batch, skipping
+            // whatever of the first frame has already gone out
+            size_t count = 0;
+            size_t requested = 0;
+            {
+                ScopedTimer timer(connection.stats.serializeSeconds);
+                size_t skip = connection.sendOffset;
+                for (const Frame& frame : connection.sending) {
+                    const char* header = reinterpret_cast<const char*>(&frame.header);
+                    if (skip < frameHeaderSize) {
+                        buffers[count++] = { header + skip, frameHeaderSize - skip };
+                        skip = 0;
+                    }
+                    else {
+                        skip -= frameHeaderSize;
+                    }
+                    if (frame.body->size() > skip) {
+                        buffers[count++] = { frame.body->data() + skip, frame.body->size() - skip };
+                    }
+                    skip = 0;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    requested += buffers[i].size;
+                }
+            }
+
+            int bytesSent;
+            {
+                ScopedTimer timer(connection.stats.syscallSeconds);
+                bytesSent = sendGather(connection.socket, buffers, count);
+            }
+            if (bytesSent == SOCKET_ERROR) {
+                if (socketWouldBlock()) {
+                    updateInterest(id, connection, true);
+                    return;
+                }
+                closeConnection(id);
+                return;
+            }
+
+            connection.stats.bytesOut += bytesSent;
+            if (static_cast<size_t>(bytesSent) < requested) {
+                ++connection.stats.partialWrites;
+            }
+
+            // Retire the frames that are now fully written
+            size_t written = connection.sendOffset + static_cast<size_t>(bytesSent);
+            while (!connection.sending.empty() && written >= connection.sending.front().size()) {
+                written -= connection.sending.front().size();
+                connection.sending.pop_front();
+                ++connection.stats.messagesOut;
+            }
+            connection.sendOffset = written;
+        }
+    }
+
+    // Copy every connection's counters for connectionStats(), refreshing the
+    // kernel's RTT estimate at the same time
+    void publishStats() {
+        auto time = std::chrono::steady_clock::now();
+        if (time - lastPublish < std::chrono::duration<double>(statsInterval)) {
+            return;
+        }
+        lastPublish = time;
+
+        std::vector<ConnectionStats> stats;
+        stats.reserve(connections.size());
+        for (auto& entry : connections) {
+            Connection& connection = entry.second;
+            connection.stats.rtt = socketRoundTrip(connection.socket);
+            connection.stats.queuedMessages = connection.sending.size() + connection.reliableFrames.size() + connection.latestFrames.size();
+            stats.push_back(connection.stats);
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        publishedStats.swap(stats);
+    }
+
+    void closeConnection(ConnectionId id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return;
+        }
+#ifdef __linux__
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.socket, nullptr);
+#endif
+        closesocket(it->second.socket);
+        connections.erase(it);
+        --activeConnections;
+        std::cout << "Client disconnected" << std::endl;
+        if (onDisconnect) {
+            onDisconnect(id);
+        }
+    }
+};
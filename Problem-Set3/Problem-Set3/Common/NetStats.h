@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Running totals for one connection, kept by the transport's I/O thread and
+// published to other threads a few times a second. Rates are left to the
+// reader, which can difference two copies.
+struct ConnectionStats {
+    uint32_t id = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    uint64_t messagesIn = 0;
+    uint64_t messagesOut = 0;
+    uint64_t partialWrites = 0;     // sends the socket only took part of
+    size_t queuedMessages = 0;      // waiting to be sent right now
+    double serializeSeconds = 0.0;  // framing and packet building on the I/O thread
+    double syscallSeconds = 0.0;    // inside send and receive calls
+    double rtt = 0.0;               // smoothed round trip time in seconds, 0 until measured
+};
+
+// Adds the time from construction to destruction to a running total
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double& total) : total(total), start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        total += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    double& total;
+    std::chrono::steady_clock::time_point start;
+};
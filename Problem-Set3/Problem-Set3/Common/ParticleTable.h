@@ -0,0 +1,100 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Protocol.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Client side of per-client particle updates. Keeps the last position and
+// velocity received for every particle and turns each partial update into a
+// full snapshot for the jitter buffer, moving particles that were not in the
+// update along their last velocity. The server resends a particle before
+// that straight line drifts too far, so this is dead reckoning with the
+// server watching the error.
+//
+// Ids not heard from since the scene changed, last heard of as removed, or
+// not refreshed for particleExpiryMs are left out; the expiry clears any
+// particle whose removal never arrived. Every particle is listed with its id,
+// in id order.
+class ParticleTable {
+public:
+    ParticleTable() : sceneVersion(0), knownCount(0), lastTick(0) {}
+
+    // Returns false, leaving snapshot alone, for an update older than one
+    // already applied, which a lossy link can deliver out of order
+    bool apply(ParticleUpdateMessage& update, SnapshotMessage& snapshot) {
+        if (lastTick != 0 && update.tick <= lastTick) {
+            return false;
+        }
+        lastTick = update.tick;
+        if (update.sceneVersion != sceneVersion || update.particleCount < entries.size()) {
+            sceneVersion = update.sceneVersion;
+            entries.assign(update.particleCount, Entry());
+            knownCount = 0;
+        }
+        // Emitters add ids within a scene
+        entries.resize(update.particleCount);
+        // Removals first: an id can die and be reused by a new particle
+        // before the client hears of either
+        for (uint32_t id : update.removed) {
+            forget(entries[id]);
+        }
+        for (size_t i = 0; i < update.indices.size(); ++i) {
+            Entry& entry = entries[update.indices[i]];
+            if (!entry.known) {
+                entry.known = true;
+                ++knownCount;
+            }
+            entry.position = update.positions[i];
+            entry.velocity = update.velocities[i];
+            entry.timeMs = update.serverTimeMs;
+        }
+
+        snapshot.tick = update.tick;
+        snapshot.serverTimeMs = update.serverTimeMs;
+        snapshot.players = std::move(update.players);
+        snapshot.particles.clear();
+        snapshot.ids.clear();
+        snapshot.particles.reserve(knownCount);
+        snapshot.ids.reserve(knownCount);
+        for (uint32_t id = 0; id < entries.size(); ++id) {
+            Entry& entry = entries[id];
+            if (!entry.known) {
+                continue;
+            }
+            uint32_t age = update.serverTimeMs - entry.timeMs;
+            if (age > particleExpiryMs) {
+                forget(entry);
+                continue;
+            }
+            // The same arithmetic the server uses to judge the error
+            float seconds = static_cast<int32_t>(age) / 1000.0f;
+            snapshot.particles.push_back(entry.position + entry.velocity * seconds);
+            snapshot.ids.push_back(id);
+        }
+        return true;
+    }
+
+private:
+    struct Entry {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+        uint32_t timeMs = 0;    // server time the position was sent for
+        bool known = false;
+    };
+
+    uint32_t sceneVersion;
+    std::vector<Entry> entries;
+    size_t knownCount;
+    uint64_t lastTick;
+
+    void forget(Entry& entry) {
+        if (entry.known) {
+            entry.known = false;
+            --knownCount;
+        }
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Protocol.h"
+#include "WallSegments.h"
+
+#include <cstdint>
+
+// Explorer movement rules. The server applies them to every input command it
+// receives and the client runs the same code to predict its own sprite, so
+// the two agree unless the server knows something the client does not.
+constexpr float playerRadius = 5.0f;
+constexpr float playerSpeed = 5.0f;      // pixels per input command
+constexpr int inputTickMilliseconds = 10;
+const sf::Vector2f playerSpawnPoint(640.0f, 360.0f);
+
+// The sprite is drawn from its top-left corner, so its centre is one radius
+// in from position
+inline bool collidesWithWalls(const sf::Vector2f& position, const WallSegments& walls, float canvasWidth, float canvasHeight) {
+    // Check if the position is outside the canvas boundaries
+    if (position.x < 0 || position.x >= canvasWidth || position.y < 0 || position.y >= canvasHeight) {
+        return true; // Collision detected with canvas boundaries
+    }
+    return walls.touchesCircle(position + sf::Vector2f(playerRadius, playerRadius));
+}
+
+// Apply one input command to a player position
+inline sf::Vector2f movePlayer(sf::Vector2f position, uint8_t keys, const WallSegments& walls, float canvasWidth, float canvasHeight) {
+    if ((keys & inputUp) && position.y >= 0) {
+        sf::Vector2f nextPosition = position;
+        nextPosition.y -= playerSpeed;
+        if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
+            position = nextPosition;
+        }
+    }
+    if ((keys & inputLeft) && position.x >= 0) {
+        sf::Vector2f nextPosition = position;
+        nextPosition.x -= playerSpeed;
+        if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
+            position = nextPosition;
+        }
+    }
+    if ((keys & inputDown) && position.y + 2 * playerRadius < canvasHeight) {
+        sf::Vector2f nextPosition = position;
+        nextPosition.y += playerSpeed;
+        if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
+            position = nextPosition;
+        }
+    }
+    if ((keys & inputRight) && position.x + 2 * playerRadius < canvasWidth) {
+        sf::Vector2f nextPosition = position;
+        nextPosition.x += playerSpeed;
+        if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
+            position = nextPosition;
+        }
+    }
+    return position;
+}
@@ -0,0 +1,561 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary messages exchanged between the server and its clients. Every message
+// starts with a one-byte type; integers are little-endian. Positions are sent
+// as 16-bit fixed point with 1/16 px resolution, at a quarter of the size of
+// the old text format. That reaches 4095.9375 px, so the server accepts no
+// canvas side larger than maxEncodedPosition.
+enum class MessageType : uint8_t {
+    Welcome = 1,        // server -> client: the client's player ID
+    Snapshot = 2,       // server -> client: particles and every player
+    InputBatch = 3,     // client -> server: input commands since the last batch
+    Subscribe = 4,      // client -> server: only watch, without a player (relays)
+    ParticleUpdate = 5, // server -> client: every player and a budgeted subset of particles
+    UpdateAck = 6,      // client -> server: the newest particle update applied
+    Walls = 7           // server -> client: part of the wall segments, reliably
+};
+
+using PlayerId = uint32_t;
+
+struct PlayerState {
+    PlayerId id;
+    sf::Vector2f position;
+    uint32_t lastInput = 0;  // sequence of the last input command applied
+};
+
+// Keys held during one client input tick
+constexpr uint8_t inputUp = 1;
+constexpr uint8_t inputLeft = 2;
+constexpr uint8_t inputDown = 4;
+constexpr uint8_t inputRight = 8;
+
+// One client tick of input. Sequence numbers start at 1 and only commands
+// with keys held are numbered and sent.
+struct InputCommand {
+    uint32_t sequence;
+    uint32_t tick;
+    uint8_t keys;
+};
+
+constexpr size_t maxInputBatch = 255;
+
+constexpr float positionScale = 16.0f;
+constexpr float maxEncodedPosition = 65535.0f / positionScale;
+
+// Velocities are signed 16-bit fixed point with 1/8 px/s resolution, enough
+// for anything up to about 4000 px/s
+constexpr float velocityScale = 8.0f;
+constexpr float maxEncodedVelocity = 32767.0f / velocityScale;
+
+// Positions outside the encodable range are clamped to its edges. The
+// server's canvas fits inside it, so the positions it sends and records are
+// never clamped.
+inline uint16_t quantizePosition(float value) {
+    float clamped = std::clamp(value, 0.0f, maxEncodedPosition);
+    return static_cast<uint16_t>(clamped * positionScale + 0.5f);
+}
+
+inline int16_t quantizeVelocity(float value) {
+    float clamped = std::clamp(value, -maxEncodedVelocity, maxEncodedVelocity);
+    return static_cast<int16_t>(std::lround(clamped * velocityScale));
+}
+
+// What the receiver decodes for a position or velocity that was sent, so a
+// sender can track exactly what the other side believes
+inline sf::Vector2f receivedPosition(sf::Vector2f position) {
+    return sf::Vector2f(quantizePosition(position.x) / positionScale, quantizePosition(position.y) / positionScale);
+}
+
+inline sf::Vector2f receivedVelocity(sf::Vector2f velocity) {
+    return sf::Vector2f(quantizeVelocity(velocity.x) / velocityScale, quantizeVelocity(velocity.y) / velocityScale);
+}
+
+class ByteWriter {
+public:
+    explicit ByteWriter(std::string& out) : out(out) {}
+
+    void writeU8(uint8_t value) {
+        out.push_back(static_cast<char>(value));
+    }
+
+    void writeU16(uint16_t value) {
+        writeU8(static_cast<uint8_t>(value));
+        writeU8(static_cast<uint8_t>(value >> 8));
+    }
+
+    void writeU32(uint32_t value) {
+        writeU16(static_cast<uint16_t>(value));
+        writeU16(static_cast<uint16_t>(value >> 16));
+    }
+
+    void writeU64(uint64_t value) {
+        writeU32(static_cast<uint32_t>(value));
+        writeU32(static_cast<uint32_t>(value >> 32));
+    }
+
+    void writeF32(float value) {
+        writeU32(std::bit_cast<uint32_t>(value));
+    }
+
+    // 7 bits a byte, low bits first; small values take one byte
+    void writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            writeU8(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        writeU8(static_cast<uint8_t>(value));
+    }
+
+    // Zigzag, so small negative values are small too
+    void writeSignedVarint(int64_t value) {
+        writeVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+    }
+
+    void writePosition(sf::Vector2f position) {
+        writeU16(quantizePosition(position.x));
+        writeU16(quantizePosition(position.y));
+    }
+
+    void writeVelocity(sf::Vector2f velocity) {
+        writeU16(static_cast<uint16_t>(quantizeVelocity(velocity.x)));
+        writeU16(static_cast<uint16_t>(quantizeVelocity(velocity.y)));
+    }
+
+private:
+    std::string& out;
+};
+
+// Reads never run past the end; once a read fails every later read fails
+// too and ok() reports false
+class ByteReader {
+public:
+    ByteReader(const char* data, size_t size) : data(data), size(size), offset(0), valid(true) {}
+
+    bool ok() const {
+        return valid;
+    }
+
+    size_t remaining() const {
+        return size - offset;
+    }
+
+    uint8_t readU8() {
+        if (!valid || offset >= size) {
+            valid = false;
+            return 0;
+        }
+        return static_cast<uint8_t>(data[offset++]);
+    }
+
+    uint16_t readU16() {
+        uint16_t low = readU8();
+        return static_cast<uint16_t>(low | (readU8() << 8));
+    }
+
+    uint32_t readU32() {
+        uint32_t low = readU16();
+        return low | (static_cast<uint32_t>(readU16()) << 16);
+    }
+
+    uint64_t readU64() {
+        uint64_t low = readU32();
+        return low | (static_cast<uint64_t>(readU32()) << 32);
+    }
+
+    float readF32() {
+        return std::bit_cast<float>(readU32());
+    }
+
+    uint64_t readVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t byte = readU8();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        valid = false;
+        return 0;
+    }
+
+    int64_t readSignedVarint() {
+        uint64_t value = readVarint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    sf::Vector2f readPosition() {
+        float x = readU16() / positionScale;
+        float y = readU16() / positionScale;
+        return sf::Vector2f(x, y);
+    }
+
+    sf::Vector2f readVelocity() {
+        float x = static_cast<int16_t>(readU16()) / velocityScale;
+        float y = static_cast<int16_t>(readU16()) / velocityScale;
+        return sf::Vector2f(x, y);
+    }
+
+private:
+    const char* data;
+    size_t size;
+    size_t offset;
+    bool valid;
+};
+
+inline bool peekMessageType(const char* data, size_t size, MessageType& type) {
+    if (size == 0) {
+        return false;
+    }
+    type = static_cast<MessageType>(static_cast<uint8_t>(data[0]));
+    return true;
+}
+
+inline std::string encodeWelcome(PlayerId playerId) {
+    std::string out;
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::Welcome));
+    writer.writeU32(playerId);
+    return out;
+}
+
+inline bool decodeWelcome(const char* data, size_t size, PlayerId& playerId) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::Welcome) {
+        return false;
+    }
+    playerId = reader.readU32();
+    return reader.ok();
+}
+
+inline std::string encodeSubscribe() {
+    std::string out;
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::Subscribe));
+    return out;
+}
+
+// At most maxInputBatch commands; callers send larger backlogs in pieces
+inline std::string encodeInputBatch(const InputCommand* commands, size_t count) {
+    count = std::min(count, maxInputBatch);
+    std::string out;
+    out.reserve(2 + count * 9);
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::InputBatch));
+    writer.writeU8(static_cast<uint8_t>(count));
+    for (size_t i = 0; i < count; ++i) {
+        writer.writeU32(commands[i].sequence);
+        writer.writeU32(commands[i].tick);
+        writer.writeU8(commands[i].keys);
+    }
+    return out;
+}
+
+inline bool decodeInputBatch(const char* data, size_t size, std::vector<InputCommand>& commands) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::InputBatch) {
+        return false;
+    }
+    commands.resize(reader.readU8());
+    for (InputCommand& command : commands) {
+        command.sequence = reader.readU32();
+        command.tick = reader.readU32();
+        command.keys = reader.readU8();
+    }
+    return reader.ok();
+}
+
+// One snapshot serves every client: it lists all players once and each client
+// skips its own entry, so the server never builds per-pair data. A client's
+// own entry carries the last input the server applied for reconciliation.
+//
+// Every particle carries its id, so a client can match particles between
+// snapshots even when births and deaths reorder them. The ids follow the
+// positions as varint differences from the previous id, which is about a
+// byte each since the server keeps particles mostly in id order.
+struct SnapshotMessage {
+    uint64_t tick = 0;
+    uint32_t serverTimeMs = 0;  // when the server simulated this tick
+    std::vector<PlayerState> players;
+    std::vector<sf::Vector2f> particles;
+    std::vector<uint32_t> ids;  // each particle's id
+};
+
+// Replaces out with the message, keeping its buffer, so a sender that
+// encodes every tick can reuse its strings. ids holds one id per particle.
+inline void encodeSnapshot(uint64_t tick, uint32_t serverTimeMs, const std::vector<PlayerState>& players, const std::vector<sf::Vector2f>& particles,
+    const std::vector<uint32_t>& ids, std::string& out) {
+    out.clear();
+    out.reserve(1 + 8 + 4 + 4 + players.size() * 12 + 4 + particles.size() * 5);
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::Snapshot));
+    writer.writeU64(tick);
+    writer.writeU32(serverTimeMs);
+    writer.writeU32(static_cast<uint32_t>(players.size()));
+    for (const PlayerState& player : players) {
+        writer.writeU32(player.id);
+        writer.writePosition(player.position);
+        writer.writeU32(player.lastInput);
+    }
+    writer.writeU32(static_cast<uint32_t>(particles.size()));
+    for (const sf::Vector2f& position : particles) {
+        writer.writePosition(position);
+    }
+    int64_t previous = -1;
+    for (uint32_t id : ids) {
+        writer.writeSignedVarint(static_cast<int64_t>(id) - previous - 1);
+        previous = id;
+    }
+}
+
+inline bool decodeSnapshot(const char* data, size_t size, SnapshotMessage& snapshot) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::Snapshot) {
+        return false;
+    }
+    snapshot.tick = reader.readU64();
+    snapshot.serverTimeMs = reader.readU32();
+
+    // Counts are checked against the bytes left before anything is allocated
+    uint32_t playerCount = reader.readU32();
+    if (!reader.ok() || playerCount > reader.remaining() / 12) {
+        return false;
+    }
+    snapshot.players.resize(playerCount);
+    for (PlayerState& player : snapshot.players) {
+        player.id = reader.readU32();
+        player.position = reader.readPosition();
+        player.lastInput = reader.readU32();
+    }
+
+    uint32_t particleCount = reader.readU32();
+    if (!reader.ok() || particleCount > reader.remaining() / 5) {
+        return false;
+    }
+    snapshot.particles.resize(particleCount);
+    for (sf::Vector2f& position : snapshot.particles) {
+        position = reader.readPosition();
+    }
+    snapshot.ids.resize(particleCount);
+    int64_t previous = -1;
+    for (uint32_t& id : snapshot.ids) {
+        int64_t next = previous + 1 + reader.readSignedVarint();
+        if (next < 0 || next > UINT32_MAX) {
+            return false;
+        }
+        id = static_cast<uint32_t>(next);
+        previous = next;
+    }
+    return reader.ok();
+}
+
+// A snapshot cut down to what one client needs. Players are always complete;
+// particles are a subset, each tagged with its id on the server and sent with
+// its velocity, followed by the ids whose particles have died since the
+// client last heard of them. The client keeps a table of the last position
+// and velocity seen for every id, moves each particle in
+// a straight line from there until it hears otherwise, and starts a new table
+// whenever sceneVersion changes, because the server then has a different set
+// of particles.
+struct ParticleUpdateMessage {
+    uint64_t tick = 0;
+    uint32_t serverTimeMs = 0;
+    uint32_t sceneVersion = 0;
+    uint32_t particleCount = 0;     // every particle id is below this
+    std::vector<PlayerState> players;
+    std::vector<uint32_t> indices;
+    std::vector<sf::Vector2f> positions;
+    std::vector<sf::Vector2f> velocities;
+    std::vector<uint32_t> removed;
+};
+
+// A client forgets a particle it has not heard about for this long. The
+// server refreshes every live particle well within it, and stops repeating
+// the removal of a dead one after it.
+constexpr uint32_t particleExpiryMs = 10000;
+
+constexpr size_t particleUpdateEntrySize = 12;
+constexpr size_t particleUpdateRemovedSize = 4;
+
+// Bytes used by everything except the particle entries and removed ids
+inline size_t particleUpdateHeaderSize(size_t playerCount) {
+    return 1 + 8 + 4 + 4 + 4 + 4 + playerCount * 12 + 4 + 4;
+}
+
+// Sends particles[i], under the id ids[i], for each i in chosen. Without ids
+// each particle's id is its position in particles. Replaces out, keeping its
+// buffer.
+inline void encodeParticleUpdate(uint64_t tick, uint32_t serverTimeMs, uint32_t sceneVersion, uint32_t particleCount,
+    const std::vector<PlayerState>& players, const std::vector<uint32_t>& chosen, const std::vector<uint32_t>& ids,
+    const std::vector<sf::Vector2f>& particles, const std::vector<sf::Vector2f>& velocities, const std::vector<uint32_t>& removed,
+    std::string& out) {
+    out.clear();
+    out.reserve(particleUpdateHeaderSize(players.size()) + chosen.size() * particleUpdateEntrySize + removed.size() * particleUpdateRemovedSize);
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::ParticleUpdate));
+    writer.writeU64(tick);
+    writer.writeU32(serverTimeMs);
+    writer.writeU32(sceneVersion);
+    writer.writeU32(particleCount);
+    writer.writeU32(static_cast<uint32_t>(players.size()));
+    for (const PlayerState& player : players) {
+        writer.writeU32(player.id);
+        writer.writePosition(player.position);
+        writer.writeU32(player.lastInput);
+    }
+    writer.writeU32(static_cast<uint32_t>(chosen.size()));
+    for (uint32_t index : chosen) {
+        writer.writeU32(ids.empty() ? index : ids[index]);
+        writer.writePosition(particles[index]);
+        writer.writeVelocity(index < velocities.size() ? velocities[index] : sf::Vector2f());
+    }
+    writer.writeU32(static_cast<uint32_t>(removed.size()));
+    for (uint32_t id : removed) {
+        writer.writeU32(id);
+    }
+}
+
+inline bool decodeParticleUpdate(const char* data, size_t size, ParticleUpdateMessage& update) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::ParticleUpdate) {
+        return false;
+    }
+    update.tick = reader.readU64();
+    update.serverTimeMs = reader.readU32();
+    update.sceneVersion = reader.readU32();
+    update.particleCount = reader.readU32();
+
+    uint32_t playerCount = reader.readU32();
+    if (!reader.ok() || playerCount > reader.remaining() / 12) {
+        return false;
+    }
+    update.players.resize(playerCount);
+    for (PlayerState& player : update.players) {
+        player.id = reader.readU32();
+        player.position = reader.readPosition();
+        player.lastInput = reader.readU32();
+    }
+
+    uint32_t entryCount = reader.readU32();
+    if (!reader.ok() || entryCount > reader.remaining() / particleUpdateEntrySize) {
+        return false;
+    }
+    update.indices.resize(entryCount);
+    update.positions.resize(entryCount);
+    update.velocities.resize(entryCount);
+    for (uint32_t i = 0; i < entryCount; ++i) {
+        update.indices[i] = reader.readU32();
+        update.positions[i] = reader.readPosition();
+        update.velocities[i] = reader.readVelocity();
+        if (update.indices[i] >= update.particleCount) {
+            return false;
+        }
+    }
+
+    uint32_t removedCount = reader.readU32();
+    if (!reader.ok() || removedCount > reader.remaining() / particleUpdateRemovedSize) {
+        return false;
+    }
+    update.removed.resize(removedCount);
+    for (uint32_t& id : update.removed) {
+        id = reader.readU32();
+        if (id >= update.particleCount) {
+            return false;
+        }
+    }
+    return reader.ok();
+}
+
+// Sent by a client after each particle update it applies, so the server can
+// stop repeating the removals that update carried
+inline std::string encodeUpdateAck(uint64_t tick) {
+    std::string out;
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(MessageType::UpdateAck));
+    writer.writeU64(tick);
+    return out;
+}
+
+inline bool decodeUpdateAck(const char* data, size_t size, uint64_t& tick) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::UpdateAck) {
+        return false;
+    }
+    tick = reader.readU64();
+    return reader.ok();
+}
+
+// The walls, sent on the reliable channel when a client joins and after every
+// wall edit. Each wall is sent as its segments, in pieces small enough for
+// UDP's reliable messages; they arrive in order, and a client replaces its
+// walls once it has every segment of one version. Ends are sent as floats so
+// the client's prediction collides with exactly the server's walls.
+struct WallsMessage {
+    uint32_t version = 0;           // changes with every wall edit
+    uint32_t segmentCount = 0;      // segments in the whole set
+    uint32_t firstSegment = 0;      // where this piece starts
+    std::vector<sf::Vector2f> ends; // two per segment
+};
+
+constexpr size_t wallsHeaderSize = 1 + 4 + 4 + 4 + 4;
+constexpr size_t wallSegmentSize = 16;
+constexpr size_t maxWallSegmentsPerMessage = 60;
+
+// The messages that carry a set of walls, given as the two ends of each
+// segment in turn. There is always at least one, so a client also hears
+// that the walls were cleared.
+inline std::vector<std::string> encodeWalls(uint32_t version, const std::vector<sf::Vector2f>& ends) {
+    uint32_t segmentCount = static_cast<uint32_t>(ends.size() / 2);
+    std::vector<std::string> messages;
+    uint32_t first = 0;
+    do {
+        uint32_t count = std::min<uint32_t>(segmentCount - first, maxWallSegmentsPerMessage);
+        std::string& out = messages.emplace_back();
+        out.reserve(wallsHeaderSize + count * wallSegmentSize);
+        ByteWriter writer(out);
+        writer.writeU8(static_cast<uint8_t>(MessageType::Walls));
+        writer.writeU32(version);
+        writer.writeU32(segmentCount);
+        writer.writeU32(first);
+        writer.writeU32(count);
+        for (uint32_t i = first * 2; i < (first + count) * 2; ++i) {
+            writer.writeF32(ends[i].x);
+            writer.writeF32(ends[i].y);
+        }
+        first += count;
+    } while (first < segmentCount);
+    return messages;
+}
+
+inline bool decodeWalls(const char* data, size_t size, WallsMessage& walls) {
+    ByteReader reader(data, size);
+    if (static_cast<MessageType>(reader.readU8()) != MessageType::Walls) {
+        return false;
+    }
+    walls.version = reader.readU32();
+    walls.segmentCount = reader.readU32();
+    walls.firstSegment = reader.readU32();
+    uint32_t count = reader.readU32();
+    if (!reader.ok() || count > reader.remaining() / wallSegmentSize || walls.firstSegment > walls.segmentCount
+        || count > walls.segmentCount - walls.firstSegment) {
+        return false;
+    }
+    walls.ends.resize(count * 2);
+    for (sf::Vector2f& end : walls.ends) {
+        end.x = reader.readF32();
+        end.y = reader.readF32();
+        if (!std::isfinite(end.x) || !std::isfinite(end.y)) {
+            return false;
+        }
+    }
+    return reader.ok();
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Framing.h"
+#include "UdpTransport.h"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Client side of the connection to the server. Over TCP every message is a
+// frame on one stream; over UDP snapshots arrive on the unreliable channel and
+// everything the client sends goes on the reliable-ordered channel.
+class ServerLink {
+public:
+    using MessageHandler = std::function<void(const char*, size_t)>;
+
+    ServerLink() : tcpSocket(INVALID_SOCKET), udpId(0), connected(false) {}
+
+    ~ServerLink() {
+        close();
+    }
+
+    ServerLink(const ServerLink&) = delete;
+    ServerLink& operator=(const ServerLink&) = delete;
+
+    // The handler runs on the link's receive thread and may be set at any time
+    void setMessageHandler(MessageHandler handler) {
+        std::lock_guard<std::mutex> lock(handlerMutex);
+        onMessage = std::move(handler);
+    }
+
+    bool connectTcp(const std::string& host, uint16_t port) {
+        tcpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (tcpSocket == INVALID_SOCKET) {
+            std::cout << "Error at socket(): " << socketError() << std::endl;
+            return false;
+        }
+        // The receive window is agreed during the handshake
+        setBufferSizes(tcpSocket, sendBufferBytes, receiveBufferBytes);
+
+        sockaddr_in service{};
+        service.sin_family = AF_INET;
+        inet_pton(AF_INET, host.c_str(), &service.sin_addr);
+        service.sin_port = htons(port);
+        if (connect(tcpSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
+            std::cout << "Failed to connect." << std::endl;
+            closesocket(tcpSocket);
+            tcpSocket = INVALID_SOCKET;
+            return false;
+        }
+
+        setNoDelay(tcpSocket);
+        connected = true;
+        receiveThread = std::thread([this] {
+            std::string payload;
+            while (receiveFrame(tcpSocket, payload)) {
+                deliver(payload.data(), payload.size());
+            }
+            connected = false;
+        });
+        return true;
+    }
+
+    bool connectUdp(const std::string& host, uint16_t port) {
+        udpIo = std::make_unique<UdpSocketIo>();
+        if (!udpIo->open(0)) {
+            udpIo.reset();
+            return false;
+        }
+        udp = std::make_unique<UdpTransport>(*udpIo);
+        udp->onConnect = [this](UdpTransport::ConnectionId) { connected = true; };
+        udp->onDisconnect = [this](UdpTransport::ConnectionId) { connected = false; };
+        udp->onUnreliable = [this](UdpTransport::ConnectionId, const char* data, size_t size) {
+            deliver(data, size);
+        };
+        udp->onReliable = udp->onUnreliable;
+        udpId = udp->connect(UdpAddress::fromString(host, port));
+        udp->start();
+        return true;
+    }
+
+    // Thread-safe
+    bool send(const std::string& payload) {
+        if (udp) {
+            return udp->sendReliable(udpId, payload);
+        }
+        std::lock_guard<std::mutex> lock(sendMutex);
+        return tcpSocket != INVALID_SOCKET && sendFrame(tcpSocket, payload);
+    }
+
+    bool isConnected() const {
+        return connected;
+    }
+
+    void close() {
+        if (udp) {
+            udp->stop();
+            udp.reset();
+            udpIo.reset();
+        }
+        if (tcpSocket != INVALID_SOCKET) {
+            shutdownSocket(tcpSocket);
+            if (receiveThread.joinable()) {
+                receiveThread.join();
+            }
+            closesocket(tcpSocket);
+            tcpSocket = INVALID_SOCKET;
+        }
+    }
+
+private:
+    // The client mostly receives snapshots and sends small input batches
+    static constexpr int sendBufferBytes = 64 * 1024;
+    static constexpr int receiveBufferBytes = 1024 * 1024;
+
+    SOCKET tcpSocket;
+    std::mutex handlerMutex;
+    MessageHandler onMessage;
+    std::thread receiveThread;
+    std::mutex sendMutex;
+    std::unique_ptr<UdpSocketIo> udpIo;
+    std::unique_ptr<UdpTransport> udp;
+    UdpTransport::ConnectionId udpId;
+    std::atomic<bool> connected;
+
+    void deliver(const char* data, size_t size) {
+        std::lock_guard<std::mutex> lock(handlerMutex);
+        if (onMessage) {
+            onMessage(data, size);
+        }
+    }
+};
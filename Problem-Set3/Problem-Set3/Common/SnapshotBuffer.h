@@ -0,0 +1,208 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "Protocol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Client-side jitter buffer. Snapshots are kept in server tick order and the
+// view is drawn a little in the past, between two snapshots that have both
+// arrived, so uneven arrival times never show up as stutter. The render delay
+// follows the measured snapshot interval and arrival jitter. If the next
+// snapshot is late the view is extrapolated from the last two for a short
+// while, then held.
+class SnapshotBuffer {
+public:
+    struct Settings {
+        double minDelay = 0.02;          // seconds
+        double maxDelay = 0.5;
+        double maxExtrapolation = 0.25;  // bridge gaps up to this long
+        size_t capacity = 32;            // snapshots kept
+    };
+
+    SnapshotBuffer() : SnapshotBuffer(Settings()) {}
+
+    explicit SnapshotBuffer(Settings settings)
+        : settings(settings), hasClock(false), clockOffset(0), jitter(0), interval(0.05), delay(0.1) {}
+
+    // arrivalTime is the client's steady clock in seconds
+    void push(SnapshotMessage snapshot, double arrivalTime) {
+        if (!snapshots.empty() && snapshot.tick <= consumedTick) {
+            return;
+        }
+        double serverTime = snapshot.serverTimeMs / 1000.0;
+        updateTiming(serverTime, arrivalTime);
+
+        auto position = std::find_if(snapshots.begin(), snapshots.end(), [&](const Entry& entry) {
+            return entry.snapshot.tick >= snapshot.tick;
+        });
+        if (position != snapshots.end() && position->snapshot.tick == snapshot.tick) {
+            return;
+        }
+        snapshots.insert(position, { serverTime, std::move(snapshot) });
+        while (snapshots.size() > settings.capacity) {
+            snapshots.pop_front();
+        }
+    }
+
+    // Fill in the world as it should look at localTime. Returns false until
+    // the first snapshot has arrived.
+    bool sample(double localTime, std::vector<sf::Vector2f>& particles, std::vector<PlayerState>& players) {
+        if (snapshots.empty()) {
+            return false;
+        }
+        double renderTime = localTime - clockOffset - delay;
+
+        // Drop snapshots that are entirely in the past, keeping one before renderTime
+        while (snapshots.size() > 2 && snapshots[1].serverTime <= renderTime) {
+            snapshots.pop_front();
+        }
+        consumedTick = snapshots.front().snapshot.tick;
+
+        const Entry& from = snapshots.front();
+        if (snapshots.size() == 1 || renderTime <= from.serverTime) {
+            particles = from.snapshot.particles;
+            players = from.snapshot.players;
+            return true;
+        }
+
+        // Interpolate between the two snapshots around renderTime, or
+        // extrapolate past the newest one for a bounded time
+        const Entry& to = snapshots[1];
+        double span = to.serverTime - from.serverTime;
+        double limit = to.serverTime + settings.maxExtrapolation;
+        double t = span > 0 ? (std::min(renderTime, limit) - from.serverTime) / span : 1.0;
+        blend(from.snapshot, to.snapshot, static_cast<float>(t), particles, players);
+        return true;
+    }
+
+    // Current render delay and measured jitter, in seconds
+    double renderDelay() const {
+        return delay;
+    }
+
+    double measuredJitter() const {
+        return jitter;
+    }
+
+    size_t buffered() const {
+        return snapshots.size();
+    }
+
+private:
+    struct Entry {
+        double serverTime;
+        SnapshotMessage snapshot;
+    };
+
+    Settings settings;
+    std::deque<Entry> snapshots;
+    uint64_t consumedTick = 0;
+    bool hasClock;
+    double clockOffset;   // local time minus server time on the fastest path seen
+    double jitter;        // smoothed extra transit time above the fastest path
+    double interval;      // smoothed server time between snapshots
+    double delay;
+    double lastServerTime = 0;
+
+    // Scratch for blend: where each id is in the older snapshot
+    static constexpr uint32_t noParticle = UINT32_MAX;
+    static constexpr size_t maxSparseIds = 1 << 20;
+    std::vector<uint32_t> fromIndex;
+
+    void updateTiming(double serverTime, double arrivalTime) {
+        double offset = arrivalTime - serverTime;
+        if (!hasClock) {
+            hasClock = true;
+            clockOffset = offset;
+            lastServerTime = serverTime;
+            return;
+        }
+
+        // Follow a faster path at once and drift slowly towards a slower one,
+        // so clock drift and route changes are tracked without chasing jitter
+        if (offset < clockOffset) {
+            clockOffset = offset;
+        }
+        else {
+            clockOffset += (offset - clockOffset) * 0.002;
+        }
+        jitter += ((offset - clockOffset) - jitter) * 0.1;
+
+        if (serverTime > lastServerTime) {
+            interval += ((serverTime - lastServerTime) - interval) * 0.1;
+            lastServerTime = serverTime;
+        }
+
+        // One snapshot interval plus headroom for late arrivals, changed
+        // gradually so the view does not jump when the network does
+        double target = std::clamp(interval + 2.0 * jitter, settings.minDelay, settings.maxDelay);
+        delay += (target - delay) * 0.05;
+    }
+
+    static sf::Vector2f lerp(sf::Vector2f a, sf::Vector2f b, float t) {
+        return a + (b - a) * t;
+    }
+
+    void blend(const SnapshotMessage& from, const SnapshotMessage& to, float t,
+        std::vector<sf::Vector2f>& particles, std::vector<PlayerState>& players) {
+        // Particles are matched by id. One born since the older snapshot is
+        // drawn where the newer one has it, and one that has died is not
+        // drawn. When nothing was born or died the lists line up by index.
+        particles.resize(to.particles.size());
+        bool hasIds = from.ids.size() == from.particles.size() && to.ids.size() == to.particles.size();
+        uint32_t maxId = 0;
+        for (uint32_t id : from.ids) {
+            maxId = std::max(maxId, id);
+        }
+        // The server's ids are dense; far larger ones are not worth a table
+        bool denseIds = maxId < from.ids.size() * 4 + maxSparseIds;
+        if (hasIds && from.ids == to.ids) {
+            for (size_t i = 0; i < to.particles.size(); ++i) {
+                particles[i] = lerp(from.particles[i], to.particles[i], t);
+            }
+        }
+        else if (hasIds && denseIds) {
+            fromIndex.assign(from.ids.empty() ? 0 : static_cast<size_t>(maxId) + 1, noParticle);
+            for (size_t i = 0; i < from.ids.size(); ++i) {
+                fromIndex[from.ids[i]] = static_cast<uint32_t>(i);
+            }
+            for (size_t i = 0; i < to.particles.size(); ++i) {
+                uint32_t id = to.ids[i];
+                uint32_t previous = id < fromIndex.size() ? fromIndex[id] : noParticle;
+                particles[i] = previous != noParticle ? lerp(from.particles[previous], to.particles[i], t) : to.particles[i];
+            }
+        }
+        else {
+            particles = to.particles;
+        }
+
+        // Players are matched by ID; a player that just joined is not moved.
+        // The server keeps players in a stable order, so the same index
+        // almost always matches and the search is the rare fallback.
+        players = to.players;
+        for (size_t i = 0; i < players.size(); ++i) {
+            PlayerState& player = players[i];
+            const PlayerState* previous = nullptr;
+            if (i < from.players.size() && from.players[i].id == player.id) {
+                previous = &from.players[i];
+            }
+            else {
+                auto it = std::find_if(from.players.begin(), from.players.end(), [&](const PlayerState& candidate) {
+                    return candidate.id == player.id;
+                });
+                if (it != from.players.end()) {
+                    previous = &*it;
+                }
+            }
+            if (previous) {
+                player.position = lerp(previous->position, player.position, t);
+            }
+        }
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <string>
+
+// Thin socket layer shared by the server and the clients. The same code
+// builds against Winsock and BSD sockets; nothing outside this header needs
+// to include a platform socket header or call WSAStartup itself.
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mstcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+typedef int SOCKET;
+typedef struct sockaddr SOCKADDR;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+inline int closesocket(SOCKET socket) {
+    return ::close(socket);
+}
+#endif
+
+// Socket library lifetime for one process. Winsock must be started before any
+// socket call and cleaned up at exit; BSD sockets need neither.
+class SocketLibrary {
+public:
+    SocketLibrary() : started(false) {
+#ifdef _WIN32
+        WSADATA wsaData;
+        started = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+        if (started) {
+            status = wsaData.szSystemStatus;
+        }
+#else
+        started = true;
+        status = "BSD sockets";
+#endif
+    }
+
+    ~SocketLibrary() {
+#ifdef _WIN32
+        if (started) {
+            WSACleanup();
+        }
+#endif
+    }
+
+    SocketLibrary(const SocketLibrary&) = delete;
+    SocketLibrary& operator=(const SocketLibrary&) = delete;
+
+    bool ok() const {
+        return started;
+    }
+
+    const std::string& description() const {
+        return status;
+    }
+
+private:
+    bool started;
+    std::string status;
+};
+
+// Keep a dead peer from raising SIGPIPE on POSIX
+#ifdef MSG_NOSIGNAL
+constexpr int socketSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int socketSendFlags = 0;
+#endif
+
+// Stop both directions of a connected socket, waking any thread blocked in
+// recv on it
+inline int shutdownSocket(SOCKET socket) {
+#ifdef _WIN32
+    return shutdown(socket, SD_BOTH);
+#else
+    return shutdown(socket, SHUT_RDWR);
+#endif
+}
+
+// Switch a socket to non-blocking mode
+inline bool setNonBlocking(SOCKET socket) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags != -1 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Send small messages such as inputs straight away instead of waiting to
+// coalesce them with later writes
+inline bool setNoDelay(SOCKET socket) {
+    int noDelay = 1;
+    return setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay)) == 0;
+}
+
+// Kernel send and receive buffer sizes in bytes. Larger buffers absorb bursts
+// such as a full snapshot going out to every client at once.
+inline bool setBufferSizes(SOCKET socket, int sendBytes, int receiveBytes) {
+    bool ok = setsockopt(socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&sendBytes), sizeof(sendBytes)) == 0;
+    return setsockopt(socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&receiveBytes), sizeof(receiveBytes)) == 0 && ok;
+}
+
+// Last socket error code for the calling thread
+inline int socketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// One piece of a gathered send
+struct SendBuffer {
+    const char* data;
+    size_t size;
+};
+
+constexpr size_t maxSendBuffers = 32;
+
+// Send up to maxSendBuffers buffers with a single system call (WSASend or
+// sendmsg), so a small header and a large shared body go out together without
+// first being copied into one buffer. Returns the number of bytes sent, which
+// may stop part way through any buffer, or SOCKET_ERROR.
+inline int sendGather(SOCKET socket, const SendBuffer* buffers, size_t count) {
+    if (count > maxSendBuffers) {
+        count = maxSendBuffers;
+    }
+#ifdef _WIN32
+    WSABUF pieces[maxSendBuffers];
+    for (size_t i = 0; i < count; ++i) {
+        pieces[i].buf = const_cast<char*>(buffers[i].data);
+        pieces[i].len = static_cast<ULONG>(buffers[i].size);
+    }
+    DWORD bytesSent = 0;
+    if (WSASend(socket, pieces, static_cast<DWORD>(count), &bytesSent, 0, NULL, NULL) == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    return static_cast<int>(bytesSent);
+#else
+    iovec pieces[maxSendBuffers];
+    for (size_t i = 0; i < count; ++i) {
+        pieces[i].iov_base = const_cast<char*>(buffers[i].data);
+        pieces[i].iov_len = buffers[i].size;
+    }
+    msghdr message{};
+    message.msg_iov = pieces;
+    message.msg_iovlen = count;
+    ssize_t bytesSent = sendmsg(socket, &message, socketSendFlags);
+    return bytesSent < 0 ? SOCKET_ERROR : static_cast<int>(bytesSent);
+#endif
+}
+
+// True if the last failed call only means "try again later"
+inline bool socketWouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// Smoothed round trip time the kernel keeps for a connected TCP socket, in
+// seconds, or 0 where the platform does not report it
+inline double socketRoundTrip(SOCKET socket) {
+#if defined(_WIN32) && defined(SIO_TCP_INFO)
+    DWORD version = 0;
+    TCP_INFO_v0 info{};
+    DWORD bytesReturned = 0;
+    if (WSAIoctl(socket, SIO_TCP_INFO, &version, sizeof(version), &info, sizeof(info), &bytesReturned, NULL, NULL) == 0) {
+        return info.RttUs / 1e6;
+    }
+#elif defined(__linux__)
+    tcp_info info{};
+    socklen_t length = sizeof(info);
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+        return info.tcpi_rtt / 1e6;
+    }
+#else
+    (void)socket;
+#endif
+    return 0.0;
+}
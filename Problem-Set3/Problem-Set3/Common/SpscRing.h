@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Capacity must be a power of two. A full ring rejects new items
+// rather than growing, so memory use is fixed when the ring is created.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0), cachedHead(0), cachedTail(0) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer only. Returns false if the ring is full.
+    bool push(const T& item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - cachedHead == Capacity) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (currentTail - cachedHead == Capacity) {
+                return false;
+            }
+        }
+        slots[currentTail & (Capacity - 1)] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty.
+    bool pop(T& item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (currentHead == cachedTail) {
+                return false;
+            }
+        }
+        item = slots[currentHead & (Capacity - 1)];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Hands everything queued so far to consume and frees the
+    // slots in one step; returns how many items there were.
+    template <typename Consume>
+    size_t drain(Consume&& consume) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        cachedTail = tail.load(std::memory_order_acquire);
+        for (size_t i = currentHead; i != cachedTail; ++i) {
+            consume(slots[i & (Capacity - 1)]);
+        }
+        head.store(cachedTail, std::memory_order_release);
+        return cachedTail - currentHead;
+    }
+
+private:
+    // Producer and consumer indices live on separate cache lines so the two
+    // threads do not invalidate each other's line on every operation
+    alignas(64) std::atomic<size_t> head;   // written by the consumer
+    alignas(64) std::atomic<size_t> tail;   // written by the producer
+    alignas(64) size_t cachedHead;          // producer's copy of head
+    alignas(64) size_t cachedTail;          // consumer's copy of tail
+    std::array<T, Capacity> slots;
+};
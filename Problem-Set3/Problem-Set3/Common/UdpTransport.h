@@ -0,0 +1,994 @@
+#pragma once
+
+#include "NetStats.h"
+#include "Socket.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/select.h>
+#endif
+
+// UDP transport for snapshots. Every packet carries a sequence number plus an
+// ack and a 32-bit ack bitfield for the last packets received from the peer,
+// so lost packets are detected without retransmitting stale snapshots.
+//
+// Two channels share each packet:
+//  - unreliable: snapshots, split into fragments when larger than one packet;
+//    a snapshot with a missing fragment is simply superseded by the next one
+//  - reliable-ordered: small messages (inputs, walls, spawns) resent until the
+//    packet carrying them is acked and delivered in send order
+
+struct UdpAddress {
+    uint32_t ip = 0;   // Network byte order
+    uint16_t port = 0; // Network byte order
+
+    static UdpAddress fromString(const std::string& host, uint16_t port) {
+        UdpAddress address;
+        inet_pton(AF_INET, host.c_str(), &address.ip);
+        address.port = htons(port);
+        return address;
+    }
+
+    bool operator==(const UdpAddress& other) const {
+        return ip == other.ip && port == other.port;
+    }
+};
+
+struct UdpAddressHash {
+    size_t operator()(const UdpAddress& address) const {
+        return (static_cast<size_t>(address.ip) << 16) ^ address.port;
+    }
+};
+
+// Where packets go in and out. The real implementation is a UDP socket; tests
+// wrap it in LossyPacketIo to simulate a bad network on loopback.
+class PacketIo {
+public:
+    virtual ~PacketIo() = default;
+    virtual bool send(const UdpAddress& to, const char* data, size_t size) = 0;
+    // Returns false when no packet is pending
+    virtual bool receive(UdpAddress& from, std::string& data) = 0;
+    // Block until a packet may be readable or the timeout expires
+    virtual void wait(int timeoutMs) = 0;
+    // Push out anything send() has batched up. The transport calls this once
+    // per loop, after it has queued every packet for the iteration.
+    virtual void flush() {}
+};
+
+// A real UDP socket. On Linux packets are moved in batches, up to
+// batchSize per recvmmsg or sendmmsg call, so a busy server pays for one
+// system call per batch instead of one per packet; elsewhere each packet is
+// its own sendto/recvfrom.
+class UdpSocketIo : public PacketIo {
+public:
+    static constexpr int socketBufferBytes = 4 * 1024 * 1024;
+
+    UdpSocketIo() : udpSocket(INVALID_SOCKET) {}
+
+    ~UdpSocketIo() override {
+        if (udpSocket != INVALID_SOCKET) {
+            flush();
+            closesocket(udpSocket);
+        }
+    }
+
+    // Port 0 picks an ephemeral port, which is what clients want
+    bool open(uint16_t port) {
+        udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (udpSocket == INVALID_SOCKET) {
+            std::cerr << "Error at socket(): " << socketError() << std::endl;
+            return false;
+        }
+        sockaddr_in service{};
+        service.sin_family = AF_INET;
+        service.sin_addr.s_addr = INADDR_ANY;
+        service.sin_port = htons(port);
+        if (bind(udpSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
+            std::cerr << "bind() failed: " << socketError() << std::endl;
+            closesocket(udpSocket);
+            udpSocket = INVALID_SOCKET;
+            return false;
+        }
+        setNonBlocking(udpSocket);
+        setBufferSizes(udpSocket, socketBufferBytes, socketBufferBytes);
+        return true;
+    }
+
+    bool send(const UdpAddress& to, const char* data, size_t size) override {
+        if (size > maxDatagramSize) {
+            return false;
+        }
+#ifdef __linux__
+        Slot& slot = outgoing[outgoingCount++];
+        slot.address = toSockaddr(to);
+        std::memcpy(slot.data, data, size);
+        slot.size = size;
+        if (outgoingCount == batchSize) {
+            flush();
+        }
+        return true;
+#else
+        sockaddr_in address = toSockaddr(to);
+        return sendto(udpSocket, data, static_cast<int>(size), 0, (SOCKADDR*)&address, sizeof(address)) != SOCKET_ERROR;
+#endif
+    }
+
+    bool receive(UdpAddress& from, std::string& data) override {
+#ifdef __linux__
+        if (incomingNext == incomingCount && !receiveBatch()) {
+            return false;
+        }
+        const Slot& slot = incoming[incomingNext++];
+        from.ip = slot.address.sin_addr.s_addr;
+        from.port = slot.address.sin_port;
+        data.assign(slot.data, slot.size);
+        return true;
+#else
+        char buffer[maxDatagramSize];
+        sockaddr_in address{};
+        socklen_t addressLength = sizeof(address);
+        int bytesReceived = recvfrom(udpSocket, buffer, sizeof(buffer), 0, (SOCKADDR*)&address, &addressLength);
+        if (bytesReceived == SOCKET_ERROR) {
+            return false;
+        }
+        from.ip = address.sin_addr.s_addr;
+        from.port = address.sin_port;
+        data.assign(buffer, bytesReceived);
+        return true;
+#endif
+    }
+
+    void wait(int timeoutMs) override {
+        flush();
+#ifdef __linux__
+        if (incomingNext != incomingCount) {
+            return;
+        }
+#endif
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(udpSocket, &readable);
+        timeval timeout{ 0, timeoutMs * 1000 };
+        select(static_cast<int>(udpSocket) + 1, &readable, nullptr, nullptr, &timeout);
+    }
+
+    void flush() override {
+#ifdef __linux__
+        size_t sent = 0;
+        while (sent < outgoingCount) {
+            mmsghdr messages[batchSize];
+            iovec pieces[batchSize];
+            size_t count = outgoingCount - sent;
+            for (size_t i = 0; i < count; ++i) {
+                Slot& slot = outgoing[sent + i];
+                pieces[i] = { slot.data, slot.size };
+                messages[i] = {};
+                messages[i].msg_hdr.msg_name = &slot.address;
+                messages[i].msg_hdr.msg_namelen = sizeof(slot.address);
+                messages[i].msg_hdr.msg_iov = &pieces[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+            int result = sendmmsg(udpSocket, messages, static_cast<unsigned int>(count), 0);
+            if (result <= 0) {
+                // A full socket buffer or an unreachable peer loses the rest,
+                // which UDP allows anyway
+                break;
+            }
+            sent += static_cast<size_t>(result);
+        }
+        outgoingCount = 0;
+#endif
+    }
+
+private:
+    static constexpr size_t maxDatagramSize = 2048;
+
+    SOCKET udpSocket;
+
+    static sockaddr_in toSockaddr(const UdpAddress& to) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = to.ip;
+        address.sin_port = to.port;
+        return address;
+    }
+
+#ifdef __linux__
+    static constexpr size_t batchSize = 32;
+
+    struct Slot {
+        sockaddr_in address;
+        size_t size;
+        char data[maxDatagramSize];
+    };
+
+    std::vector<Slot> incoming = std::vector<Slot>(batchSize);
+    size_t incomingNext = 0;
+    size_t incomingCount = 0;
+    std::vector<Slot> outgoing = std::vector<Slot>(batchSize);
+    size_t outgoingCount = 0;
+
+    bool receiveBatch() {
+        mmsghdr messages[batchSize];
+        iovec pieces[batchSize];
+        for (size_t i = 0; i < batchSize; ++i) {
+            pieces[i] = { incoming[i].data, maxDatagramSize };
+            messages[i] = {};
+            messages[i].msg_hdr.msg_name = &incoming[i].address;
+            messages[i].msg_hdr.msg_namelen = sizeof(incoming[i].address);
+            messages[i].msg_hdr.msg_iov = &pieces[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int result = recvmmsg(udpSocket, messages, batchSize, 0, nullptr);
+        incomingNext = 0;
+        incomingCount = result > 0 ? static_cast<size_t>(result) : 0;
+        for (size_t i = 0; i < incomingCount; ++i) {
+            incoming[i].size = messages[i].msg_len;
+        }
+        return incomingCount > 0;
+    }
+#endif
+};
+
+// Packet-loss and latency shim. Outgoing packets are dropped with the given
+// probability, or held back for latency +/- jitter before reaching the inner
+// PacketIo. Seeded, so a lossy run can be reproduced.
+class LossyPacketIo : public PacketIo {
+public:
+    LossyPacketIo(PacketIo& inner, float lossPercent, int latencyMs, int jitterMs, uint32_t seed = 1)
+        : inner(inner), lossPercent(lossPercent), latencyMs(latencyMs), jitterMs(jitterMs), random(seed) {}
+
+    bool send(const UdpAddress& to, const char* data, size_t size) override {
+        std::uniform_real_distribution<float> percent(0.0f, 100.0f);
+        if (percent(random) < lossPercent) {
+            return true;
+        }
+        std::uniform_int_distribution<int> jitter(-jitterMs, jitterMs);
+        auto due = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, latencyMs + jitter(random)));
+        delayed.push({ due, sequence++, to, std::string(data, size) });
+        release();
+        return true;
+    }
+
+    bool receive(UdpAddress& from, std::string& data) override {
+        release();
+        return inner.receive(from, data);
+    }
+
+    void flush() override {
+        release();
+        inner.flush();
+    }
+
+    void wait(int timeoutMs) override {
+        release();
+        if (!delayed.empty()) {
+            auto untilDue = std::chrono::duration_cast<std::chrono::milliseconds>(delayed.top().due - std::chrono::steady_clock::now()).count();
+            timeoutMs = static_cast<int>(std::clamp<long long>(untilDue, 0, timeoutMs));
+        }
+        inner.wait(timeoutMs);
+    }
+
+private:
+    struct DelayedPacket {
+        std::chrono::steady_clock::time_point due;
+        uint64_t order;
+        UdpAddress to;
+        std::string data;
+
+        bool operator>(const DelayedPacket& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    PacketIo& inner;
+    float lossPercent;
+    int latencyMs;
+    int jitterMs;
+    std::mt19937 random;
+    uint64_t sequence = 0;
+    std::priority_queue<DelayedPacket, std::vector<DelayedPacket>, std::greater<DelayedPacket>> delayed;
+
+    void release() {
+        auto now = std::chrono::steady_clock::now();
+        while (!delayed.empty() && delayed.top().due <= now) {
+            inner.send(delayed.top().to, delayed.top().data.data(), delayed.top().data.size());
+            delayed.pop();
+        }
+    }
+};
+
+struct UdpTransportConfig {
+    uint32_t protocolId = 0x50534E33; // "PSN3"
+    size_t maxFragmentSize = 1024;
+    size_t maxMessageSize = 4 * 1024 * 1024;
+    size_t maxReliableSize = 1024;
+    size_t maxConnections = 1024;
+    double timeoutSeconds = 5.0;
+    double keepAliveSeconds = 0.1;
+};
+
+class UdpTransport {
+public:
+    using ConnectionId = uint32_t;
+    using Config = UdpTransportConfig;
+
+    // An encoded message that many connections can send without copying it
+    using SharedPayload = std::shared_ptr<const std::string>;
+
+    // Callbacks run on the transport thread
+    std::function<void(ConnectionId)> onConnect;
+    std::function<void(ConnectionId)> onDisconnect;
+    std::function<void(ConnectionId, const char*, size_t)> onUnreliable;
+    std::function<void(ConnectionId, const char*, size_t)> onReliable;
+
+    explicit UdpTransport(PacketIo& io, Config config = Config())
+        : io(io), config(config), running(false), nextId(1) {}
+
+    ~UdpTransport() {
+        stop();
+    }
+
+    UdpTransport(const UdpTransport&) = delete;
+    UdpTransport& operator=(const UdpTransport&) = delete;
+
+    // Client side: start the handshake with a server. Call before start().
+    ConnectionId connect(const UdpAddress& server) {
+        ConnectionId id = nextId++;
+        Connection& connection = connections[id];
+        connection.address = server;
+        connection.state = State::Connecting;
+        connection.lastReceiveTime = now();
+        addresses[server] = id;
+        return id;
+    }
+
+    void start() {
+        if (running.exchange(true)) {
+            return;
+        }
+        ioThread = std::thread(&UdpTransport::run, this);
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        if (ioThread.joinable()) {
+            ioThread.join();
+        }
+        // Best-effort goodbye so the peer does not wait for the timeout
+        for (auto& entry : connections) {
+            if (entry.second.state == State::Connected) {
+                sendControl(entry.second.address, PacketType::Disconnect);
+            }
+        }
+        io.flush();
+        connections.clear();
+        addresses.clear();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        publishedStats.clear();
+    }
+
+    // Thread-safe. Messages larger than one packet are fragmented.
+    void sendUnreliable(ConnectionId id, const std::string& payload) {
+        sendUnreliable(id, std::make_shared<const std::string>(payload));
+    }
+
+    // Thread-safe. The fragments of a shared payload refer to it rather than
+    // copying it, so broadcasting one snapshot costs a reference per client.
+    void sendUnreliable(ConnectionId id, SharedPayload payload) {
+        if (!payload || payload->size() > config.maxMessageSize) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        outbox.push_back({ id, false, std::string(), std::move(payload) });
+    }
+
+    // Thread-safe. Returns false if the message is too large for the channel.
+    bool sendReliable(ConnectionId id, const std::string& payload) {
+        if (payload.size() > config.maxReliableSize) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(outboxMutex);
+        outbox.push_back({ id, true, payload, nullptr });
+        return true;
+    }
+
+    size_t connectionCount() const {
+        return activeConnections.load();
+    }
+
+    // Smoothed round trip time in seconds, 0 until measured
+    double roundTripTime(ConnectionId id) const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        auto it = std::find_if(publishedStats.begin(), publishedStats.end(), [id](const ConnectionStats& stats) {
+            return stats.id == id;
+        });
+        return it == publishedStats.end() ? 0.0 : it->rtt;
+    }
+
+    // Counters for every connection as of the last publish, at most
+    // statsInterval old. UDP never writes part of a packet, so partialWrites
+    // stays 0.
+    std::vector<ConnectionStats> connectionStats() const {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return publishedStats;
+    }
+
+private:
+    enum class PacketType : uint8_t {
+        Connect = 1,
+        Accept = 2,
+        Data = 3,
+        Disconnect = 4
+    };
+
+    enum class State {
+        Connecting,
+        Connected
+    };
+
+    static constexpr size_t packetHistory = 1024;
+    static constexpr size_t maxPendingFragments = 4;
+    static constexpr size_t maxPacketSize = 1400;
+    static constexpr double statsInterval = 0.25;
+
+    struct SentPacket {
+        uint16_t sequence = 0;
+        bool valid = false;
+        bool acked = false;
+        double time = 0.0;
+        std::vector<uint16_t> reliableIds;
+    };
+
+    struct ReliableMessage {
+        uint16_t id;
+        std::string payload;
+        double lastSendTime;
+    };
+
+    struct PendingFragment {
+        SharedPayload message;
+        size_t offset;
+        uint16_t length;
+        uint16_t messageId;
+        uint16_t index;
+        uint16_t count;
+    };
+
+    struct Reassembly {
+        uint16_t count = 0;
+        uint16_t received = 0;
+        std::vector<std::string> fragments;
+        std::vector<bool> present;
+    };
+
+    struct Connection {
+        UdpAddress address;
+        State state = State::Connecting;
+        double lastReceiveTime = 0.0;
+        double lastSendTime = 0.0;
+
+        // Packet level sequencing and acks
+        uint16_t localSequence = 0;
+        uint16_t remoteSequence = 0;
+        bool receivedAny = false;
+        std::vector<int32_t> received = std::vector<int32_t>(packetHistory, -1);
+        std::vector<SentPacket> sent = std::vector<SentPacket>(packetHistory);
+        double rtt = 0.0;
+
+        // Reliable-ordered channel
+        uint16_t nextReliableSend = 0;
+        uint16_t nextReliableReceive = 0;
+        std::deque<ReliableMessage> unackedReliable;
+        std::map<uint16_t, std::string> earlyReliable;
+
+        // Unreliable channel
+        uint16_t nextMessageId = 0;
+        std::deque<PendingFragment> pendingFragments;
+        std::map<uint16_t, Reassembly> reassembly;
+
+        ConnectionStats stats;
+    };
+
+    struct OutgoingMessage {
+        ConnectionId id;
+        bool reliable;
+        std::string payload;     // reliable messages
+        SharedPayload shared;    // unreliable messages
+    };
+
+    PacketIo& io;
+    Config config;
+    std::atomic<bool> running;
+    std::atomic<size_t> activeConnections{ 0 };
+    ConnectionId nextId;
+    std::thread ioThread;
+
+    // Owned by the transport thread
+    std::unordered_map<ConnectionId, Connection> connections;
+    std::unordered_map<UdpAddress, ConnectionId, UdpAddressHash> addresses;
+
+    std::mutex outboxMutex;
+    std::vector<OutgoingMessage> outbox;
+    std::vector<OutgoingMessage> draining;
+
+    mutable std::mutex statsMutex;
+    std::vector<ConnectionStats> publishedStats;
+    double lastPublish = 0.0;
+
+    static double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // True if a is newer than b, allowing for wraparound
+    static bool sequenceGreaterThan(uint16_t a, uint16_t b) {
+        return ((a > b) && (a - b <= 32768)) || ((a < b) && (b - a > 32768));
+    }
+
+    template <typename T>
+    static void write(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool read(const std::string& in, size_t& offset, T& value) {
+        if (in.size() - offset < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, in.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    void run() {
+        std::string packet;
+        UdpAddress from;
+        while (running) {
+            io.wait(1);
+            while (true) {
+                double receiveSeconds = 0.0;
+                bool received;
+                {
+                    ScopedTimer timer(receiveSeconds);
+                    received = io.receive(from, packet);
+                }
+                if (!received) {
+                    break;
+                }
+                handlePacket(from, packet);
+                countReceive(from, packet.size(), receiveSeconds);
+            }
+            drainOutbox();
+
+            double time = now();
+            std::vector<ConnectionId> timedOut;
+            for (auto& entry : connections) {
+                Connection& connection = entry.second;
+                if (time - connection.lastReceiveTime > config.timeoutSeconds) {
+                    timedOut.push_back(entry.first);
+                    continue;
+                }
+                if (connection.state == State::Connecting) {
+                    if (time - connection.lastSendTime > config.keepAliveSeconds) {
+                        sendControl(connection.address, PacketType::Connect);
+                        connection.lastSendTime = time;
+                    }
+                    continue;
+                }
+                flush(connection, time);
+            }
+            for (ConnectionId id : timedOut) {
+                std::cout << "UDP connection " << id << " timed out" << std::endl;
+                closeConnection(id);
+            }
+            // Where sends are batched the system call happens here, for all
+            // connections at once, so it is not counted against any of them
+            io.flush();
+            if (time - lastPublish >= statsInterval) {
+                publishStats();
+                lastPublish = time;
+            }
+        }
+    }
+
+    // The packet is counted after it was handled, so the first packet of a
+    // new connection counts towards it too
+    void countReceive(const UdpAddress& from, size_t size, double seconds) {
+        auto known = addresses.find(from);
+        if (known == addresses.end()) {
+            return;
+        }
+        ConnectionStats& stats = connections[known->second].stats;
+        stats.bytesIn += size;
+        stats.syscallSeconds += seconds;
+    }
+
+    void publishStats() {
+        std::vector<ConnectionStats> stats;
+        stats.reserve(connections.size());
+        for (auto& entry : connections) {
+            Connection& connection = entry.second;
+            connection.stats.id = entry.first;
+            connection.stats.rtt = connection.rtt;
+            connection.stats.queuedMessages = connection.pendingFragments.size() + connection.unackedReliable.size();
+            stats.push_back(connection.stats);
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        publishedStats.swap(stats);
+    }
+
+    void drainOutbox() {
+        {
+            std::lock_guard<std::mutex> lock(outboxMutex);
+            draining.swap(outbox);
+        }
+        for (OutgoingMessage& message : draining) {
+            auto it = connections.find(message.id);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection& connection = it->second;
+            ++connection.stats.messagesOut;
+            if (message.reliable) {
+                connection.unackedReliable.push_back({ connection.nextReliableSend++, std::move(message.payload), -1.0 });
+                continue;
+            }
+
+            // A newer snapshot makes any unsent fragments of older ones useless
+            connection.pendingFragments.clear();
+            uint16_t messageId = connection.nextMessageId++;
+            size_t size = message.shared->size();
+            size_t count = std::max<size_t>(1, (size + config.maxFragmentSize - 1) / config.maxFragmentSize);
+            for (size_t i = 0; i < count; ++i) {
+                size_t begin = i * config.maxFragmentSize;
+                size_t length = std::min(config.maxFragmentSize, size - begin);
+                connection.pendingFragments.push_back({ message.shared, begin, static_cast<uint16_t>(length), messageId,
+                    static_cast<uint16_t>(i), static_cast<uint16_t>(count) });
+            }
+        }
+        draining.clear();
+    }
+
+    void sendControl(const UdpAddress& to, PacketType type) {
+        std::string packet;
+        write(packet, config.protocolId);
+        write(packet, static_cast<uint8_t>(type));
+        io.send(to, packet.data(), packet.size());
+    }
+
+    // Send every pending fragment, plus any reliable messages that are due,
+    // plus a keep-alive if nothing else went out recently
+    void flush(Connection& connection, double time) {
+        double resendDelay = std::max(0.1, connection.rtt * 1.5);
+        bool reliableDue = false;
+        for (const ReliableMessage& message : connection.unackedReliable) {
+            if (message.lastSendTime < 0.0 || time - message.lastSendTime > resendDelay) {
+                reliableDue = true;
+                break;
+            }
+        }
+
+        while (!connection.pendingFragments.empty() || reliableDue || time - connection.lastSendTime > config.keepAliveSeconds) {
+            auto buildStart = std::chrono::steady_clock::now();
+            std::string packet;
+            uint16_t sequence = connection.localSequence++;
+            write(packet, config.protocolId);
+            write(packet, static_cast<uint8_t>(PacketType::Data));
+            write(packet, sequence);
+            write(packet, static_cast<uint8_t>(connection.receivedAny ? 1 : 0));
+            write(packet, connection.remoteSequence);
+            write(packet, ackBits(connection));
+
+            SentPacket& record = connection.sent[sequence % packetHistory];
+            record.sequence = sequence;
+            record.valid = true;
+            record.acked = false;
+            record.time = time;
+            record.reliableIds.clear();
+
+            // Reliable messages ride along while they fit
+            size_t countOffset = packet.size();
+            write(packet, static_cast<uint8_t>(0));
+            uint8_t reliableCount = 0;
+            // Leave room for the next fragment unless this is the first message
+            size_t budget = connection.pendingFragments.empty()
+                ? maxPacketSize
+                : maxPacketSize - 9 - connection.pendingFragments.front().length;
+            for (ReliableMessage& message : connection.unackedReliable) {
+                bool due = message.lastSendTime < 0.0 || time - message.lastSendTime > resendDelay;
+                size_t limit = reliableCount == 0 ? maxPacketSize : budget;
+                if (!due || reliableCount == 255 || packet.size() + 4 + message.payload.size() > limit) {
+                    continue;
+                }
+                write(packet, message.id);
+                write(packet, static_cast<uint16_t>(message.payload.size()));
+                packet.append(message.payload);
+                message.lastSendTime = time;
+                record.reliableIds.push_back(message.id);
+                ++reliableCount;
+            }
+            packet[countOffset] = static_cast<char>(reliableCount);
+            reliableDue = false;
+
+            if (!connection.pendingFragments.empty() && packet.size() + 9 + connection.pendingFragments.front().length <= maxPacketSize) {
+                const PendingFragment& fragment = connection.pendingFragments.front();
+                write(packet, static_cast<uint8_t>(1));
+                write(packet, fragment.messageId);
+                write(packet, fragment.index);
+                write(packet, fragment.count);
+                write(packet, fragment.length);
+                packet.append(fragment.message->data() + fragment.offset, fragment.length);
+                connection.pendingFragments.pop_front();
+            }
+            else {
+                write(packet, static_cast<uint8_t>(0));
+            }
+
+            connection.stats.serializeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+            {
+                ScopedTimer timer(connection.stats.syscallSeconds);
+                io.send(connection.address, packet.data(), packet.size());
+            }
+            connection.stats.bytesOut += packet.size();
+            connection.lastSendTime = time;
+        }
+    }
+
+    uint32_t ackBits(const Connection& connection) const {
+        uint32_t bits = 0;
+        if (!connection.receivedAny) {
+            return bits;
+        }
+        for (uint32_t i = 0; i < 32; ++i) {
+            uint16_t sequence = static_cast<uint16_t>(connection.remoteSequence - 1 - i);
+            if (connection.received[sequence % packetHistory] == sequence) {
+                bits |= 1u << i;
+            }
+        }
+        return bits;
+    }
+
+    void handlePacket(const UdpAddress& from, const std::string& packet) {
+        size_t offset = 0;
+        uint32_t protocolId;
+        uint8_t rawType;
+        if (!read(packet, offset, protocolId) || protocolId != config.protocolId || !read(packet, offset, rawType)) {
+            return;
+        }
+        PacketType type = static_cast<PacketType>(rawType);
+
+        auto known = addresses.find(from);
+        if (known == addresses.end()) {
+            // Only a Connect from a new address opens a connection
+            if (type != PacketType::Connect || connections.size() >= config.maxConnections) {
+                return;
+            }
+            ConnectionId id = nextId++;
+            Connection& connection = connections[id];
+            connection.address = from;
+            connection.state = State::Connected;
+            connection.lastReceiveTime = now();
+            addresses[from] = id;
+            sendControl(from, PacketType::Accept);
+            connectionEstablished(id);
+            return;
+        }
+
+        ConnectionId id = known->second;
+        Connection& connection = connections[id];
+        connection.lastReceiveTime = now();
+
+        switch (type) {
+        case PacketType::Connect:
+            // Our Accept was lost; repeat it
+            sendControl(from, PacketType::Accept);
+            return;
+        case PacketType::Accept:
+            if (connection.state == State::Connecting) {
+                connection.state = State::Connected;
+                connectionEstablished(id);
+            }
+            return;
+        case PacketType::Disconnect:
+            closeConnection(id);
+            return;
+        case PacketType::Data:
+            if (connection.state == State::Connecting) {
+                connection.state = State::Connected;
+                connectionEstablished(id);
+            }
+            handleData(id, connection, packet, offset);
+            return;
+        }
+    }
+
+    void handleData(ConnectionId id, Connection& connection, const std::string& packet, size_t offset) {
+        uint16_t sequence, ack;
+        uint8_t hasAck;
+        uint32_t bits;
+        if (!read(packet, offset, sequence) || !read(packet, offset, hasAck) || !read(packet, offset, ack) || !read(packet, offset, bits)) {
+            return;
+        }
+
+        // Record the packet for our own acks; drop exact duplicates
+        if (connection.received[sequence % packetHistory] == sequence) {
+            return;
+        }
+        connection.received[sequence % packetHistory] = sequence;
+        if (!connection.receivedAny || sequenceGreaterThan(sequence, connection.remoteSequence)) {
+            connection.remoteSequence = sequence;
+            connection.receivedAny = true;
+        }
+
+        // Process the peer's acks of our packets, if it has received any yet
+        if (hasAck) {
+            processAck(connection, ack);
+            for (uint32_t i = 0; i < 32; ++i) {
+                if (bits & (1u << i)) {
+                    processAck(connection, static_cast<uint16_t>(ack - 1 - i));
+                }
+            }
+        }
+
+        uint8_t reliableCount;
+        if (!read(packet, offset, reliableCount)) {
+            return;
+        }
+        for (uint8_t i = 0; i < reliableCount; ++i) {
+            uint16_t messageId, length;
+            if (!read(packet, offset, messageId) || !read(packet, offset, length) || packet.size() - offset < length) {
+                return;
+            }
+            // Keep messages inside the receive window that we have not delivered yet
+            if (!sequenceGreaterThan(connection.nextReliableReceive, messageId)
+                && static_cast<uint16_t>(messageId - connection.nextReliableReceive) < 1024) {
+                connection.earlyReliable.emplace(messageId, packet.substr(offset, length));
+            }
+            offset += length;
+        }
+        deliverReliable(id, connection);
+
+        uint8_t hasFragment;
+        if (!read(packet, offset, hasFragment) || !hasFragment) {
+            return;
+        }
+        uint16_t messageId, index, count, length;
+        if (!read(packet, offset, messageId) || !read(packet, offset, index) || !read(packet, offset, count)
+            || !read(packet, offset, length) || packet.size() - offset < length || index >= count) {
+            return;
+        }
+        handleFragment(id, connection, messageId, index, count, packet.substr(offset, length));
+    }
+
+    void processAck(Connection& connection, uint16_t sequence) {
+        SentPacket& record = connection.sent[sequence % packetHistory];
+        if (!record.valid || record.sequence != sequence || record.acked) {
+            return;
+        }
+        record.acked = true;
+
+        double sample = now() - record.time;
+        connection.rtt = connection.rtt == 0.0 ? sample : connection.rtt + 0.1 * (sample - connection.rtt);
+
+        for (uint16_t reliableId : record.reliableIds) {
+            auto& unacked = connection.unackedReliable;
+            unacked.erase(std::remove_if(unacked.begin(), unacked.end(),
+                [reliableId](const ReliableMessage& message) { return message.id == reliableId; }), unacked.end());
+        }
+    }
+
+    void deliverReliable(ConnectionId id, Connection& connection) {
+        auto it = connection.earlyReliable.find(connection.nextReliableReceive);
+        while (it != connection.earlyReliable.end()) {
+            ++connection.stats.messagesIn;
+            if (onReliable) {
+                onReliable(id, it->second.data(), it->second.size());
+            }
+            connection.earlyReliable.erase(it);
+            ++connection.nextReliableReceive;
+            it = connection.earlyReliable.find(connection.nextReliableReceive);
+        }
+    }
+
+    void handleFragment(ConnectionId id, Connection& connection, uint16_t messageId, uint16_t index, uint16_t count, std::string data) {
+        if (count == 1) {
+            ++connection.stats.messagesIn;
+            if (onUnreliable) {
+                onUnreliable(id, data.data(), data.size());
+            }
+            return;
+        }
+        if (static_cast<size_t>(count) * config.maxFragmentSize > config.maxMessageSize) {
+            return;
+        }
+
+        // Only a few messages are reassembled at once; older ones are stale
+        Reassembly& entry = connection.reassembly[messageId];
+        if (entry.count == 0) {
+            entry.count = count;
+            entry.fragments.resize(count);
+            entry.present.assign(count, false);
+        }
+        if (entry.count != count || entry.present[index]) {
+            return;
+        }
+        entry.fragments[index] = std::move(data);
+        entry.present[index] = true;
+        ++entry.received;
+
+        if (entry.received == entry.count) {
+            std::string message;
+            for (const std::string& fragment : entry.fragments) {
+                message.append(fragment);
+            }
+            // Anything older than a completed message will never be wanted
+            for (auto it = connection.reassembly.begin(); it != connection.reassembly.end();) {
+                if (it->first == messageId || sequenceGreaterThan(messageId, it->first)) {
+                    it = connection.reassembly.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            ++connection.stats.messagesIn;
+            if (onUnreliable) {
+                onUnreliable(id, message.data(), message.size());
+            }
+            return;
+        }
+        while (connection.reassembly.size() > maxPendingFragments) {
+            // Evict the oldest partial message
+            auto oldest = connection.reassembly.begin();
+            for (auto it = connection.reassembly.begin(); it != connection.reassembly.end(); ++it) {
+                if (sequenceGreaterThan(oldest->first, it->first)) {
+                    oldest = it;
+                }
+            }
+            connection.reassembly.erase(oldest);
+        }
+    }
+
+    void connectionEstablished(ConnectionId id) {
+        ++activeConnections;
+        std::cout << "UDP client connected" << std::endl;
+        if (onConnect) {
+            onConnect(id);
+        }
+    }
+
+    void closeConnection(ConnectionId id) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return;
+        }
+        bool wasConnected = it->second.state == State::Connected;
+        addresses.erase(it->second.address);
+        connections.erase(it);
+        if (wasConnected) {
+            --activeConnections;
+            std::cout << "UDP client disconnected" << std::endl;
+            if (onDisconnect) {
+                onDisconnect(id);
+            }
+        }
+    }
+};
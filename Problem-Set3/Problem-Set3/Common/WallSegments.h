@@ -0,0 +1,183 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// The walls as the collision code reads them. Walls are drawn as
+// sf::VertexArrays; here every segment is split into parallel arrays, with
+// everything that depends only on the wall worked out when the walls change,
+// so the loops that run per particle and per player only load, multiply and
+// add. Fill it again with assign() after every wall edit.
+class WallSegments {
+public:
+    // radius is the size of the round bodies (players) tested with
+    // touchesCircle(); their padded boxes are kept alongside
+    void assign(const std::vector<sf::VertexArray>& walls, float radius) {
+        clear();
+        circleRadiusSquared = radius * radius;
+        for (const sf::VertexArray& wall : walls) {
+            for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+                add(wall[i].position, wall[i + 1].position, radius);
+            }
+        }
+    }
+
+    void clear() {
+        startX.clear();
+        startY.clear();
+        deltaX.clear();
+        deltaY.clear();
+        normalX.clear();
+        normalY.clear();
+        inverseLengthSquared.clear();
+        minX.clear();
+        minY.clear();
+        maxX.clear();
+        maxY.clear();
+        circleMinX.clear();
+        circleMinY.clear();
+        circleMaxX.clear();
+        circleMaxY.clear();
+    }
+
+    size_t size() const {
+        return startX.size();
+    }
+
+    bool empty() const {
+        return startX.empty();
+    }
+
+    // Bounces a point moving from position to nextPosition off every segment
+    // its step crosses, leaving nextPosition at the last crossing and
+    // velocity reflected. Returns true if it hit anything.
+    bool bounce(sf::Vector2f position, sf::Vector2f& nextPosition, sf::Vector2f& velocity) const {
+        bool hit = false;
+        sf::Vector2f step = nextPosition - position;
+        float stepMinX = std::min(position.x, nextPosition.x);
+        float stepMaxX = std::max(position.x, nextPosition.x);
+        float stepMinY = std::min(position.y, nextPosition.y);
+        float stepMaxY = std::max(position.y, nextPosition.y);
+        for (size_t i = 0; i < size(); ++i) {
+            if (stepMaxX < minX[i] || stepMinX > maxX[i] || stepMaxY < minY[i] || stepMinY > maxY[i]) {
+                continue;
+            }
+            float alongStep, denominator;
+            if (!crossing(i, position, step, alongStep, denominator)) {
+                continue;
+            }
+
+            hit = true;
+            float along = velocity.x * normalX[i] + velocity.y * normalY[i];
+            velocity.x -= 2.0f * along * normalX[i];
+            velocity.y -= 2.0f * along * normalY[i];
+            nextPosition = position + step * (alongStep / denominator);
+            step = nextPosition - position;
+            stepMinX = std::min(position.x, nextPosition.x);
+            stepMaxX = std::max(position.x, nextPosition.x);
+            stepMinY = std::min(position.y, nextPosition.y);
+            stepMaxY = std::max(position.y, nextPosition.y);
+        }
+        return hit;
+    }
+
+    // True if a point moving from position to nextPosition would hit any
+    // segment; what bounce() tests, without moving anything
+    bool crosses(sf::Vector2f position, sf::Vector2f nextPosition) const {
+        sf::Vector2f step = nextPosition - position;
+        float stepMinX = std::min(position.x, nextPosition.x);
+        float stepMaxX = std::max(position.x, nextPosition.x);
+        float stepMinY = std::min(position.y, nextPosition.y);
+        float stepMaxY = std::max(position.y, nextPosition.y);
+        for (size_t i = 0; i < size(); ++i) {
+            if (stepMaxX < minX[i] || stepMinX > maxX[i] || stepMaxY < minY[i] || stepMinY > maxY[i]) {
+                continue;
+            }
+            float alongStep, denominator;
+            if (crossing(i, position, step, alongStep, denominator)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // True if a circle of the radius given to assign() centred at center
+    // overlaps any segment
+    bool touchesCircle(sf::Vector2f center) const {
+        for (size_t i = 0; i < size(); ++i) {
+            if (center.x < circleMinX[i] || center.x > circleMaxX[i] || center.y < circleMinY[i] || center.y > circleMaxY[i]) {
+                continue;
+            }
+            float offsetX = center.x - startX[i];
+            float offsetY = center.y - startY[i];
+            float t = std::clamp((offsetX * deltaX[i] + offsetY * deltaY[i]) * inverseLengthSquared[i], 0.0f, 1.0f);
+            float awayX = offsetX - t * deltaX[i];
+            float awayY = offsetY - t * deltaY[i];
+            if (awayX * awayX + awayY * awayY < circleRadiusSquared) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::vector<float> startX;
+    std::vector<float> startY;
+    std::vector<float> deltaX;                  // end minus start
+    std::vector<float> deltaY;
+    std::vector<float> normalX;                 // unit length, 0 for a point
+    std::vector<float> normalY;
+    std::vector<float> inverseLengthSquared;    // 0 for a point
+    std::vector<float> minX;                    // bounding box
+    std::vector<float> minY;
+    std::vector<float> maxX;
+    std::vector<float> maxY;
+    std::vector<float> circleMinX;              // bounding box grown by the radius
+    std::vector<float> circleMinY;
+    std::vector<float> circleMaxX;
+    std::vector<float> circleMaxY;
+    float circleRadiusSquared = 0.0f;
+
+    // Whether a step crosses segment i, and where: alongStep / denominator
+    // of the way. Both are the crossing parameters times the shared
+    // denominator, so no division is needed to reject a miss.
+    bool crossing(size_t i, sf::Vector2f position, sf::Vector2f step, float& alongStep, float& denominator) const {
+        float offsetX = position.x - startX[i];
+        float offsetY = position.y - startY[i];
+        denominator = step.x * deltaY[i] - step.y * deltaX[i];
+        float alongWall = step.x * offsetY - step.y * offsetX;
+        alongStep = deltaX[i] * offsetY - deltaY[i] * offsetX;
+        if (denominator < 0) {
+            denominator = -denominator;
+            alongWall = -alongWall;
+            alongStep = -alongStep;
+        }
+        return !(denominator == 0 || alongWall < 0 || alongWall > denominator || alongStep < 0 || alongStep > denominator);
+    }
+
+    void add(sf::Vector2f start, sf::Vector2f end, float radius) {
+        sf::Vector2f delta = end - start;
+        float lengthSquared = delta.x * delta.x + delta.y * delta.y;
+        float length = std::sqrt(lengthSquared);
+        startX.push_back(start.x);
+        startY.push_back(start.y);
+        deltaX.push_back(delta.x);
+        deltaY.push_back(delta.y);
+        normalX.push_back(length > 0 ? -delta.y / length : 0.0f);
+        normalY.push_back(length > 0 ? delta.x / length : 0.0f);
+        inverseLengthSquared.push_back(lengthSquared > 0 ? 1.0f / lengthSquared : 0.0f);
+        minX.push_back(std::min(start.x, end.x));
+        minY.push_back(std::min(start.y, end.y));
+        maxX.push_back(std::max(start.x, end.x));
+        maxY.push_back(std::max(start.y, end.y));
+        circleMinX.push_back(minX.back() - radius);
+        circleMinY.push_back(minY.back() - radius);
+        circleMaxX.push_back(maxX.back() + radius);
+        circleMaxY.push_back(maxY.back() + radius);
+    }
+};
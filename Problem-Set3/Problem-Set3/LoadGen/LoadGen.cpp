@@ -0,0 +1,329 @@
+// Headless load generator. Opens many connections to the server from one
+// process, drives each bot's sprite with scripted or random input, decodes
+// every snapshot and reports latency, jitter, decode time and throughput as
+// percentiles.
+#include "../Common/PlayerMovement.h"
+#include "../Common/Protocol.h"
+#include "../Common/ServerLink.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+enum class Pattern { Random, Square };
+
+// Measurements gathered on a bot's receive thread since the last report
+struct BotSamples {
+    std::vector<double> inputLatency;   // ms from sending a command to seeing it applied
+    std::vector<double> interArrival;   // ms between snapshots
+    std::vector<double> jitter;         // ms change in inter-arrival from the previous one
+    std::vector<double> decodeTime;     // us per snapshot
+    uint64_t bytes = 0;
+    uint64_t snapshots = 0;
+    uint64_t decodeErrors = 0;
+
+    void append(const BotSamples& other) {
+        inputLatency.insert(inputLatency.end(), other.inputLatency.begin(), other.inputLatency.end());
+        interArrival.insert(interArrival.end(), other.interArrival.begin(), other.interArrival.end());
+        jitter.insert(jitter.end(), other.jitter.begin(), other.jitter.end());
+        decodeTime.insert(decodeTime.end(), other.decodeTime.begin(), other.decodeTime.end());
+        bytes += other.bytes;
+        snapshots += other.snapshots;
+        decodeErrors += other.decodeErrors;
+    }
+};
+
+struct SentInput {
+    uint32_t sequence;
+    Clock::time_point sentAt;
+};
+
+struct Bot {
+    ServerLink link;
+    std::mutex mutex;
+    PlayerId playerId = 0;
+    uint32_t nextSequence = 1;
+    uint32_t acknowledged = 0;
+    std::deque<SentInput> inFlight;       // last sequence of each batch not yet applied
+    std::vector<InputCommand> batch;
+    bool hasArrival = false;
+    Clock::time_point lastArrival;
+    double lastInterval = -1;
+    SnapshotMessage snapshot;             // reused so decoding does not reallocate
+    ParticleUpdateMessage update;
+    BotSamples samples;
+
+    // Movement script state
+    std::mt19937 rng;
+    uint8_t keys = 0;
+    uint32_t ticksLeft = 0;
+    uint32_t leg = 0;
+};
+
+// Receive thread
+void onBotMessage(Bot& bot, const char* data, size_t size) {
+    Clock::time_point now = Clock::now();
+    MessageType type;
+    if (!peekMessageType(data, size, type)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(bot.mutex);
+    bot.samples.bytes += size;
+    if (type == MessageType::Welcome) {
+        decodeWelcome(data, size, bot.playerId);
+        return;
+    }
+    if (type != MessageType::Snapshot && type != MessageType::ParticleUpdate) {
+        return;
+    }
+
+    // Budgeted updates carry every player, which is all a bot looks at
+    auto decodeStart = Clock::now();
+    bool decoded = type == MessageType::Snapshot ? decodeSnapshot(data, size, bot.snapshot) : decodeParticleUpdate(data, size, bot.update);
+    if (decoded && type == MessageType::ParticleUpdate) {
+        bot.snapshot.players.swap(bot.update.players);
+    }
+    auto decodeEnd = Clock::now();
+    if (!decoded) {
+        ++bot.samples.decodeErrors;
+        return;
+    }
+    ++bot.samples.snapshots;
+    bot.samples.decodeTime.push_back(std::chrono::duration<double, std::micro>(decodeEnd - decodeStart).count());
+
+    if (bot.hasArrival) {
+        double interval = std::chrono::duration<double, std::milli>(now - bot.lastArrival).count();
+        bot.samples.interArrival.push_back(interval);
+        if (bot.lastInterval >= 0) {
+            bot.samples.jitter.push_back(std::abs(interval - bot.lastInterval));
+        }
+        bot.lastInterval = interval;
+    }
+    bot.hasArrival = true;
+    bot.lastArrival = now;
+
+    // A batch counts as delivered once the server reports its last command applied
+    for (const PlayerState& player : bot.snapshot.players) {
+        if (player.id != bot.playerId) {
+            continue;
+        }
+        bot.acknowledged = std::max(bot.acknowledged, player.lastInput);
+        while (!bot.inFlight.empty() && bot.inFlight.front().sequence <= bot.acknowledged) {
+            bot.samples.inputLatency.push_back(std::chrono::duration<double, std::milli>(now - bot.inFlight.front().sentAt).count());
+            bot.inFlight.pop_front();
+        }
+        break;
+    }
+
+    // Tells the server which removals have arrived, as a client would
+    if (type == MessageType::ParticleUpdate) {
+        uint64_t tick = bot.update.tick;
+        lock.unlock();
+        bot.link.send(encodeUpdateAck(tick));
+    }
+}
+
+// Keys for this tick. Random bots hold a random direction for a random time;
+// square bots walk the same square over and over.
+uint8_t nextKeys(Bot& bot, Pattern pattern) {
+    if (bot.ticksLeft == 0) {
+        if (pattern == Pattern::Random) {
+            static const uint8_t directions[] = {
+                0, inputUp, inputDown, inputLeft, inputRight,
+                inputUp | inputLeft, inputUp | inputRight, inputDown | inputLeft, inputDown | inputRight
+            };
+            bot.keys = directions[std::uniform_int_distribution<size_t>(0, std::size(directions) - 1)(bot.rng)];
+            bot.ticksLeft = std::uniform_int_distribution<uint32_t>(20, 200)(bot.rng);
+        }
+        else {
+            static const uint8_t legs[] = { inputRight, inputDown, inputLeft, inputUp };
+            bot.keys = legs[bot.leg++ % std::size(legs)];
+            bot.ticksLeft = 50;
+        }
+    }
+    --bot.ticksLeft;
+    return bot.keys;
+}
+
+double percentile(std::vector<double>& values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+void printRow(const char* name, std::vector<double>& values, const char* unit) {
+    std::cout << "  " << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+        << " p50 " << std::setw(9) << percentile(values, 0.50)
+        << " p95 " << std::setw(9) << percentile(values, 0.95)
+        << " p99 " << std::setw(9) << percentile(values, 0.99)
+        << " max " << std::setw(9) << percentile(values, 1.0)
+        << " " << unit << " (" << values.size() << " samples)" << std::endl;
+}
+
+void report(const char* title, BotSamples& total, std::vector<double>& botBytesPerSecond, double seconds, size_t connected, size_t bots) {
+    std::cout << title << ": " << connected << "/" << bots << " bots connected, "
+        << total.snapshots << " snapshots, " << total.decodeErrors << " decode errors, "
+        << std::fixed << std::setprecision(1) << total.bytes / seconds / 1024.0 << " KiB/s total" << std::endl;
+    printRow("input latency", total.inputLatency, "ms");
+    printRow("inter-arrival", total.interArrival, "ms");
+    printRow("jitter", total.jitter, "ms");
+    printRow("decode", total.decodeTime, "us");
+    printRow("per-bot rate", botBytesPerSecond, "KiB/s");
+}
+
+std::atomic<bool> running(true);
+
+void stopRunning(int) {
+    running = false;
+}
+
+int main(int argc, char* argv[]) {
+    SocketLibrary sockets;
+    if (!sockets.ok()) {
+        std::cout << "The socket library could not be started" << std::endl;
+        return 1;
+    }
+
+    // Command line: [--server <ip>] [--port <port>] [--udp] [--bots <n>] [--duration <s>]
+    //               [--pattern random|square] [--report <s>] [--seed <n>]
+    std::string serverAddress = "127.0.0.1";
+    uint16_t serverPort = 55555;   // UDP uses the next port
+    bool useUdp = false;
+    size_t botCount = 100;
+    double duration = 0;   // run until interrupted
+    double reportInterval = 5;
+    Pattern pattern = Pattern::Random;
+    uint32_t seed = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--server" && i + 1 < argc) {
+            serverAddress = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            serverPort = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--udp") {
+            useUdp = true;
+        }
+        else if (arg == "--bots" && i + 1 < argc) {
+            botCount = std::stoul(argv[++i]);
+        }
+        else if (arg == "--duration" && i + 1 < argc) {
+            duration = std::stod(argv[++i]);
+        }
+        else if (arg == "--report" && i + 1 < argc) {
+            reportInterval = std::max(0.1, std::stod(argv[++i]));
+        }
+        else if (arg == "--pattern" && i + 1 < argc) {
+            pattern = std::string(argv[++i]) == "square" ? Pattern::Square : Pattern::Random;
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<uint32_t>(std::stoul(argv[++i]));
+        }
+    }
+    std::signal(SIGINT, stopRunning);
+
+    std::vector<std::unique_ptr<Bot>> bots;
+    for (size_t i = 0; i < botCount; ++i) {
+        auto bot = std::make_unique<Bot>();
+        bot->rng.seed(seed + static_cast<uint32_t>(i));
+        Bot* target = bot.get();
+        bot->link.setMessageHandler([target](const char* data, size_t size) {
+            onBotMessage(*target, data, size);
+        });
+        bool linked = useUdp ? bot->link.connectUdp(serverAddress, serverPort + 1) : bot->link.connectTcp(serverAddress, serverPort);
+        if (!linked) {
+            std::cout << "Bot " << i << " failed to connect." << std::endl;
+            break;
+        }
+        bots.push_back(std::move(bot));
+    }
+    std::cout << bots.size() << " bots started against " << serverAddress << (useUdp ? " over UDP" : " over TCP") << std::endl;
+
+    const uint32_t ticksPerBatch = 3;
+    uint32_t tick = 0;
+    auto start = Clock::now();
+    auto nextTick = start;
+    auto lastReport = start;
+    BotSamples overall;
+    std::vector<double> overallRates;
+
+    while (running) {
+        // Same cadence as a real client: a command per tick while keys are
+        // held, sent every few ticks or as soon as the keys are released
+        for (auto& bot : bots) {
+            uint8_t keys = nextKeys(*bot, pattern);
+            if (keys != 0) {
+                bot->batch.push_back({ bot->nextSequence++, tick, keys });
+            }
+            if (!bot->batch.empty() && ((tick + 1) % ticksPerBatch == 0 || keys == 0)) {
+                {
+                    std::lock_guard<std::mutex> lock(bot->mutex);
+                    bot->inFlight.push_back({ bot->batch.back().sequence, Clock::now() });
+                }
+                bot->link.send(encodeInputBatch(bot->batch.data(), bot->batch.size()));
+                bot->batch.clear();
+            }
+        }
+        ++tick;
+
+        auto now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        bool finished = duration > 0 && elapsed >= duration;
+        if (finished || std::chrono::duration<double>(now - lastReport).count() >= reportInterval) {
+            double seconds = std::chrono::duration<double>(now - lastReport).count();
+            BotSamples total;
+            std::vector<double> rates;
+            size_t connected = 0;
+            for (auto& bot : bots) {
+                BotSamples samples;
+                {
+                    std::lock_guard<std::mutex> lock(bot->mutex);
+                    std::swap(samples, bot->samples);
+                }
+                connected += bot->link.isConnected() ? 1 : 0;
+                rates.push_back(samples.bytes / seconds / 1024.0);
+                total.append(samples);
+            }
+            overall.append(total);
+            overallRates.insert(overallRates.end(), rates.begin(), rates.end());
+            report("Interval", total, rates, seconds, connected, bots.size());
+            lastReport = now;
+            if (finished) {
+                break;
+            }
+        }
+
+        nextTick += std::chrono::milliseconds(inputTickMilliseconds);
+        std::this_thread::sleep_until(nextTick);
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    size_t connected = 0;
+    for (auto& bot : bots) {
+        connected += bot->link.isConnected() ? 1 : 0;
+        bot->link.close();
+    }
+    report("Summary", overall, overallRates, seconds, connected, bots.size());
+
+    return 0;
+}
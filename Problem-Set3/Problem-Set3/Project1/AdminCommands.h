@@ -0,0 +1,181 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "ParticleSpawner.h"
+#include "World.h"
+
+#include <cstddef>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// Scene commands accepted on the admin socket and from "exec" lines in the
+// config file. Angles are in degrees; positions and speeds in pixels.
+//
+//     spawn line <count> <x1> <y1> <x2> <y2> <speed> <angle>
+//     spawn fan <count> <x> <y> <startAngle> <endAngle> <speed>
+//     spawn ramp <count> <x> <y> <angle>
+//     emit <rate> <lifetime> line|fan|ramp <count> ...
+//     wall <x1> <y1> <x2> <y2>
+//     canvas <width> <height>
+//     clear particles|walls|lastwall|emitters
+//
+// emit takes the same shapes as spawn and adds an emitter that launches rate
+// particles a second, going round the count positions of the shape, each
+// living lifetime seconds.
+using WorldCommand = std::function<void(World&)>;
+
+// A spawn is built in the background by ServerLoop::spawn() rather than run
+// as a WorldCommand on the tick thread
+struct SpawnCommand {
+    size_t count = 0;
+    ShapeSpec spec;
+    SpawnShape shape;
+};
+
+inline bool isSpawnCommand(const std::string& line) {
+    std::istringstream in(line);
+    std::string verb;
+    in >> verb;
+    return verb == "spawn";
+}
+
+// Turns a spawn line into a count and shape. Returns false with a message if
+// the line is not a valid spawn.
+inline bool parseSpawnCommand(const std::string& line, SpawnCommand& spawn, std::string& error) {
+    const float degrees = 3.14159265358979323846f / 180.0f;
+    std::istringstream in(line);
+    std::string verb, shape;
+    long long count = 0;
+    in >> verb >> shape >> count;
+    if (!in || count < 0 || count > static_cast<long long>(maxSpawnCount)) {
+        error = "usage: spawn line|fan|ramp <count 0-" + std::to_string(maxSpawnCount) + "> ...";
+        return false;
+    }
+    spawn.count = static_cast<size_t>(count);
+    if (shape == "line") {
+        sf::Vector2f start, end;
+        float speed = 0.0f, angle = 0.0f;
+        if (!(in >> start.x >> start.y >> end.x >> end.y >> speed >> angle)) {
+            error = "usage: spawn line <count> <x1> <y1> <x2> <y2> <speed> <angle>";
+            return false;
+        }
+        spawn.spec = lineSpec(spawn.count, start, end, speed, angle * degrees);
+    }
+    else if (shape == "fan") {
+        sf::Vector2f origin;
+        float startAngle = 0.0f, endAngle = 0.0f, speed = 0.0f;
+        if (!(in >> origin.x >> origin.y >> startAngle >> endAngle >> speed)) {
+            error = "usage: spawn fan <count> <x> <y> <startAngle> <endAngle> <speed>";
+            return false;
+        }
+        spawn.spec = fanSpec(spawn.count, origin, startAngle * degrees, endAngle * degrees, speed);
+    }
+    else if (shape == "ramp") {
+        sf::Vector2f origin;
+        float angle = 0.0f;
+        if (!(in >> origin.x >> origin.y >> angle)) {
+            error = "usage: spawn ramp <count> <x> <y> <angle>";
+            return false;
+        }
+        spawn.spec = speedRampSpec(spawn.count, origin, angle * degrees);
+    }
+    else {
+        error = "unknown spawn shape '" + shape + "'";
+        return false;
+    }
+    spawn.shape = makeShape(spawn.spec);
+    return true;
+}
+
+// Shared by the emit command and scene files
+inline bool checkEmitter(float rate, float lifetime, size_t count, std::string& error) {
+    if (!(rate > 0.0f) || rate > maxSpawnCount) {
+        error = "an emitter needs a rate from above 0 to " + std::to_string(maxSpawnCount) + " a second";
+        return false;
+    }
+    if (!(lifetime > 0.0f) || static_cast<double>(rate) * lifetime > maxSpawnCount) {
+        error = "an emitter needs a lifetime above 0 with rate * lifetime up to " + std::to_string(maxSpawnCount);
+        return false;
+    }
+    if (count == 0 || count > maxSpawnCount) {
+        error = "an emitter needs a count from 1 to " + std::to_string(maxSpawnCount);
+        return false;
+    }
+    return true;
+}
+
+// Turns one of the other command lines into a change to run on the tick
+// thread. Returns false with a message if the line is not a valid command.
+inline bool parseWorldCommand(const std::string& line, WorldCommand& command, std::string& error) {
+    std::istringstream in(line);
+    std::string verb;
+    in >> verb;
+
+    if (verb == "emit") {
+        float rate = 0.0f, lifetime = 0.0f;
+        if (!(in >> rate >> lifetime)) {
+            error = "usage: emit <rate> <lifetime> line|fan|ramp <count> ...";
+            return false;
+        }
+        std::string shapeArguments;
+        std::getline(in, shapeArguments);
+        SpawnCommand spawn;
+        if (!parseSpawnCommand("spawn" + shapeArguments, spawn, error) || !checkEmitter(rate, lifetime, spawn.count, error)) {
+            return false;
+        }
+        Emitter emitter = makeEmitter(spawn.spec, rate, lifetime);
+        command = [emitter](World& world) { world.emitters.push_back(emitter); };
+        return true;
+    }
+
+    if (verb == "wall") {
+        sf::Vector2f start, end;
+        if (!(in >> start.x >> start.y >> end.x >> end.y)) {
+            error = "usage: wall <x1> <y1> <x2> <y2>";
+            return false;
+        }
+        command = [=](World& world) { addWall(world, start, end); };
+        return true;
+    }
+
+    if (verb == "canvas") {
+        float width = 0.0f, height = 0.0f;
+        if (!(in >> width >> height) || !validCanvasSize(width, height)) {
+            error = "usage: canvas <width> <height>, each above 0 and at most " + std::to_string(largestCanvasSide);
+            return false;
+        }
+        command = [=](World& world) {
+            world.canvasWidth = width;
+            world.canvasHeight = height;
+        };
+        return true;
+    }
+
+    if (verb == "clear") {
+        std::string what;
+        in >> what;
+        if (what == "particles") {
+            command = [](World& world) { world.particles.clear(); };
+        }
+        else if (what == "walls") {
+            command = [](World& world) { clearWalls(world); };
+        }
+        else if (what == "lastwall") {
+            command = [](World& world) { removeLastWall(world); };
+        }
+        else if (what == "emitters") {
+            command = [](World& world) { world.emitters.clear(); };
+        }
+        else {
+            error = "usage: clear particles|walls|lastwall|emitters";
+            return false;
+        }
+        return true;
+    }
+
+    error = "unknown command '" + verb + "'";
+    return false;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "../Common/Socket.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+// Line-based admin socket for operating a server without its window. It
+// listens on 127.0.0.1 only, so it is reachable from the same machine (for
+// example with "nc 127.0.0.1 <port>") and nowhere else. Every line received
+// is passed to the handler on the admin thread and the handler's reply is
+// sent back followed by a newline.
+class AdminServer {
+public:
+    using Handler = std::function<std::string(const std::string&)>;
+
+    explicit AdminServer(Handler handler)
+        : handler(std::move(handler)), running(false), listenSocket(INVALID_SOCKET) {}
+
+    ~AdminServer() {
+        stop();
+    }
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    bool start(uint16_t port) {
+        listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSocket == INVALID_SOCKET) {
+            std::cerr << "Admin socket(): " << socketError() << std::endl;
+            return false;
+        }
+        int reuse = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+        sockaddr_in service{};
+        service.sin_family = AF_INET;
+        service.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        service.sin_port = htons(port);
+        if (bind(listenSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR || ::listen(listenSocket, 4) == SOCKET_ERROR) {
+            std::cerr << "Admin socket could not listen on port " << port << ": " << socketError() << std::endl;
+            closesocket(listenSocket);
+            listenSocket = INVALID_SOCKET;
+            return false;
+        }
+        running = true;
+        thread = std::thread(&AdminServer::run, this);
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+        for (Session& session : sessions) {
+            closesocket(session.socket);
+        }
+        sessions.clear();
+        closesocket(listenSocket);
+        listenSocket = INVALID_SOCKET;
+    }
+
+private:
+    struct Session {
+        SOCKET socket;
+        std::string pending;   // received text not yet ending in a newline
+    };
+
+    // Longest line accepted before the session is dropped
+    static constexpr size_t maxLineLength = 4096;
+
+    Handler handler;
+    std::atomic<bool> running;
+    SOCKET listenSocket;
+    std::thread thread;
+    std::vector<Session> sessions;
+
+    // Polled with a short timeout, which bounds how long stop() waits. Not
+    // select(), because with thousands of game connections open the admin
+    // sockets can be numbered past what an fd_set holds.
+    void run() {
+#ifdef _WIN32
+        typedef WSAPOLLFD PollFd;
+#else
+        typedef pollfd PollFd;
+#endif
+        std::vector<PollFd> pollFds;
+        while (running) {
+            pollFds.clear();
+            pollFds.push_back({ listenSocket, POLLIN, 0 });
+            for (const Session& session : sessions) {
+                pollFds.push_back({ session.socket, POLLIN, 0 });
+            }
+#ifdef _WIN32
+            int ready = WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 100);
+#else
+            int ready = ::poll(pollFds.data(), pollFds.size(), 100);
+#endif
+            if (ready <= 0) {
+                continue;
+            }
+
+            // Sessions first, while pollFds still lines up with them
+            for (size_t i = sessions.size(); i-- > 0;) {
+                if (pollFds[i + 1].revents != 0 && !serve(sessions[i])) {
+                    closesocket(sessions[i].socket);
+                    sessions.erase(sessions.begin() + i);
+                }
+            }
+
+            if (pollFds[0].revents & POLLIN) {
+                SOCKET client = accept(listenSocket, nullptr, nullptr);
+                if (client != INVALID_SOCKET) {
+                    sessions.push_back({ client, std::string() });
+                }
+            }
+        }
+    }
+
+    // Reads what the session sent and answers every complete line. Returns
+    // false once the session should be closed.
+    bool serve(Session& session) {
+        char buffer[1024];
+        int received = recv(session.socket, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return false;
+        }
+        session.pending.append(buffer, received);
+
+        size_t newline;
+        while ((newline = session.pending.find('\n')) != std::string::npos) {
+            std::string line = session.pending.substr(0, newline);
+            session.pending.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty()) {
+                continue;
+            }
+            std::string reply = handler(line) + "\n";
+            if (send(session.socket, reply.data(), static_cast<int>(reply.size()), socketSendFlags) == SOCKET_ERROR) {
+                return false;
+            }
+        }
+        return session.pending.size() <= maxLineLength;
+    }
+};
@@ -1,6 +1,5 @@
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
-#define RADIUS 5.0
 
 #endif
 #include <SFML/Graphics.hpp>
@@ -24,544 +23,342 @@
 #include <utility>
 #include <stdexcept>
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
+#include <csignal>
 #include <ctime>
+#include <filesystem>
 #include <fstream>
 #include <string> // for std::string
 #include <sstream> // for std::stringstream
 
+#include "../Common/AllocationCounter.h"
+#include "../Common/NetReactor.h"
+#include "AdminCommands.h"
+#include "AdminServer.h"
+#include "NetTelemetry.h"
+#include "PlayerRegistry.h"
+#include "Recording.h"
+#include "SendStage.h"
+#include "ServerConfig.h"
+#include "ServerLoop.h"
+#include "StressScenes.h"
+#include "World.h"
+
 bool devWindowCreated = false;
 sf::RenderWindow window;
 // Global variables
-std::mutex clientSocketsMutex;
-std::vector<SOCKET> clientSockets;
+// Connected explorers and their last reported sprite positions, written by the
+// network I/O threads and read once per frame
+PlayerRegistry players;
 
-template<typename T>
-const T& clamp(const T& value, const T& min, const T& max) {
-    return (value < min) ? min : ((max < value) ? max : value);
-}
 namespace fs = std::filesystem;
 
-class ThreadPool {
-public:
-    ThreadPool(size_t numThreads) : stop(false) {
-        for (size_t i = 0; i < numThreads; ++i) {
-            threads.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(queueMutex);
-                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
-                        if (stop && tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(tasks.front());
-                        tasks.pop();
-                    }
-
-                    task();
-                }
-                });
-        }
-    }
-
-    ~ThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            stop = true;
-        }
-        condition.notify_all();
-        for (std::thread& worker : threads) {
-            worker.join();
-        }
-    }
-
-    template <class F, class... Args>
-    void enqueue(F&& f, Args&&... args) {
-        {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            tasks.emplace([=]() mutable { std::forward<F>(f)(std::forward<Args>(args)...); });
-        }
-        condition.notify_one();
-    }
-
-private:
-    std::vector<std::thread> threads;
-    std::queue<std::function<void()>> tasks;
-    std::mutex queueMutex;
-    std::condition_variable condition;
-    bool stop;
-};
-
-class Particle {
-public:
-    Particle(float startX, float startY, float speed, float angle)
-        : position(startX, startY), velocity(speed* std::cos(angle), speed* std::sin(angle)), isCollided(false) {}
-
-    Particle(const Particle& other)
-        : position(other.position), velocity(other.velocity) {}
-
-    Particle& operator=(const Particle& other) {
-        if (this != &other) {
-            std::lock(mutex, other.mutex);
-            std::lock_guard<std::mutex> self_lock(mutex, std::adopt_lock);
-            std::lock_guard<std::mutex> other_lock(other.mutex, std::adopt_lock);
-            position = other.position;
-            velocity = other.velocity;
-        }
-        return *this;
-    }
-
-    void update(float deltaTime, float canvasWidth, float canvasHeight, const std::vector<sf::VertexArray>& walls) {
-        std::lock_guard<std::mutex> lock(mutex);
-
-        sf::Vector2f nextPosition = position + velocity * deltaTime;
-
-        if (nextPosition.x < 0 || nextPosition.x > canvasWidth) {
-            velocity.x = -velocity.x;
-            nextPosition.x = clamp(nextPosition.x, 0.0f, static_cast<float>(canvasWidth));
-        }
-        if (nextPosition.y < 0 || nextPosition.y > canvasHeight) {
-            velocity.y = -velocity.y;
-            nextPosition.y = clamp(nextPosition.y, 0.0f, static_cast<float>(canvasHeight));
-        }
-        if (!isCollided) {
-            for (const auto& wall : walls) {
-                for (size_t i = 0; i < wall.getVertexCount() - 1; ++i) {
-                    sf::Vector2f p1 = wall[i].position;
-                    sf::Vector2f p2 = wall[i + 1].position;
-                    if (intersects(position, nextPosition, p1, p2)) {
-                        isCollided = true;
-
-
-                        sf::Vector2f normal = getNormal(p1, p2);
-
-                        float dotProduct = velocity.x * normal.x + velocity.y * normal.y;
-                        sf::Vector2f reflection = velocity - 2.0f * dotProduct * normal;
-                        nextPosition = getCollisionPoint(position, nextPosition, p1, p2);
-
-                        velocity = reflection;
-                        break;
-                    }
-                }
-            }
-        }
-        else {
-            isCollided = false;
-        }
-        position = nextPosition;
-    }
-
-    sf::Vector2f getPosition() const {
-        return position;
-    }
-    sf::Vector2f getVelocity() const {
-        return velocity;
-    }
-
-    //no longer in use
-    void render(sf::RenderWindow& window) const {
-        std::lock_guard<std::mutex> lock(mutex);
-
-        sf::CircleShape shape(5.0f);
-        shape.setFillColor(sf::Color::Green);
-        shape.setPosition(position);
-        window.draw(shape);
-    }
-
-private:
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    mutable std::mutex mutex;
-    bool isCollided;
-
-    sf::Vector2f getCollisionPoint(const sf::Vector2f& startPos, const sf::Vector2f& endPos, const sf::Vector2f& wallStart, const sf::Vector2f& wallEnd) {
-        sf::Vector2f collisionPoint;
-
-        float x1 = startPos.x, y1 = startPos.y;
-        float x2 = endPos.x, y2 = endPos.y;
-        float x3 = wallStart.x, y3 = wallStart.y;
-        float x4 = wallEnd.x, y4 = wallEnd.y;
-
-        float denom = (x1 - x2) * (y3 - y4) - (y1 - y2) * (x3 - x4);
-
-        if (denom == 0) {
-            return endPos;
-        }
-
-        float t = ((x1 - x3) * (y3 - y4) - (y1 - y3) * (x3 - x4)) / denom;
-        float u = -((x1 - x2) * (y1 - y3) - (y1 - y2) * (x1 - x3)) / denom;
-
-        if (t >= 0 && t <= 1 && u >= 0 && u <= 1) {
-            collisionPoint.x = x1 + t * (x2 - x1);
-            collisionPoint.y = y1 + t * (y2 - y1);
-        }
-        else {
-            return endPos;
-        }
-
-        return collisionPoint;
-    }
-
-    static bool intersects(const sf::Vector2f& p1, const sf::Vector2f& p2, const sf::Vector2f& q1, const sf::Vector2f& q2) {
-        float s1_x, s1_y, s2_x, s2_y;
-        s1_x = p2.x - p1.x;
-        s1_y = p2.y - p1.y;
-        s2_x = q2.x - q1.x;
-        s2_y = q2.y - q1.y;
-        float s, t;
-        s = (-s1_y * (p1.x - q1.x) + s1_x * (p1.y - q1.y)) / (-s2_x * s1_y + s1_x * s2_y);
-        t = (s2_x * (p1.y - q1.y) - s2_y * (p1.x - q1.x)) / (-s2_x * s1_y + s1_x * s2_y);
-
-        return s >= 0 && s <= 1 && t >= 0 && t <= 1;
-    }
-
-    sf::Vector2f getNormal(const sf::Vector2f& p1, const sf::Vector2f& p2) {
-        sf::Vector2f direction = p2 - p1;
-
-        sf::Vector2f normal(-direction.y, direction.x); // Rotate direction vector 90 degrees
-
-        float length = std::sqrt(normal.x * normal.x + normal.y * normal.y);
-        if (length != 0) {
-            normal.x /= length;
-            normal.y /= length;
-        }
-
-        return normal;
-    }
-};
-
+// Every wall as one list of line segments, drawn in a single call. The
+// caller keeps vertices so its buffer is reused from frame to frame.
 void renderWalls(sf::RenderWindow& window,
     const std::vector<sf::VertexArray>& walls,
-    std::mutex& mutex,
-    float scale) {
-    std::lock_guard<std::mutex> lock(mutex);
+    float scale,
+    std::vector<sf::Vertex>& vertices) {
+    vertices.clear();
     for (const auto& wall : walls) {
-        // Create a transformed copy of the wall vertices with the given scale
-        sf::VertexArray scaledWall(wall.getPrimitiveType());
-        for (size_t i = 0; i < wall.getVertexCount(); ++i) {
-            scaledWall.append(sf::Vertex(sf::Vector2f(wall[i].position.x * scale, wall[i].position.y * scale)));
+        for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+            vertices.emplace_back(wall[i].position * scale);
+            vertices.emplace_back(wall[i + 1].position * scale);
         }
-        window.draw(scaledWall);
+    }
+    if (!vertices.empty()) {
+        window.draw(vertices.data(), vertices.size(), sf::Lines);
     }
 }
 
-void renderParticles(const std::vector<Particle>& particles,
+// The shapes are made once by the caller, since building one allocates
+void renderParticles(const std::vector<sf::Vector2f>& particles,
     sf::RenderWindow& window,
-    std::mutex& mutex,
-    float scale) {
-    std::lock_guard<std::mutex> lock(mutex);
-    for (const auto& particle : particles) {
-        sf::CircleShape particleShape(5.0f * scale); // Adjust particle size based on scale
-        sf::Vector2f particlePosition = particle.getPosition();
+    sf::CircleShape& particleShape) {
+    for (const auto& particlePosition : particles) {
         particleShape.setPosition(particlePosition);
-        particleShape.setFillColor(sf::Color::Green);
         window.draw(particleShape);
     }
 }
 
-void renderSprite(const std::vector<sf::Vector2f>& receivedPositions,
-    std::mutex& mutex,
+void renderSprite(const std::vector<PlayerState>& receivedPositions,
     sf::RenderWindow& window,
-    float scale) {
-    std::lock_guard<std::mutex> lock(mutex);
-
-    sf::CircleShape particleShape(5.0f * scale); // Adjust particle size based on scale
-    particleShape.setFillColor(sf::Color::Red);
-
-    for (const auto& position : receivedPositions) {
-        particleShape.setPosition(position);
-        window.draw(particleShape);
+    sf::CircleShape& spriteShape) {
+    for (const auto& player : receivedPositions) {
+        spriteShape.setPosition(player.position);
+        window.draw(spriteShape);
     }
 }
 
 
-float dot(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-    return v1.x * v2.x + v1.y * v2.y;
-}
+// Network callbacks, run on the reactor's or the UDP transport's I/O thread
+// Each transport keeps the input queues of its own connections. The map is
+// only touched on that transport's I/O thread, which is also the only
+// producer for the queues in it.
+using InputQueues = std::unordered_map<uint32_t, std::shared_ptr<PlayerRegistry::InputQueue>>;
+std::atomic<uint64_t> droppedInputs(0);
 
-float distance(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-    return std::sqrt((v1.x - v2.x) * (v1.x - v2.x) + (v1.y - v2.y) * (v1.y - v2.y));
+PlayerId onClientConnected(ClientRef client, InputQueues& queues) {
+    PlayerId id = players.join(client, queues[client.id]);
+    std::cout << "Player " << id << " joined (" << players.size() << " connected)" << std::endl;
+    return id;
 }
 
-sf::Vector2f getClosestPointOnSegment(const sf::Vector2f& point, const sf::Vector2f& segmentStart, const sf::Vector2f& segmentEnd) {
-    sf::Vector2f segment = segmentEnd - segmentStart;
-    float lengthSquared = segment.x * segment.x + segment.y * segment.y; // Compute squared length directly
-    if (lengthSquared == 0) {
-        return segmentStart;
-    }
-    float t = std::max(0.0f, std::min(1.0f, dot(point - segmentStart, segment) / lengthSquared));
-    return segmentStart + t * segment;
+void onClientDisconnected(ClientRef client, InputQueues& queues) {
+    queues.erase(client.id);
+    players.leave(client);
 }
 
-bool collidesWithWalls(const sf::Vector2f& position, const std::vector<sf::VertexArray>& walls, float canvasWidth, float canvasHeight) {
-    for (const auto& wall : walls) {
-        for (size_t i = 0; i < wall.getVertexCount() - 1; ++i) {
-            sf::Vector2f p1 = wall[i].position;
-            sf::Vector2f p2 = wall[i + 1].position;
-            p1.x -= RADIUS;
-            p1.y -= RADIUS;
-            p2.x -= RADIUS;
-            p2.y -= RADIUS;
-            sf::Vector2f closestPoint = getClosestPointOnSegment(position, p1, p2);
+void onClientMessage(ClientRef client, InputQueues& queues, const char* data, size_t size) {
+    auto queue = queues.find(client.id);
+    if (queue == queues.end()) {
+        return;
+    }
 
+    MessageType type;
+    if (!peekMessageType(data, size, type)) {
+        return;
+    }
 
+    // A relay gives up its player and just receives snapshots
+    if (type == MessageType::Subscribe) {
+        queues.erase(queue);
+        players.spectate(client);
+        std::cout << "Spectator subscribed (" << players.spectatorCount() << " watching)" << std::endl;
+        return;
+    }
 
-            if (distance(position, closestPoint) < RADIUS) {
-                return true; // Collision detected
-            }
+    // Lets the send stage stop repeating the removals it has seen
+    if (type == MessageType::UpdateAck) {
+        uint64_t acknowledgedTick;
+        if (decodeUpdateAck(data, size, acknowledgedTick)) {
+            players.acknowledge(client, acknowledgedTick);
         }
+        return;
     }
-    // Check if the position is outside the canvas boundaries
-    if (position.x < 0 || position.x >= canvasWidth || position.y < 0 || position.y >= canvasHeight) {
-        return true; // Collision detected with canvas boundaries
-    }
-    return false; // No collision detected
-}
 
-void handleInput(sf::CircleShape& ball, float canvasWidth, float canvasHeight, const std::vector<sf::VertexArray>& walls, bool& developerMode) {
-    const float speed = 5.0f;
-    std::cout << developerMode << std::endl;
-    while (true) {
-        if (!developerMode) {
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::W) && ball.getPosition().y >= 0) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.y -= speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(0, -speed);
-                }
-            }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::A) && ball.getPosition().x >= 0) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.x -= speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(-speed, 0);
-                }
-            }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::S) && ball.getPosition().y + ball.getRadius() + RADIUS < canvasHeight) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.y += speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(0, speed);
-                }
-            }
-            if (sf::Keyboard::isKeyPressed(sf::Keyboard::D) &&
-                ball.getPosition().x + ball.getRadius() + RADIUS < canvasWidth) {
-                sf::Vector2f nextPosition = ball.getPosition();
-                nextPosition.x += speed;
-                if (!collidesWithWalls(nextPosition, walls, canvasWidth, canvasHeight)) {
-                    ball.move(speed, 0);
-                }
+    // Queue the client's input for the next frame; a client that sends
+    // faster than the frame drains loses the excess
+    thread_local std::vector<InputCommand> commands;
+    if (decodeInputBatch(data, size, commands)) {
+        for (const InputCommand& command : commands) {
+            if (!queue->second->push(command)) {
+                ++droppedInputs;
             }
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
 }
 
+// Set by the admin "shutdown" command or Ctrl+C; stops both the viewer and a
+// headless server
+std::atomic<bool> shutdownRequested(false);
 
-// Function to receive packets from the client socket
-// sf::Vector2f receivePackets(SOCKET clientSocket) {
-//     sf::Vector2f receivedPosition;
-//     while (true) {
-//         // Receive ball position from the client socket
-//         if (recv(clientSocket, reinterpret_cast<char*>(&receivedPosition), sizeof(receivedPosition), 0) != SOCKET_ERROR) {
-//             // Print the received position
-//             std::cout << "Received ball position: (" << receivedPosition.x << ", " << receivedPosition.y << ")" << std::endl;
-//             // Update the global variable with the received position
-//             return receivedPosition;
-//         }
-//         else {
-//             std::cout << "Connection closed or error occurred." << std::endl;
-//             return sf::Vector2f(-1000, -1000);
-//         }
-//     }
-// }
-
-// std::tuple<std::string, sf::Vector2f> receivePackets(SOCKET clientSocket) {
-//     std::string clientId;
-//     sf::Vector2f receivedPosition;
-
-//     // Receive data from the client socket
-//     char idBuffer[256];
-//     char buffer[sizeof(idBuffer) + sizeof(sf::Vector2f)];
-
-//     if (recv(clientSocket, buffer, sizeof(buffer), 0) != SOCKET_ERROR) {
-//         // Extract client ID and position from buffer
-//         std::memcpy(idBuffer, buffer, sizeof(idBuffer));
-//         idBuffer[sizeof(idBuffer) - 1] = '\0';
-//         clientId = std::string(idBuffer);
-
-//         std::memcpy(&receivedPosition, buffer + sizeof(int), sizeof(sf::Vector2f));
-
-//         // Print the received data
-//         std::cout << "Received from client: " << clientId << "Ball position (" << receivedPosition.x << ", " << receivedPosition.y << ")" << std::endl;
-//     }
-//     else {
-//         std::cout << "Connection closed or error occurred." << std::endl;
-//         // Return a default client ID and position in case of error
-//         clientId = "";
-//         receivedPosition = sf::Vector2f(-1000, -1000);
-//     }
-
-//     return std::make_tuple(clientId, receivedPosition);
-// }    
-
-std::tuple<std::string, sf::Vector2f> receivePackets(SOCKET clientSocket, std::string& id) {
-    sf::Vector2f receivedPosition;
-    sf::Packet packet;
-
-    while (true) {
-        // Receive packet from the client socket
-        char buffer[1024]; // Adjust the buffer size according to your needs
-        int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
-        if (bytesReceived == SOCKET_ERROR) {
-            std::cerr << "Failed to receive data from the client!" << std::endl;
-            return std::make_tuple("",sf::Vector2f(-1000, -1000));
-        }
-
-        // Load the received data into the packet
-        packet.append(buffer, bytesReceived);
-
-        // Extract ID and position from the packet
-        packet >> id >> receivedPosition.x >> receivedPosition.y;
-
-        // Return the received position
-        return std::make_tuple(id, receivedPosition);
-    }
+void requestShutdown(int) {
+    shutdownRequested = true;
 }
 
-std::string receiveSerializedData(SOCKET clientSocket) {
-    // Buffer to store received data
-    char buffer[1024]; // Adjust buffer size as needed
-
-    // Receive data from the client socket
-    int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
-
-    if (bytesReceived <= 0) {
-        // Handle connection error or closed connection
-        return ""; // Return empty string
-    }
-
-    // Convert received data to a string
-    std::string receivedData(buffer, bytesReceived);
-
-    return receivedData;
+// Replaces the scene and the particles with a generated stress scene, both in
+// the tick its particles are ready. Returns false with a message, leaving the
+// world as it was, if the preset or counts are invalid or a spawn is still
+// running.
+bool startStressScene(ServerLoop& loop, const std::string& preset, size_t walls, size_t particles, uint32_t seed, std::string& error) {
+    // Checked first too, so a busy spawner does not cost a scene generation
+    if (loop.spawning()) {
+        error = "a spawn is already running";
+        return false;
+    }
+    StressScene generated;
+    if (!generateStressScene(preset, walls, particles, seed, generated, error)) {
+        return false;
+    }
+    if (!loop.spawnScene(std::move(generated.scene), generated.spawn.count, std::move(generated.spawn.shape))) {
+        error = "a spawn is already running";
+        return false;
+    }
+    return true;
 }
 
-void sendSerializedData(SOCKET clientSocket, const std::string& serializedData) {
-    // Convert serialized data to a char array
-    const char* dataBuffer = serializedData.c_str();
-    int dataSize = serializedData.size();
-
-    // Send the data to the client socket
-    int bytesSent = send(clientSocket, dataBuffer, dataSize, 0);
-
-    // Check for errors
-    if (bytesSent == SOCKET_ERROR) {
-        std::cerr << "Error sending serialized data." << std::endl;
+// Answers one admin socket line. Scene commands are queued for the next tick.
+std::string handleAdminCommand(ServerLoop& loop, const std::string& line) {
+    if (line == "status") {
+        std::ostringstream status;
+        status << "tick " << loop.tickCount()
+            << " particles " << loop.particleCount()
+            << " walls " << loop.wallCount()
+            << " emitters " << loop.emitterCount()
+            << " players " << players.size()
+            << " spectators " << players.spectatorCount()
+            << " tick_ms " << loop.lastTickMilliseconds()
+            << " budget " << loop.sends().getClientBudget()
+            << " tolerance " << loop.sends().getErrorTolerance()
+            << " spawn_progress " << loop.spawnProgress();
+        if (countingAllocations) {
+            status << " tick_allocations " << loop.lastTickAllocations();
+        }
+        return status.str();
     }
-}
-
-void sendParticles(SOCKET clientSocket, const std::vector<Particle>& particles, const sf::Vector2f& receivedPosition) {
-    // Serialize particle positions and received position
-    std::ostringstream oss;
-    oss << receivedPosition.x << " " << receivedPosition.y;
-
-    for (const auto& particle : particles) {
-        oss << " " << particle.getPosition().x << " " << particle.getPosition().y;
+    if (line == "shutdown") {
+        shutdownRequested = true;
+        return "ok";
     }
-
-    std::string serializedData = oss.str();
-
-    // Send serialized data to the client
-    sendSerializedData(clientSocket, serializedData);
-}
-
-void updateBallPositions(const std::vector<sf::Vector2f>& receivedPositions, std::vector<sf::CircleShape>& balls) {
-    // Iterate over each received position and update the corresponding ball position
-    for (size_t i = 0; i < receivedPositions.size(); ++i) {
-        balls[i].setPosition(receivedPositions[i]);
+    if (line.rfind("budget ", 0) == 0) {
+        try {
+            loop.sends().setClientBudget(std::stoul(line.substr(7)));
+        }
+        catch (const std::exception&) {
+            return "error: usage: budget <bytes per snapshot, 0 for no limit>";
+        }
+        return "ok";
+    }
+    if (line.rfind("tolerance ", 0) == 0) {
+        try {
+            loop.sends().setErrorTolerance(std::stof(line.substr(10)));
+        }
+        catch (const std::exception&) {
+            return "error: usage: tolerance <pixels, 0 to send every particle>";
+        }
+        return "ok";
+    }
+    if (line == "checkpoint" || line.rfind("checkpoint ", 0) == 0) {
+        std::string path = line.size() > 11 ? line.substr(11) : loop.getCheckpointFile();
+        if (path.empty()) {
+            return "error: usage: checkpoint <file>, or set checkpoint_file";
+        }
+        loop.checkpoint(path);
+        return "ok";
+    }
+    if (line == "record stop") {
+        loop.stopRecording();
+        return "ok";
+    }
+    if (line.rfind("save ", 0) == 0) {
+        loop.saveScene(line.substr(5));
+        return "ok";
+    }
+    std::string error;
+    if (line == "restore" || line.rfind("restore ", 0) == 0) {
+        std::string path = line.size() > 8 ? line.substr(8) : loop.getCheckpointFile();
+        Checkpoint checkpoint;
+        if (path.empty() || !loadCheckpoint(path, checkpoint, error)) {
+            return "error: " + (path.empty() ? "usage: restore <file>, or set checkpoint_file" : error);
+        }
+        loop.restore(std::move(checkpoint));
+        return "ok";
+    }
+    if (line.rfind("record ", 0) == 0) {
+        if (!loop.startRecording(line.substr(7), error)) {
+            return "error: " + error;
+        }
+        return "ok";
     }
+    if (line.rfind("load ", 0) == 0) {
+        Scene scene;
+        if (!loadScene(line.substr(5), scene, error)) {
+            return "error: " + error;
+        }
+        loop.loadScene(std::move(scene));
+        return "ok";
+    }
+    if (line.rfind("generate ", 0) == 0) {
+        std::istringstream in(line.substr(9));
+        std::string preset;
+        long long walls = 0, particles = 0;
+        unsigned long seed = 1;
+        in >> preset >> walls >> particles;
+        if (!in || walls < 0 || particles < 0) {
+            return "error: usage: generate maze|grid|corridors|fan <walls> <particles> [seed]";
+        }
+        in >> seed;
+        if (!startStressScene(loop, preset, static_cast<size_t>(walls), static_cast<size_t>(particles), static_cast<uint32_t>(seed), error)) {
+            return "error: " + error;
+        }
+        return "ok";
+    }
+    if (isSpawnCommand(line)) {
+        SpawnCommand spawn;
+        if (!parseSpawnCommand(line, spawn, error)) {
+            return "error: " + error;
+        }
+        if (!loop.spawn(spawn.count, std::move(spawn.shape))) {
+            return "error: a spawn is already running";
+        }
+        return "ok";
+    }
+    WorldCommand command;
+    if (!parseWorldCommand(line, command, error)) {
+        return "error: " + error;
+    }
+    loop.submit(std::move(command));
+    return "ok";
 }
 
-void clientHandler(const std::vector<SOCKET>& clientSockets) {
-    char buffer[200];
-    int byteCount;
-
-    sf::Clock clock;
+// The attached viewer. The server ticks without it; the window only draws the
+// latest snapshot and turns mouse clicks and the settings tabs into scene
+// commands for the tick thread.
+void clientHandler(ServerLoop& loop, NetReactor& reactor, UdpTransport& udp) {
     sf::Clock deltaClock;
-    sf::Clock fpsClock;
     int frameCount = 0;
     float fps = 0;
     auto lastFpsTime = std::chrono::steady_clock::now();
 
-    std::vector<Particle> particles;
-    float canvasWidth = 1280.0f;
-    float canvasHeight = 720.0f;
+    // Kept across frames so drawing allocates nothing once running
+    sf::CircleShape particleShape(5.0f);
+    particleShape.setFillColor(sf::Color::Green);
+    sf::CircleShape spriteShape(5.0f);
+    spriteShape.setFillColor(sf::Color::Red);
+    std::vector<sf::Vertex> wallVertices;
+    AllocationLap frameAllocations;
+    uint64_t lastFrameAllocations = 0;
+
+    float canvasWidth = loop.canvasWidth();
+    float canvasHeight = loop.canvasHeight();
     float speed = 100.0f;
     float startAngle = 0.0f;
     float endAngle = 180.0f;
 
     float angle = 45.0f * M_PI / 180.0f; // Convert angle to radians
     int numParticles = 1;
-    std::vector<sf::VertexArray> walls;
+    float emitRate = 100.0f;
+    float emitLifetime = 5.0f;
 
     bool isDrawingLine = false;
     sf::Vector2f lineStart(100.0f, 360.0f); // Default line start point
     sf::Vector2f lineEnd(1180.0f, 360.0f);  // Default line end point
 
-    std::vector<sf::CircleShape> balls;
     bool developerMode = true; // Default to developer mode
 
-
-    std::vector<std::thread> receiveThreads;
-    std::vector<sf::Vector2f> receivedPositions(clientSockets.size(), sf::Vector2f(-1000, -1000)); // Initialize received positions
-    std::vector<std::string> clientIDs;
-
-
-    // Start a receive thread for each client socket
-    for (size_t i = 0; i < clientSockets.size(); ++i) {
-        // Create a new ball object for this client
-        sf::CircleShape ball(RADIUS);
-        ball.setFillColor(sf::Color::Red);
-        ball.setPosition(640, 360); // Initial position
-        balls.push_back(ball);
-
-        receiveThreads.emplace_back([&clientSockets, &receivedPositions, &balls, &clientIDs, i]() {
-            while (true) {
-                // Receive data from the client socket
-                std::string serializedData = receiveSerializedData(clientSockets[i]);
-
-                // Deserialize the data
-                std::istringstream iss(serializedData);
-                std::string id;
-                sf::Vector2f position;
-                iss >> id >> position.x >> position.y;
-
-                // Update the received position for this client
-                receivedPositions[i] = position;
-
-                // Update the position of the corresponding ball
-                balls[i].setPosition(position);
-
-                // Store the client ID
-                clientIDs.emplace_back(id);
-
-                // Print the received data if needed
-                // std::cout << "ID: " << id << ", Position: (" << position.x << ", " << position.y << ")" << std::endl;
-            }
-            });
-    }
-
-    unsigned int numThreads = std::thread::hardware_concurrency();
-    ThreadPool threadPool(numThreads);
-
-    // Mutex for synchronization
-    std::mutex mutex;
+    // Serialization and sending happen on the loop's send stage
+    float snapshotRate = loop.sends().getSnapshotRate();
+    int clientBudget = static_cast<int>(loop.sends().getClientBudget());
+    float errorTolerance = loop.sends().getErrorTolerance();
+    NetTelemetry telemetry;
+    std::string telemetryStatus;
+
+    // Scene files hold the walls and emitters; see SceneFile.h
+    char scenePath[260] = "scene.bin";
+    std::string sceneStatus;
+
+    // Generated scenes for stress tests; see StressScenes.h
+    int stressPreset = 0;
+    int stressWalls = 1000;
+    int stressParticles = 10000;
+    int stressSeed = 1;
+
+    // Recording the run, and replaying a recording in place of the live view
+    char recordPath[260] = "run.rec";
+    char replayPath[260] = "run.rec";
+    std::unique_ptr<RecordingReader> replay;
+    ReplayFrame replayFrame;
+    double replayTick = 0.0;
+    bool replayPlaying = false;
+    float replaySpeed = 1.0f;
+    std::string replayStatus;
 
     while (window.isOpen()) {
+        if (shutdownRequested) {
+            window.close();
+            break;
+        }
+
         sf::Event event;
         while (window.pollEvent(event)) {
             ImGui::SFML::ProcessEvent(event);
@@ -578,21 +375,16 @@ void clientHandler(const std::vector<SOCKET>& clientSockets) {
                     else {
                         isDrawingLine = false;
                         lineEnd = window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y));
-                        walls.emplace_back(sf::LinesStrip, 2);
-                        walls.back()[0].position = lineStart;
-                        walls.back()[1].position = lineEnd;
+                        loop.submit([start = lineStart, end = lineEnd](World& world) { addWall(world, start, end); });
                     }
                 }
             }
         }
-        float deltaTime = clock.restart().asSeconds();
-        ImGui::SFML::Update(window, deltaClock.restart());
-
+        sf::Time frameTime = deltaClock.restart();
+        ImGui::SFML::Update(window, frameTime);
 
         window.clear(sf::Color::Black);
 
-        updateBallPositions(receivedPositions, balls);
-
         window.setView(window.getDefaultView());
 
         // Developer mode UI
@@ -608,15 +400,51 @@ void clientHandler(const std::vector<SOCKET>& clientSockets) {
             lastFpsTime = currentTime;
         }
         ImGui::Text("FPS: %.1f", fps);
+        ImGui::Text("Tick: %llu at %.0f Hz, %.2f ms", static_cast<unsigned long long>(loop.tickCount()), loop.getTickRate(), loop.lastTickMilliseconds());
+        if (countingAllocations) {
+            ImGui::Text("Allocations: %llu last frame, %llu last tick", static_cast<unsigned long long>(lastFrameAllocations),
+                static_cast<unsigned long long>(loop.lastTickAllocations()));
+        }
 
         ImGui::Separator();
 
+        if (ImGui::SliderFloat("Snapshot Rate (Hz)", &snapshotRate, 1.0f, 60.0f)) {
+            loop.sends().setSnapshotRate(snapshotRate);
+        }
+        // Bytes per snapshot for each explorer; 0 sends every particle
+        if (ImGui::SliderInt("Client Budget (bytes)", &clientBudget, 0, 16384)) {
+            loop.sends().setClientBudget(static_cast<size_t>(clientBudget));
+        }
+        // How far an explorer's extrapolated particle may drift before it is
+        // resent; 0 sends every particle
+        if (ImGui::SliderFloat("Error Tolerance (px)", &errorTolerance, 0.0f, 20.0f)) {
+            loop.sends().setErrorTolerance(errorTolerance);
+        }
+        ImGui::Text("Dropped snapshots: %llu", static_cast<unsigned long long>(reactor.droppedFrameCount()));
+        ImGui::Text("Dropped inputs: %llu", static_cast<unsigned long long>(droppedInputs.load()));
+
+        ImGui::End();
+
+        // Per-connection bandwidth, queue and CPU figures
+        telemetry.sample(reactor, &udp, loop.sends());
+        ImGui::Begin("Network");
+        telemetry.draw();
+        if (ImGui::Button("Dump CSV")) {
+            std::string path = "net-stats-" + std::to_string(std::time(nullptr)) + ".csv";
+            telemetryStatus = telemetry.writeCsv(path) ? "Wrote " + path : "Could not write " + path;
+        }
+        if (!telemetryStatus.empty()) {
+            ImGui::SameLine();
+            ImGui::TextUnformatted(telemetryStatus.c_str());
+        }
         ImGui::End();
 
         ImGui::Begin("Particle Settings", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
         ImGui::Separator();
 
+        // Large spawns are built in the background; one at a time
+        bool spawning = loop.spawning();
         if (ImGui::BeginTabBar("Settings Tabs")) {
             if (ImGui::BeginTabItem("Line Setting")) {
                 ImGui::SliderFloat("Line Start X", &lineStart.x, 0.0f, canvasWidth);
@@ -625,17 +453,16 @@ void clientHandler(const std::vector<SOCKET>& clientSockets) {
                 ImGui::SliderFloat("Line End Y", &lineEnd.y, 0.0f, canvasHeight);
                 ImGui::SliderFloat("Velocity", &speed, 50.0f, 500.0f);
                 ImGui::SliderFloat("Angle (degrees)", &angle, 0.0f, 360.0f);
-                ImGui::SliderInt("Number of Particles", &numParticles, 1, 10000);
+                ImGui::SliderInt("Number of Particles", &numParticles, 1, static_cast<int>(maxSpawnCount), "%d", ImGuiSliderFlags_Logarithmic);
+                ImGui::BeginDisabled(spawning);
                 if (ImGui::Button("Generate Particles")) {
-                    particles.clear();
-                    for (int i = 0; i < numParticles; ++i) {
-                        float t = 0.0f;
-                        if (numParticles > 1) {
-                            t = static_cast<float>(i) / (numParticles - 1);
-                        }
-                        sf::Vector2f position = lineStart + t * (lineEnd - lineStart);
-                        particles.emplace_back(position.x, position.y, speed, angle);
-                    }
+                    loop.spawn(numParticles, lineShape(numParticles, lineStart, lineEnd, speed, angle));
+                }
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                if (ImGui::Button("Add Emitter")) {
+                    Emitter emitter = makeEmitter(lineSpec(numParticles, lineStart, lineEnd, speed, angle), emitRate, emitLifetime);
+                    loop.submit([emitter](World& world) { world.emitters.push_back(emitter); });
                 }
                 ImGui::EndTabItem();
             }
@@ -646,18 +473,16 @@ void clientHandler(const std::vector<SOCKET>& clientSockets) {
                 ImGui::SliderAngle("Start Angle", &startAngle);
                 ImGui::SliderAngle("End Angle", &endAngle);
                 ImGui::SliderFloat("Velocity", &speed, 50.0f, 500.0f);
-                ImGui::SliderInt("Number of Particles", &numParticles, 1, 10000);
+                ImGui::SliderInt("Number of Particles", &numParticles, 1, static_cast<int>(maxSpawnCount), "%d", ImGuiSliderFlags_Logarithmic);
+                ImGui::BeginDisabled(spawning);
                 if (ImGui::Button("Generate Particles")) {
-                    particles.clear();
-                    float angleIncrement = 0.0f;
-                    if (numParticles > 1) {
-                        angleIncrement = (endAngle - startAngle) / (numParticles - 1);
-                    }
-                    for (int i = 0; i < numParticles; ++i) {
-                        float currentAngle = startAngle + i * angleIncrement;
-                        sf::Vector2f position = lineStart;
-                        particles.emplace_back(position.x, position.y, speed, currentAngle);
-                    }
+                    loop.spawn(numParticles, fanShape(numParticles, lineStart, startAngle, endAngle, speed));
+                }
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                if (ImGui::Button("Add Emitter")) {
+                    Emitter emitter = makeEmitter(fanSpec(numParticles, lineStart, startAngle, endAngle, speed), emitRate, emitLifetime);
+                    loop.submit([emitter](World& world) { world.emitters.push_back(emitter); });
                 }
                 ImGui::EndTabItem();
             }
@@ -666,72 +491,176 @@ void clientHandler(const std::vector<SOCKET>& clientSockets) {
                 ImGui::SliderFloat("Spawn Point X", &lineStart.x, 0.0f, canvasWidth);
                 ImGui::SliderFloat("Spawn Point Y", &lineStart.y, 0.0f, canvasHeight);
                 ImGui::SliderFloat("Angle (degrees)", &angle, 0.0f, 360.0f);
-                ImGui::SliderInt("Number of Particles", &numParticles, 1, 10000);
+                ImGui::SliderInt("Number of Particles", &numParticles, 1, static_cast<int>(maxSpawnCount), "%d", ImGuiSliderFlags_Logarithmic);
+                ImGui::BeginDisabled(spawning);
                 if (ImGui::Button("Generate Particles")) {
-                    particles.clear();
-                    float speedIncrement = 450.0f / numParticles;
-                    for (int i = 0; i < numParticles; ++i) {
-                        float currentSpeed = 50.0f + i * speedIncrement;
-                        sf::Vector2f position = lineStart;
-                        particles.emplace_back(position.x, position.y, currentSpeed, angle);
-
-                        // send the particles to the client
-                    }
+                    loop.spawn(numParticles, speedRampShape(numParticles, lineStart, angle));
+                }
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                if (ImGui::Button("Add Emitter")) {
+                    Emitter emitter = makeEmitter(speedRampSpec(numParticles, lineStart, angle), emitRate, emitLifetime);
+                    loop.submit([emitter](World& world) { world.emitters.push_back(emitter); });
                 }
                 ImGui::EndTabItem();
             }
 
             ImGui::EndTabBar();
         }
+        if (spawning) {
+            ImGui::ProgressBar(loop.spawnProgress(), ImVec2(-FLT_MIN, 0), "Spawning...");
+        }
+        // Emitters stream the tab's shape instead of replacing the particles
+        ImGui::SliderFloat("Emit Rate (per s)", &emitRate, 1.0f, 100000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Lifetime (s)", &emitLifetime, 0.1f, 60.0f);
+        ImGui::Text("Emitters: %zu", loop.emitterCount());
+        ImGui::SameLine();
+        if (ImGui::Button("Clear Emitters")) {
+            loop.submit([](World& world) { world.emitters.clear(); });
+        }
         if (ImGui::Button("Clear Particles")) {
-            particles.clear();
+            loop.submit([](World& world) { world.particles.clear(); });
         }
         if (ImGui::Button("Clear Walls")) {
-            walls.clear();
+            loop.submit([](World& world) { clearWalls(world); });
         }
         if (ImGui::Button("Clear last wall")) {
-            if (walls.size() > 0) {
-                walls.pop_back();
+            loop.submit([](World& world) { removeLastWall(world); });
+        }
+
+        ImGui::Separator();
+        ImGui::InputText("Scene File", scenePath, sizeof(scenePath));
+        if (ImGui::Button("Load Scene")) {
+            Scene scene;
+            std::string error;
+            if (loadScene(scenePath, scene, error)) {
+                sceneStatus = "Loaded " + std::to_string(scene.walls.size()) + " walls";
+                loop.loadScene(std::move(scene));
+            }
+            else {
+                sceneStatus = error;
             }
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Save Scene")) {
+            loop.saveScene(scenePath);
+            sceneStatus = std::string("Saving ") + scenePath;
+        }
+        ImGui::Combo("Stress Scene", &stressPreset, stressPresetNames, static_cast<int>(stressPresetCount));
+        ImGui::InputInt("Stress Walls", &stressWalls);
+        ImGui::InputInt("Stress Particles", &stressParticles);
+        ImGui::InputInt("Seed", &stressSeed);
+        if (ImGui::Button("Generate")) {
+            std::string error;
+            if (stressWalls < 0 || stressParticles < 0) {
+                sceneStatus = "Counts must not be negative";
+            }
+            else if (startStressScene(loop, stressPresetNames[stressPreset], stressWalls, stressParticles, static_cast<uint32_t>(stressSeed), error)) {
+                sceneStatus = std::string("Generated ") + stressPresetNames[stressPreset] + " " + std::to_string(stressWalls) + " "
+                    + std::to_string(stressParticles) + " " + std::to_string(stressSeed);
+            }
+            else {
+                sceneStatus = error;
+            }
+        }
+        if (!sceneStatus.empty()) {
+            ImGui::TextUnformatted(sceneStatus.c_str());
+        }
 
         ImGui::End();
 
-        threadPool.enqueue([&particles, deltaTime, canvasWidth, canvasHeight, &walls]() {
-            for (auto& particle : particles) {
-                particle.update(deltaTime, canvasWidth, canvasHeight, walls);
+        ImGui::Begin("Replay", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+        if (loop.recording()) {
+            ImGui::Text("Recording to %s", recordPath);
+            if (ImGui::Button("Stop Recording")) {
+                loop.stopRecording();
+            }
+        }
+        else {
+            ImGui::InputText("Record To", recordPath, sizeof(recordPath));
+            if (ImGui::Button("Record")) {
+                std::string error;
+                replayStatus = loop.startRecording(recordPath, error) ? "" : error;
+            }
+        }
+        ImGui::Separator();
+        ImGui::InputText("Recording", replayPath, sizeof(replayPath));
+        if (ImGui::Button("Open")) {
+            auto reader = std::make_unique<RecordingReader>();
+            std::string error;
+            if (reader->open(replayPath, error)) {
+                replay = std::move(reader);
+                replayTick = static_cast<double>(replay->firstTick());
+                replayPlaying = false;
+                replayStatus.clear();
+            }
+            else {
+                replayStatus = error;
+            }
+        }
+        if (replay) {
+            ImGui::SameLine();
+            if (ImGui::Button("Back to Live")) {
+                replay.reset();
+            }
+        }
+        if (replay) {
+            uint64_t firstTick = replay->firstTick();
+            uint64_t lastTick = replay->lastTick();
+            if (ImGui::Button(replayPlaying ? "Pause" : "Play")) {
+                replayPlaying = !replayPlaying;
             }
-            });
-
-        // Render walls and particles
-        renderWalls(window, walls, mutex, 1.0f);
-        renderParticles(particles, window, mutex, 1.0f);
-        renderSprite(receivedPositions, mutex, window, 1.0f);
-
-        // Draw ball
-        int i = 0;
-        size_t j = 1;
-        for (auto& clientSocket : clientSockets) {
-            if (i == 1) {
-                j = 0;
+            ImGui::SameLine();
+            ImGui::SliderFloat("Speed", &replaySpeed, 0.1f, 8.0f, "%.1fx", ImGuiSliderFlags_Logarithmic);
+            if (replayPlaying) {
+                replayTick += frameTime.asSeconds() * replaySpeed * replay->getTickRate();
+                if (replayTick >= static_cast<double>(lastTick)) {
+                    replayTick = static_cast<double>(lastTick);
+                    replayPlaying = false;
+                }
             }
-            std::cout << "Neighbor: " << receivedPositions[j].x << " " << receivedPositions[j].y << std::endl;
-            sendParticles(clientSocket, particles, receivedPositions[j]);
-            i++;
+            uint64_t tick = static_cast<uint64_t>(replayTick);
+            if (ImGui::SliderScalar("Tick", ImGuiDataType_U64, &tick, &firstTick, &lastTick)) {
+                replayTick = static_cast<double>(tick);
+            }
+            // Chunks are read from disk as the tick reaches them
+            std::string error;
+            if (!replay->readFrame(tick, replayFrame, error)) {
+                replayStatus = error;
+                replay.reset();
+            }
+        }
+        if (!replayStatus.empty()) {
+            ImGui::TextUnformatted(replayStatus.c_str());
         }
+        ImGui::End();
 
-        //window.draw(balls);
+        // Render walls, particles and players as of the latest tick, or as
+        // of the replayed one
+        std::shared_ptr<const ServerSnapshot> snapshot = loop.latest();
+        if (replay) {
+            if (replayFrame.walls) {
+                renderWalls(window, *replayFrame.walls, 1.0f, wallVertices);
+            }
+            renderParticles(replayFrame.particles, window, particleShape);
+            renderSprite(replayFrame.players, window, spriteShape);
+        }
+        else if (snapshot) {
+            if (snapshot->walls) {
+                renderWalls(window, *snapshot->walls, 1.0f, wallVertices);
+            }
+            renderParticles(snapshot->particles, window, particleShape);
+            renderSprite(snapshot->players, window, spriteShape);
+        }
 
         ImGui::SFML::Render(window);
 
         window.display();
 
         frameCount++;
+        lastFrameAllocations = frameAllocations.lap();
     }
     ImGui::SFML::Shutdown();
-    for (auto& thread : receiveThreads) {
-        thread.join();
-    }
 }
 
 void initializeWindow() {
@@ -742,97 +671,204 @@ void initializeWindow() {
     ImGui::SFML::Init(window);
 }
 
-void createWindow(const std::vector<SOCKET>& clientSockets) {
+void createWindow(ServerLoop& loop, NetReactor& reactor, UdpTransport& udp) {
     // Create Dev Window
     if (!devWindowCreated) {
         initializeWindow();
         devWindowCreated = true;
     }
 
-    // Pass the list of client sockets to clientHandler
-    clientHandler(clientSockets);
+    // The reactor and the UDP transport own every client socket and the loop
+    // owns the simulation; the window only views and edits it
+    clientHandler(loop, reactor, udp);
 }
 
-
-
-// Function to handle client connections
-void acceptClients(SOCKET serverSocket) {
-    while (true) {
-        SOCKET clientSocket = accept(serverSocket, NULL, NULL);
-        if (clientSocket == INVALID_SOCKET) {
-            std::cout << "accept failed: " << WSAGetLastError() << std::endl;
+// Runs the scene for seconds to warm up and as long again to measure, and
+// fails if any tick that ran no command, compaction or recording allocated
+// while measured
+int checkAllocations(const ServerLoop& loop, float seconds) {
+    if (!countingAllocations) {
+        std::cout << "Allocations are not counted in this build; define COUNT_ALLOCATIONS" << std::endl;
+        return 2;
+    }
+    auto wait = [](float duration) {
+        auto end = std::chrono::steady_clock::now() + std::chrono::duration<float>(duration);
+        while (!shutdownRequested && std::chrono::steady_clock::now() < end) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
-        else {
-            std::cout << "Client connected" << std::endl;
+    };
+    std::cout << "Warming up for " << seconds << " s" << std::endl;
+    wait(seconds);
+    uint64_t startTick = loop.tickCount();
+    uint64_t startAllocations = loop.steadyTickAllocations();
+    wait(seconds);
+    uint64_t ticks = loop.tickCount() - startTick;
+    uint64_t allocations = loop.steadyTickAllocations() - startAllocations;
+    std::cout << allocations << " allocations in " << ticks << " ticks with " << loop.particleCount() << " particles" << std::endl;
+    return allocations == 0 ? 0 : 1;
+}
 
-            // Lock the mutex before modifying shared resources
-            std::lock_guard<std::mutex> lock(clientSocketsMutex);
-            clientSockets.push_back(clientSocket);
+int main(int argc, char* argv[]) {
+    // --convert-scene <in> <out> rewrites a scene file in the format <out>
+    // asks for and exits without starting the server
+    if (argc == 4 && std::string(argv[1]) == "--convert-scene") {
+        Scene scene;
+        std::string error;
+        if (!loadScene(argv[2], scene, error) || !saveScene(argv[3], scene, error)) {
+            std::cout << error << std::endl;
+            return 1;
         }
+        std::cout << "Wrote " << scene.walls.size() << " walls and " << scene.emitters.size() << " emitters to " << argv[3] << std::endl;
+        return 0;
     }
-}
 
-int main() {
-    // Initialize WSA variables
-    WSADATA wsaData;
-    int wsaerr;
-    WORD wVersionRequested = MAKEWORD(2, 2);
-    wsaerr = WSAStartup(wVersionRequested, &wsaData);
-    if (wsaerr != 0) {
-        std::cout << "The Winsock dll not found!" << std::endl;
+    // Started for the whole run, cleaned up when main returns
+    SocketLibrary sockets;
+    if (!sockets.ok()) {
+        std::cout << "The socket library could not be started!" << std::endl;
         return 0;
     }
     else {
-        std::cout << "Server is on" << std::endl << "The Winsock dll found" << std::endl;
-        std::cout << "The status: " << wsaData.szSystemStatus << std::endl;
+        std::cout << "Server is on" << std::endl;
+        std::cout << "The status: " << sockets.description() << std::endl;
+    }
+
+    // Command line: [--config <file>] [--headless] [--check-allocations <seconds>]
+    //               [--udp-loss <percent>] [--udp-latency <ms>] [--udp-jitter <ms>]
+    // The config file is read first and the other options override it. The
+    // UDP options simulate a bad network on the UDP port for testing.
+    ServerConfig config;
+    float checkSeconds = 0.0f;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::string(argv[i]) == "--config") {
+            std::string error;
+            if (!loadServerConfig(argv[i + 1], config, error)) {
+                std::cout << "Config error: " << error << std::endl;
+                return 1;
+            }
+            if (!validCanvasSize(config.canvasWidth, config.canvasHeight)) {
+                std::cout << "Config error: the canvas must be above 0 and at most " << largestCanvasSide
+                    << " pixels a side" << std::endl;
+                return 1;
+            }
+        }
     }
-
-    // Create socket
-    SOCKET serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (serverSocket == INVALID_SOCKET) {
-        std::cout << "Error at socket(): " << WSAGetLastError() << std::endl;
-        WSACleanup();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            config.headless = true;
+        }
+        else if (arg == "--config" && i + 1 < argc) {
+            ++i;
+        }
+        else if (arg == "--check-allocations" && i + 1 < argc) {
+            checkSeconds = std::stof(argv[++i]);
+            config.headless = true;
+        }
+        else if (arg == "--udp-loss" && i + 1 < argc) {
+            config.udpLoss = std::stof(argv[++i]);
+        }
+        else if (arg == "--udp-latency" && i + 1 < argc) {
+            config.udpLatency = std::stoi(argv[++i]);
+        }
+        else if (arg == "--udp-jitter" && i + 1 < argc) {
+            config.udpJitter = std::stoi(argv[++i]);
+        }
+    }
+    std::signal(SIGINT, requestShutdown);
+
+    // Create the listening socket and start the I/O thread
+    NetReactor reactor;
+    InputQueues tcpInputs;
+    reactor.onConnect = [&reactor, &tcpInputs](NetReactor::ConnectionId id) {
+        reactor.send(id, encodeWelcome(onClientConnected({ ClientTransport::Tcp, id }, tcpInputs)));
+    };
+    reactor.onDisconnect = [&tcpInputs](NetReactor::ConnectionId id) { onClientDisconnected({ ClientTransport::Tcp, id }, tcpInputs); };
+    reactor.onMessage = [&tcpInputs](NetReactor::ConnectionId id, const char* data, size_t size) {
+        onClientMessage({ ClientTransport::Tcp, id }, tcpInputs, data, size);
+    };
+    if (!reactor.listen(config.tcpPort)) {
         return 0;
     }
-    else {
-        std::cout << "Socket online" << std::endl;
-    }
-
-    // Bind the socket
-    sockaddr_in service;
-    service.sin_family = AF_INET;
-    service.sin_addr.s_addr = INADDR_ANY; // Bind to all available interfaces
-    service.sin_port = htons(55555);
-    if (bind(serverSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR) {
-        std::cout << "bind() failed: " << WSAGetLastError() << std::endl;
-        closesocket(serverSocket);
-        WSACleanup();
+    std::cout << "listen() is online on port " << config.tcpPort << ", waiting for new connections..." << std::endl;
+
+    // UDP clients connect on their own port
+    UdpSocketIo udpSocket;
+    if (!udpSocket.open(config.udpPort)) {
         return 0;
     }
-    else {
-        std::cout << "bind() on" << std::endl;
+    std::unique_ptr<LossyPacketIo> lossySocket;
+    if (config.udpLoss > 0.0f || config.udpLatency > 0 || config.udpJitter > 0) {
+        lossySocket = std::make_unique<LossyPacketIo>(udpSocket, config.udpLoss, config.udpLatency, config.udpJitter, static_cast<uint32_t>(std::time(nullptr)));
+        std::cout << "Simulating " << config.udpLoss << "% loss, " << config.udpLatency << " ms latency, " << config.udpJitter << " ms jitter on UDP" << std::endl;
+    }
+    InputQueues udpInputs;
+    UdpTransport udp(lossySocket ? static_cast<PacketIo&>(*lossySocket) : udpSocket);
+    udp.onConnect = [&udp, &udpInputs](UdpTransport::ConnectionId id) {
+        udp.sendReliable(id, encodeWelcome(onClientConnected({ ClientTransport::Udp, id }, udpInputs)));
+    };
+    udp.onDisconnect = [&udpInputs](UdpTransport::ConnectionId id) { onClientDisconnected({ ClientTransport::Udp, id }, udpInputs); };
+    udp.onReliable = [&udpInputs](UdpTransport::ConnectionId id, const char* data, size_t size) {
+        onClientMessage({ ClientTransport::Udp, id }, udpInputs, data, size);
+    };
+
+    reactor.start();
+    udp.start();
+
+    // The simulation ticks from here on, with or without a window
+    ServerLoop loop(players, reactor, &udp, config);
+    // A warm restart carries on from the last checkpoint instead of building
+    // the scene again
+    bool restored = false;
+    if (!config.checkpointFile.empty() && std::filesystem::exists(config.checkpointFile)) {
+        Checkpoint checkpoint;
+        std::string error;
+        if (loadCheckpoint(config.checkpointFile, checkpoint, error)) {
+            std::cout << "Restored tick " << checkpoint.tick << " with " << checkpoint.particles.size() << " particles from " << config.checkpointFile << std::endl;
+            loop.restore(std::move(checkpoint));
+            restored = true;
+        }
+        else {
+            std::cout << "Checkpoint not restored: " << error << std::endl;
+        }
     }
-
-    // Listen to incoming connections
-    if (listen(serverSocket, SOMAXCONN) == SOCKET_ERROR) {
-        std::cout << "listen(): Error listening on socket: " << WSAGetLastError() << std::endl;
+    if (!restored) {
+        for (const std::string& line : config.commands) {
+            std::cout << line << ": " << handleAdminCommand(loop, line) << std::endl;
+        }
     }
-    else {
-        std::cout << "listen() is online, waiting for new connections..." << std::endl;
+    if (!config.recordFile.empty()) {
+        std::string error;
+        if (!loop.startRecording(config.recordFile, error)) {
+            std::cout << "Not recording: " << error << std::endl;
+        }
     }
+    loop.start();
 
-    // Start a thread to accept incoming client connections
-    std::thread(acceptClients, serverSocket).detach();
-
-    // Create the window after server initialization
-    createWindow(clientSockets);
+    AdminServer admin([&loop](const std::string& line) { return handleAdminCommand(loop, line); });
+    if (config.adminPort != 0 && admin.start(config.adminPort)) {
+        std::cout << "Admin socket on 127.0.0.1:" << config.adminPort << std::endl;
+    }
 
-    // Wait for user input to exit
-    std::cout << "Press Enter to exit..." << std::endl;
-    std::cin.get();
+    int exitCode = 0;
+    if (checkSeconds > 0.0f) {
+        exitCode = checkAllocations(loop, checkSeconds);
+    }
+    else if (config.headless) {
+        std::cout << "Running headless at " << loop.getTickRate() << " Hz" << std::endl;
+        while (!shutdownRequested) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    else {
+        // Create the window after server initialization
+        createWindow(loop, reactor, udp);
+    }
 
     // Cleanup and exit
-    closesocket(serverSocket);
-    WSACleanup();
-    return 0;
-}
\ No newline at end of file
+    admin.stop();
+    loop.stop();
+    udp.stop();
+    reactor.stop();
+    return exitCode;
+}
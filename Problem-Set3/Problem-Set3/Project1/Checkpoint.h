@@ -0,0 +1,202 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "MappedFile.h"
+#include "Particle.h"
+#include "SceneFile.h"
+#include "World.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Everything needed to carry on a run after a restart: the tick counter, the
+// scene and every particle with its collision state and remaining lifetime.
+// Emitters keep their place in their shape. Players are not saved; they join
+// again when they reconnect.
+struct Checkpoint {
+    uint64_t tick = 0;
+    Scene scene;
+    std::vector<Particle> particles;    // may include dead ones, which are not saved
+};
+
+// Checkpoint file layout, little-endian like a binary scene: a
+// CheckpointHeader, then wallCount SceneWallRecords, emitterCount
+// CheckpointEmitterRecords and particleCount CheckpointParticleRecords.
+// A new version is needed whenever a record changes.
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t tick;
+    float canvasWidth;
+    float canvasHeight;
+    uint32_t wallCount;
+    uint32_t emitterCount;
+    uint64_t particleCount;
+};
+
+struct CheckpointEmitterRecord {
+    SceneEmitterRecord emitter;
+    uint32_t next;
+    float owed;
+};
+
+struct CheckpointParticleRecord {
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    uint32_t collided;
+    float lifetime;
+};
+
+static_assert(sizeof(CheckpointHeader) == 40 && sizeof(CheckpointEmitterRecord) == 52 && sizeof(CheckpointParticleRecord) == 24,
+    "checkpoint records must have no padding");
+
+constexpr char checkpointFileMagic[4] = { 'P', 'S', 'C', 'K' };
+constexpr uint32_t checkpointFileVersion = 1;
+
+// Writes to a temporary file next to path and renames it over path once
+// complete, so a crash while writing leaves the previous checkpoint intact.
+// Returns false with a message if the file cannot be written.
+inline bool saveCheckpoint(const std::string& path, const Checkpoint& checkpoint, std::string& error) {
+    std::vector<SceneWallRecord> walls;
+    walls.reserve(checkpoint.scene.walls.size());
+    appendWallRecords(checkpoint.scene.walls, walls);
+    std::vector<CheckpointEmitterRecord> emitters;
+    emitters.reserve(checkpoint.scene.emitters.size());
+    for (const Emitter& emitter : checkpoint.scene.emitters) {
+        emitters.push_back({ makeEmitterRecord(emitter), static_cast<uint32_t>(emitter.next), static_cast<float>(emitter.owed) });
+    }
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, checkpointFileMagic, sizeof(checkpointFileMagic));
+    header.version = checkpointFileVersion;
+    header.tick = checkpoint.tick;
+    header.canvasWidth = checkpoint.scene.canvasWidth;
+    header.canvasHeight = checkpoint.scene.canvasHeight;
+    header.wallCount = static_cast<uint32_t>(walls.size());
+    header.emitterCount = static_cast<uint32_t>(emitters.size());
+    header.particleCount = static_cast<uint64_t>(std::count_if(checkpoint.particles.begin(), checkpoint.particles.end(),
+        [](const Particle& particle) { return particle.isAlive(); }));
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            error = "cannot write checkpoint " + temporaryPath;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(walls.data()), walls.size() * sizeof(SceneWallRecord));
+        out.write(reinterpret_cast<const char*>(emitters.data()), emitters.size() * sizeof(CheckpointEmitterRecord));
+
+        // Particles go out in blocks so a large run needs no second copy
+        std::vector<CheckpointParticleRecord> block;
+        block.reserve(65536);
+        for (const Particle& particle : checkpoint.particles) {
+            if (!particle.isAlive()) {
+                continue;
+            }
+            block.push_back({ particle.getPosition(), particle.getVelocity(), particle.getCollided() ? 1u : 0u, particle.getLifetime() });
+            if (block.size() == block.capacity()) {
+                out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(CheckpointParticleRecord));
+                block.clear();
+            }
+        }
+        out.write(reinterpret_cast<const char*>(block.data()), block.size() * sizeof(CheckpointParticleRecord));
+        out.close();
+        if (!out) {
+            error = "cannot write checkpoint " + temporaryPath;
+            return false;
+        }
+    }
+
+    std::error_code renameError;
+    std::filesystem::rename(temporaryPath, path, renameError);
+    if (renameError) {
+        error = "cannot replace checkpoint " + path + ": " + renameError.message();
+        return false;
+    }
+    return true;
+}
+
+// Maps the file and copies its records out. Returns false with a message if
+// the file cannot be read or is not a valid checkpoint.
+inline bool loadCheckpoint(const std::string& path, Checkpoint& checkpoint, std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot open checkpoint " + path;
+        return false;
+    }
+    const char* data = file.data();
+    size_t size = file.size();
+    if (size < sizeof(CheckpointHeader) || std::memcmp(data, checkpointFileMagic, sizeof(checkpointFileMagic)) != 0) {
+        error = path + " is not a checkpoint";
+        return false;
+    }
+    CheckpointHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != checkpointFileVersion) {
+        error = "checkpoint version " + std::to_string(header.version) + " is not supported";
+        return false;
+    }
+    uint64_t expected = sizeof(CheckpointHeader) + static_cast<uint64_t>(header.wallCount) * sizeof(SceneWallRecord)
+        + static_cast<uint64_t>(header.emitterCount) * sizeof(CheckpointEmitterRecord);
+    if (expected > size || header.particleCount != (size - expected) / sizeof(CheckpointParticleRecord)
+        || (size - expected) % sizeof(CheckpointParticleRecord) != 0) {
+        error = "checkpoint is " + std::to_string(size) + " bytes, which does not match its header";
+        return false;
+    }
+    if (!validCanvasSize(header.canvasWidth, header.canvasHeight)) {
+        error = "checkpoint has no valid canvas size";
+        return false;
+    }
+    checkpoint.tick = header.tick;
+    checkpoint.scene.canvasWidth = header.canvasWidth;
+    checkpoint.scene.canvasHeight = header.canvasHeight;
+
+    const SceneWallRecord* walls = reinterpret_cast<const SceneWallRecord*>(data + sizeof(CheckpointHeader));
+    if (!readWallRecords(walls, header.wallCount, checkpoint.scene.walls, error)) {
+        return false;
+    }
+
+    const CheckpointEmitterRecord* emitters = reinterpret_cast<const CheckpointEmitterRecord*>(walls + header.wallCount);
+    checkpoint.scene.emitters.resize(header.emitterCount);
+    for (uint32_t i = 0; i < header.emitterCount; ++i) {
+        Emitter& emitter = checkpoint.scene.emitters[i];
+        if (!readEmitterRecord(emitters[i].emitter, i, emitter, error)) {
+            return false;
+        }
+        emitter.next = emitters[i].next % emitter.count;
+        if (!(emitters[i].owed >= 0.0f && emitters[i].owed <= std::max(1.0f, emitter.rate))) {
+            error = "emitter " + std::to_string(i) + " owes more particles than a second's worth";
+            return false;
+        }
+        emitter.owed = emitters[i].owed;
+    }
+
+    const CheckpointParticleRecord* particles = reinterpret_cast<const CheckpointParticleRecord*>(emitters + header.emitterCount);
+    try {
+        checkpoint.particles.resize(header.particleCount);
+    }
+    catch (const std::bad_alloc&) {
+        error = "not enough memory for " + std::to_string(header.particleCount) + " particles";
+        return false;
+    }
+    for (size_t i = 0; i < checkpoint.particles.size(); ++i) {
+        const CheckpointParticleRecord& record = particles[i];
+        if (!validPoint(record.position) || !validPoint(record.velocity)) {
+            error = "particle " + std::to_string(i) + " has a non-finite position or velocity";
+            return false;
+        }
+        checkpoint.particles[i].restore(record.position, record.velocity, record.collided != 0, record.lifetime);
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Number formats for the compact particle storage (see Particle.h). Both
+// conversions round to nearest, saturate instead of overflowing and never
+// produce infinities, NaNs or subnormals, so decoding needs no special cases.
+
+// 16.16 signed fixed point: a resolution of 1/65536 pixel up to +-32767
+// pixels
+constexpr float fixedScale = 65536.0f;
+constexpr float maxFixed = 32767.0f;
+
+inline double clampFixed(float value) {
+    if (!(value > -maxFixed)) {
+        return -maxFixed;       // NaN lands here too
+    }
+    return value < maxFixed ? value : maxFixed;
+}
+
+// In double, which holds every 16.16 value exactly
+inline int32_t toFixed(float value) {
+    double scaled = clampFixed(value) * fixedScale;
+    return static_cast<int32_t>(scaled + (scaled < 0 ? -0.5 : 0.5));
+}
+
+// Rounded to an even number of 1/65536ths, leaving the lowest bit free
+inline int32_t toEvenFixed(float value) {
+    double scaled = clampFixed(value) * (fixedScale / 2);
+    return static_cast<int32_t>(scaled + (scaled < 0 ? -0.5 : 0.5)) * 2;
+}
+
+// The tick's versions, for positions on the canvas. Anything off it is moved
+// to the nearest edge, which skips the sign test.
+inline int32_t toCanvasFixed(float value) {
+    return static_cast<int32_t>(std::clamp(value, 0.0f, maxFixed) * static_cast<double>(fixedScale) + 0.5);
+}
+
+inline int32_t toCanvasEvenFixed(float value) {
+    return static_cast<int32_t>(std::clamp(value, 0.0f, maxFixed) * static_cast<double>(fixedScale / 2) + 0.5) * 2;
+}
+
+inline float fromFixed(int32_t value) {
+    return static_cast<float>(value) * (1.0f / fixedScale);
+}
+
+// IEEE half precision: 11 significant bits, so a relative error of at most
+// 2^-11, for magnitudes from 2^-14, below which it stores 0, up to 65504
+inline uint16_t toHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000u);
+    uint32_t magnitude = bits & 0x7fffffffu;
+    if (magnitude < 0x38800000u) {
+        return sign;
+    }
+    if (magnitude >= 0x477ff000u) {
+        return sign | 0x7bffu;
+    }
+    // Move the exponent bias from 127 to 15, then round away the low 13
+    // mantissa bits, ties to even
+    magnitude -= 112u << 23;
+    magnitude += 0x0fffu + ((magnitude >> 13) & 1u);
+    return sign | static_cast<uint16_t>(magnitude >> 13);
+}
+
+inline float fromHalf(uint16_t value) {
+    uint32_t sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+    uint32_t magnitude = value & 0x7fffu;
+    uint32_t bits = sign | (magnitude != 0 ? (magnitude + (112u << 10)) << 13 : 0u);
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
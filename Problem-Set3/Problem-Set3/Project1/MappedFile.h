@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only into memory, for binary formats that are
+// read in place instead of parsed. The same code builds against the Win32
+// file mapping calls and POSIX mmap. An empty file opens with size() 0 and
+// no data.
+class MappedFile {
+public:
+    MappedFile() : bytes(nullptr), length(0) {}
+
+    ~MappedFile() {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false, with the file closed, if it cannot be opened or mapped
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        bool ok = GetFileSizeEx(file, &fileSize) != 0;
+        if (ok && fileSize.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            ok = mapping != nullptr;
+            if (ok) {
+                bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                ok = bytes != nullptr;
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (!ok) {
+            bytes = nullptr;
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return false;
+        }
+        struct stat status;
+        bool ok = fstat(file, &status) == 0;
+        if (ok && status.st_size > 0) {
+            void* mapped = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+            ok = mapped != MAP_FAILED;
+            if (ok) {
+                bytes = static_cast<const char*>(mapped);
+            }
+        }
+        ::close(file);
+        if (!ok) {
+            return false;
+        }
+        length = static_cast<size_t>(status.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+        if (bytes) {
+#ifdef _WIN32
+            UnmapViewOfFile(bytes);
+#else
+            munmap(const_cast<char*>(bytes), length);
+#endif
+        }
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const char* bytes;
+    size_t length;
+};
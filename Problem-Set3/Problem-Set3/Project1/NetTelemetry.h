@@ -0,0 +1,174 @@
+#pragma once
+
+#include "imgui.h"
+
+#include "../Common/NetReactor.h"
+#include "../Common/NetStats.h"
+#include "../Common/UdpTransport.h"
+#include "PlayerRegistry.h"
+#include "SendStage.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Per-connection network telemetry for the server UI. Once a second the
+// totals from both transports are differenced against the previous sample to
+// give rates, so the table shows which client or stage is using the
+// bandwidth and CPU.
+class NetTelemetry {
+public:
+    struct Row {
+        ClientRef client;
+        ConnectionStats totals;
+        double bytesInPerSecond = 0.0;
+        double bytesOutPerSecond = 0.0;
+        double messagesInPerSecond = 0.0;
+        double messagesOutPerSecond = 0.0;
+        double serializeShare = 0.0;  // seconds of serializing per second
+        double syscallShare = 0.0;    // seconds in system calls per second
+    };
+
+    NetTelemetry() : hasSample(false), encodeMsPerSecond(0.0), encodeUsPerSnapshot(0.0), lastEncodeSeconds(0.0), lastEncodeCount(0) {}
+
+    // Call every frame; does nothing until interval seconds have passed
+    void sample(const NetReactor& reactor, const UdpTransport* udp, const SendStage& sendStage, double interval = 1.0) {
+        auto time = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(time - lastSample).count();
+        if (hasSample && elapsed < interval) {
+            return;
+        }
+
+        std::unordered_map<ClientRef, ConnectionStats, ClientRefHash> current;
+        for (const ConnectionStats& stats : reactor.connectionStats()) {
+            current[{ ClientTransport::Tcp, stats.id }] = stats;
+        }
+        if (udp) {
+            for (const ConnectionStats& stats : udp->connectionStats()) {
+                current[{ ClientTransport::Udp, stats.id }] = stats;
+            }
+        }
+
+        rows.clear();
+        for (const auto& entry : current) {
+            Row row;
+            row.client = entry.first;
+            row.totals = entry.second;
+            auto previous = totals.find(entry.first);
+            if (hasSample && elapsed > 0.0 && previous != totals.end()) {
+                const ConnectionStats& before = previous->second;
+                row.bytesInPerSecond = (row.totals.bytesIn - before.bytesIn) / elapsed;
+                row.bytesOutPerSecond = (row.totals.bytesOut - before.bytesOut) / elapsed;
+                row.messagesInPerSecond = (row.totals.messagesIn - before.messagesIn) / elapsed;
+                row.messagesOutPerSecond = (row.totals.messagesOut - before.messagesOut) / elapsed;
+                row.serializeShare = (row.totals.serializeSeconds - before.serializeSeconds) / elapsed;
+                row.syscallShare = (row.totals.syscallSeconds - before.syscallSeconds) / elapsed;
+            }
+            rows.push_back(row);
+        }
+        // Heaviest senders first
+        std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+            return a.bytesOutPerSecond > b.bytesOutPerSecond;
+        });
+
+        double encodeSeconds = sendStage.encodeSeconds();
+        uint64_t encodeCount = sendStage.encodeCount();
+        if (hasSample && elapsed > 0.0) {
+            encodeMsPerSecond = (encodeSeconds - lastEncodeSeconds) * 1000.0 / elapsed;
+            uint64_t encodes = encodeCount - lastEncodeCount;
+            encodeUsPerSnapshot = encodes > 0 ? (encodeSeconds - lastEncodeSeconds) * 1e6 / encodes : 0.0;
+        }
+        lastEncodeSeconds = encodeSeconds;
+        lastEncodeCount = encodeCount;
+
+        totals.swap(current);
+        lastSample = time;
+        hasSample = true;
+    }
+
+    void draw() const {
+        ImGui::Text("Snapshot encode: %.2f ms/s, %.1f us each", encodeMsPerSecond, encodeUsPerSnapshot);
+        ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingFixedFit;
+        if (!ImGui::BeginTable("Connections", 10, flags, ImVec2(0.0f, 300.0f))) {
+            return;
+        }
+        ImGui::TableSetupScrollFreeze(0, 1);
+        ImGui::TableSetupColumn("Client");
+        ImGui::TableSetupColumn("In KiB/s");
+        ImGui::TableSetupColumn("Out KiB/s");
+        ImGui::TableSetupColumn("In msg/s");
+        ImGui::TableSetupColumn("Out msg/s");
+        ImGui::TableSetupColumn("Queued");
+        ImGui::TableSetupColumn("Partial writes");
+        ImGui::TableSetupColumn("Serialize ms/s");
+        ImGui::TableSetupColumn("Syscall ms/s");
+        ImGui::TableSetupColumn("RTT ms");
+        ImGui::TableHeadersRow();
+        for (const Row& row : rows) {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%s %u", transportName(row.client.transport), row.client.id);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", row.bytesInPerSecond / 1024.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", row.bytesOutPerSecond / 1024.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", row.messagesInPerSecond);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.1f", row.messagesOutPerSecond);
+            ImGui::TableNextColumn();
+            ImGui::Text("%zu", row.totals.queuedMessages);
+            ImGui::TableNextColumn();
+            ImGui::Text("%llu", static_cast<unsigned long long>(row.totals.partialWrites));
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", row.serializeShare * 1000.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", row.syscallShare * 1000.0);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", row.totals.rtt * 1000.0);
+        }
+        ImGui::EndTable();
+    }
+
+    // One line per connection from the latest sample; returns false if the
+    // file could not be written
+    bool writeCsv(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            return false;
+        }
+        out << "transport,id,bytes_in,bytes_out,messages_in,messages_out,bytes_in_per_s,bytes_out_per_s,"
+            "messages_in_per_s,messages_out_per_s,queued,partial_writes,serialize_s,syscall_s,rtt_ms,"
+            "encode_ms_per_s,encode_us_per_snapshot\n";
+        for (const Row& row : rows) {
+            out << transportName(row.client.transport) << ',' << row.client.id << ','
+                << row.totals.bytesIn << ',' << row.totals.bytesOut << ','
+                << row.totals.messagesIn << ',' << row.totals.messagesOut << ','
+                << row.bytesInPerSecond << ',' << row.bytesOutPerSecond << ','
+                << row.messagesInPerSecond << ',' << row.messagesOutPerSecond << ','
+                << row.totals.queuedMessages << ',' << row.totals.partialWrites << ','
+                << row.totals.serializeSeconds << ',' << row.totals.syscallSeconds << ','
+                << row.totals.rtt * 1000.0 << ','
+                << encodeMsPerSecond << ',' << encodeUsPerSnapshot << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::vector<Row> rows;
+    std::unordered_map<ClientRef, ConnectionStats, ClientRefHash> totals;
+    std::chrono::steady_clock::time_point lastSample;
+    bool hasSample;
+    double encodeMsPerSecond;
+    double encodeUsPerSnapshot;
+    double lastEncodeSeconds;
+    uint64_t lastEncodeCount;
+
+    static const char* transportName(ClientTransport transport) {
+        return transport == ClientTransport::Udp ? "UDP" : "TCP";
+    }
+};
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/WallSegments.h"
+#include "CompactNumbers.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// One bouncing particle. It reflects off the canvas edges and off walls, and
+// lives forever unless given a lifetime. Particles are plain values owned by
+// the tick thread, so copying and moving them is just copying the fields.
+//
+// Building with PARTICLE_COMPACT_STORAGE defined stores each particle in 16
+// bytes instead of 24, for runs of tens of millions of particles where the
+// tick is limited by memory bandwidth:
+//
+//   position  16.16 fixed point, to 1/65536 pixel in y and 1/32768 in x,
+//             whose lowest bit holds the collision flag; canvases up to
+//             32767 pixels
+//   velocity  half floats, to within 2^-11 of the value stored
+//   lifetime  a float, as before
+//
+// A tick with no bounce adds the velocity's step to the fixed-point position
+// in integers, cutting the step to a whole 1/65536 pixel, under 2^-15 pixel a
+// tick. Velocity is only rounded when it is stored, at launch and after a
+// bounce, so a particle's path drifts from the float build's by at most 2^-11
+// of the distance it travels between bounces, about 0.1 pixel per second at
+// 200 pixels a second. Clamping to a canvas edge can move it by up to one
+// tick's step, and once a particle hits a wall the two builds' paths part
+// for good, as any small difference would make them.
+#ifdef PARTICLE_COMPACT_STORAGE
+constexpr float maxCanvasSize = maxFixed;
+#else
+constexpr float maxCanvasSize = std::numeric_limits<float>::max();
+#endif
+
+// What every particle's update needs for one tick, worked out once per tick
+struct ParticleTick {
+    ParticleTick(float deltaTime, float canvasWidth, float canvasHeight, const WallSegments& walls)
+        : deltaTime(deltaTime), canvasWidth(canvasWidth), canvasHeight(canvasHeight), walls(walls) {
+#ifdef PARTICLE_COMPACT_STORAGE
+        fixedWidth = toFixed(canvasWidth);
+        fixedHeight = toFixed(canvasHeight);
+        stepX = deltaTime * (fixedScale / 2);
+        stepY = deltaTime * fixedScale;
+#endif
+    }
+
+    float deltaTime;
+    float canvasWidth;
+    float canvasHeight;
+    const WallSegments& walls;
+#ifdef PARTICLE_COMPACT_STORAGE
+    int64_t fixedWidth;
+    int64_t fixedHeight;
+    float stepX;        // velocity to 16.16 x movement, in units of 2
+    float stepY;
+#endif
+};
+
+class Particle {
+public:
+    Particle(float startX, float startY, float speed, float angle) {
+        restore(sf::Vector2f(startX, startY), sf::Vector2f(speed * std::cos(angle), speed * std::sin(angle)), false,
+            std::numeric_limits<float>::infinity());
+    }
+
+    // At rest at the origin, for storage that is launched later
+    Particle() {
+        restore(sf::Vector2f(), sf::Vector2f(), false, std::numeric_limits<float>::infinity());
+    }
+
+#ifdef PARTICLE_COMPACT_STORAGE
+    // Moves in fixed point, so a tick with no bounce decodes only the
+    // velocity and never rounds the position. Walls are tested against the
+    // fixed-point step itself; only a hit goes through the float bounce.
+    void update(const ParticleTick& tick) {
+        bool isCollided = (fixedX & 1) != 0;
+        int64_t nextX = (fixedX & ~1) + static_cast<int64_t>(fromHalf(halfVelocityX) * tick.stepX) * 2;
+        int64_t nextY = fixedY + static_cast<int64_t>(fromHalf(halfVelocityY) * tick.stepY);
+        if (nextX < 0 || nextX > tick.fixedWidth || nextY < 0 || nextY > tick.fixedHeight) [[unlikely]] {
+            sf::Vector2f position = getPosition();
+            sf::Vector2f velocity = getVelocity();
+            bounce(position, velocity, position + velocity * tick.deltaTime, isCollided, tick);
+            return;
+        }
+        if (!isCollided && !tick.walls.empty()) {
+            sf::Vector2f position = getPosition();
+            sf::Vector2f nextPosition(fromFixed(static_cast<int32_t>(nextX)), fromFixed(static_cast<int32_t>(nextY)));
+            if (tick.walls.crosses(position, nextPosition)) [[unlikely]] {
+                bounce(position, getVelocity(), nextPosition, false, tick);
+                return;
+            }
+        }
+        fixedX = static_cast<int32_t>(nextX);
+        fixedY = static_cast<int32_t>(nextY);
+    }
+#else
+    void update(const ParticleTick& tick) {
+        sf::Vector2f nextPosition = position + velocity * tick.deltaTime;
+        if (nextPosition.x < 0 || nextPosition.x > tick.canvasWidth || nextPosition.y < 0 || nextPosition.y > tick.canvasHeight
+            || (!isCollided && !tick.walls.empty())) [[unlikely]] {
+            bounce(position, velocity, nextPosition, isCollided, tick);
+            return;
+        }
+        position = nextPosition;
+        isCollided = false;
+    }
+#endif
+
+    // Starts the particle over, living forever
+    void launch(sf::Vector2f start, float speed, float angle) {
+        restore(start, sf::Vector2f(speed * std::cos(angle), speed * std::sin(angle)), false, std::numeric_limits<float>::infinity());
+    }
+
+    bool isAlive() const {
+        return lifetime > 0.0f;
+    }
+
+    // Counts the lifetime down. Returns true on the call that ends it.
+    bool age(float deltaTime) {
+        if (lifetime <= 0.0f) {
+            return false;
+        }
+        lifetime -= deltaTime;
+        return lifetime <= 0.0f;
+    }
+
+    void setLifetime(float seconds) {
+        lifetime = seconds;
+    }
+
+    void kill() {
+        lifetime = 0.0f;
+    }
+
+    // Puts back a particle saved with the getters below
+    void restore(sf::Vector2f savedPosition, sf::Vector2f savedVelocity, bool collided, float secondsLeft) {
+        storePosition(savedPosition, collided);
+        storeVelocity(savedVelocity);
+        lifetime = secondsLeft;
+    }
+
+#ifdef PARTICLE_COMPACT_STORAGE
+    sf::Vector2f getPosition() const {
+        return sf::Vector2f(fromFixed(fixedX & ~1), fromFixed(fixedY));
+    }
+    sf::Vector2f getVelocity() const {
+        return sf::Vector2f(fromHalf(halfVelocityX), fromHalf(halfVelocityY));
+    }
+    // True for the tick after a wall bounce, when walls are not tested
+    bool getCollided() const {
+        return (fixedX & 1) != 0;
+    }
+#else
+    sf::Vector2f getPosition() const {
+        return position;
+    }
+    sf::Vector2f getVelocity() const {
+        return velocity;
+    }
+    // True for the tick after a wall bounce, when walls are not tested
+    bool getCollided() const {
+        return isCollided;
+    }
+#endif
+    float getLifetime() const {
+        return lifetime;
+    }
+
+private:
+    friend struct ParticleLayout;
+
+    // The rest of a tick that reaches a canvas edge or hits a wall
+    void bounce(sf::Vector2f position, sf::Vector2f velocity, sf::Vector2f nextPosition, bool isCollided, const ParticleTick& tick) {
+        bool turned = false;
+        if (nextPosition.x < 0 || nextPosition.x > tick.canvasWidth) {
+            velocity.x = -velocity.x;
+            nextPosition.x = std::clamp(nextPosition.x, 0.0f, tick.canvasWidth);
+            turned = true;
+        }
+        if (nextPosition.y < 0 || nextPosition.y > tick.canvasHeight) {
+            velocity.y = -velocity.y;
+            nextPosition.y = std::clamp(nextPosition.y, 0.0f, tick.canvasHeight);
+            turned = true;
+        }
+        if (!isCollided) {
+            isCollided = tick.walls.bounce(position, nextPosition, velocity);
+            turned = turned || isCollided;
+        }
+        else {
+            isCollided = false;
+        }
+        storeCanvasPosition(nextPosition, isCollided);
+        if (turned) {
+            storeVelocity(velocity);
+        }
+    }
+
+#ifdef PARTICLE_COMPACT_STORAGE
+    int32_t fixedX;             // 16.16, lowest bit the collision flag
+    int32_t fixedY;             // 16.16
+    uint16_t halfVelocityX;
+    uint16_t halfVelocityY;
+    float lifetime;             // seconds left; 0 or less once dead
+
+    void storePosition(sf::Vector2f newPosition, bool collided) {
+        fixedX = toEvenFixed(newPosition.x) | (collided ? 1 : 0);
+        fixedY = toFixed(newPosition.y);
+    }
+
+    void storeCanvasPosition(sf::Vector2f newPosition, bool collided) {
+        fixedX = toCanvasEvenFixed(newPosition.x) | (collided ? 1 : 0);
+        fixedY = toCanvasFixed(newPosition.y);
+    }
+
+    void storeVelocity(sf::Vector2f newVelocity) {
+        halfVelocityX = toHalf(newVelocity.x);
+        halfVelocityY = toHalf(newVelocity.y);
+    }
+#else
+    sf::Vector2f position;
+    sf::Vector2f velocity;
+    bool isCollided;
+    float lifetime;     // seconds left; 0 or less once dead
+
+    void storePosition(sf::Vector2f newPosition, bool collided) {
+        position = newPosition;
+        isCollided = collided;
+    }
+
+    void storeCanvasPosition(sf::Vector2f newPosition, bool collided) {
+        storePosition(newPosition, collided);
+    }
+
+    void storeVelocity(sf::Vector2f newVelocity) {
+        velocity = newVelocity;
+    }
+#endif
+};
+
+// The storage layout each build promises. ParticlePool keeps particles in
+// one array and compaction copies them as plain values.
+struct ParticleLayout {
+#ifdef PARTICLE_COMPACT_STORAGE
+    static constexpr size_t bytes = 16;
+    static_assert(offsetof(Particle, fixedX) == 0 && offsetof(Particle, fixedY) == 4, "the position comes first");
+    static_assert(offsetof(Particle, halfVelocityX) == 8 && offsetof(Particle, halfVelocityY) == 10, "then the velocity");
+    static_assert(offsetof(Particle, lifetime) == 12, "then the lifetime");
+#else
+    static constexpr size_t bytes = 24;
+    static_assert(offsetof(Particle, position) == 0 && offsetof(Particle, velocity) == 8, "the position and velocity come first");
+    static_assert(offsetof(Particle, lifetime) == 20, "the lifetime is last");
+#endif
+};
+
+static_assert(sizeof(Particle) == ParticleLayout::bytes, "a particle is the size its layout says");
+static_assert(alignof(Particle) == 4, "particles pack with no padding between them");
+static_assert(std::is_trivially_copyable_v<Particle>, "particles are copied as plain values");
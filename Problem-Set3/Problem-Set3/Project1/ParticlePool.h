@@ -0,0 +1,210 @@
+#pragma once
+
+#include "Particle.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Names one particle for as long as it lives. The pool may move the particle
+// during compaction without invalidating the handle, and once the particle
+// dies its id can be reused, but never with the same generation, so an old
+// handle stops matching instead of finding the newcomer.
+struct ParticleHandle {
+    uint32_t id = 0;
+    uint32_t generation = 0;
+};
+
+// Particle storage with stable ids. Particles live in one array in the order
+// they were spawned; spawn() appends and kill() marks the particle dead where
+// it is, both in O(1). The holes left by dead particles are skipped until
+// compact() squeezes them out in parallel, keeping the live particles dense
+// and in order. An id table maps each id to wherever its particle is now, so
+// the ids in snapshots and any handles held elsewhere survive compaction.
+//
+// Storage only grows while more particles are alive, or holes waiting, than
+// ever before, so a steady stream of spawns and kills stops allocating.
+// Each particle takes ParticleLayout::bytes, 16 in the compact build.
+class ParticlePool {
+public:
+    static_assert(sizeof(Particle) == ParticleLayout::bytes, "storage is sized by the particle layout");
+
+    ParticlePool() : holes(0), replacements(0) {}
+
+    // Particles alive now
+    size_t size() const {
+        return particles.size() - holes;
+    }
+
+    // Live and dead particles in storage order; dead ones are !isAlive()
+    size_t storageSize() const {
+        return particles.size();
+    }
+
+    Particle& at(size_t index) {
+        return particles[index];
+    }
+
+    const Particle& at(size_t index) const {
+        return particles[index];
+    }
+
+    // Every particle, live and dead, in storage order
+    const std::vector<Particle>& storage() const {
+        return particles;
+    }
+
+    uint32_t idAt(size_t index) const {
+        return ids[index];
+    }
+
+    // Every id handed out so far is below this
+    uint32_t idCount() const {
+        return static_cast<uint32_t>(generations.size());
+    }
+
+    size_t holeCount() const {
+        return holes;
+    }
+
+    // Changes with every replace(), after which the ids name new particles.
+    // Spawns, kills and compaction leave it alone.
+    uint32_t version() const {
+        return replacements;
+    }
+
+    // A new particle at rest, to be launched by the caller
+    ParticleHandle spawn() {
+        uint32_t id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        else {
+            id = static_cast<uint32_t>(generations.size());
+            generations.push_back(0);
+            locations.push_back(0);
+        }
+        locations[id] = static_cast<uint32_t>(particles.size());
+        particles.emplace_back();
+        ids.push_back(id);
+        return { id, generations[id] };
+    }
+
+    // Null once the particle has died
+    Particle* find(ParticleHandle handle) {
+        if (handle.id >= generations.size() || generations[handle.id] != handle.generation) {
+            return nullptr;
+        }
+        return &particles[locations[handle.id]];
+    }
+
+    bool kill(ParticleHandle handle) {
+        if (!find(handle)) {
+            return false;
+        }
+        killAt(locations[handle.id]);
+        return true;
+    }
+
+    // Kills the particle at a storage index, which must be alive or have just
+    // run out of lifetime
+    void killAt(size_t index) {
+        uint32_t id = ids[index];
+        particles[index].kill();
+        ++generations[id];
+        freeIds.push_back(id);
+        ++holes;
+    }
+
+    // Takes particles as the new contents, numbered from id 0 in order.
+    // Every handle to the old particles stops matching.
+    void replace(std::vector<Particle>& replacement) {
+        size_t count = replacement.size();
+        particles.swap(replacement);
+        for (uint32_t& generation : generations) {
+            ++generation;
+        }
+        if (generations.size() < count) {
+            generations.resize(count, 0);
+            locations.resize(count);
+        }
+        ids.resize(count);
+        std::iota(ids.begin(), ids.end(), 0u);
+        std::iota(locations.begin(), locations.begin() + count, 0u);
+        freeIds.clear();
+        for (size_t id = generations.size(); id-- > count;) {
+            freeIds.push_back(static_cast<uint32_t>(id));
+        }
+        holes = 0;
+        ++replacements;
+    }
+
+    void clear() {
+        std::vector<Particle> none;
+        replace(none);
+    }
+
+    // Removes the holes, keeping the live particles in order. Storage is cut
+    // into chunks; each chunk's live particles are counted and then copied to
+    // their place in a second buffer, both steps spread over the pool.
+    void compact(ThreadPool& pool) {
+        if (holes == 0) {
+            return;
+        }
+        size_t count = particles.size();
+        size_t chunks = std::max<size_t>(1, std::min(pool.size() * 4, count / minChunkSize));
+        size_t chunkSize = (count + chunks - 1) / chunks;
+
+        chunkStarts.assign(chunks + 1, 0);
+        parallelFor(pool, chunks, [this, count, chunkSize](size_t chunk) {
+            size_t live = 0;
+            for (size_t i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); ++i) {
+                live += particles[i].isAlive();
+            }
+            chunkStarts[chunk + 1] = live;
+        });
+        std::partial_sum(chunkStarts.begin(), chunkStarts.end(), chunkStarts.begin());
+
+        // As large as the storage, since the two are swapped, so neither
+        // grows again until the storage does
+        compacted.reserve(particles.capacity());
+        compactedIds.reserve(ids.capacity());
+        compacted.resize(chunkStarts[chunks]);
+        compactedIds.resize(chunkStarts[chunks]);
+        parallelFor(pool, chunks, [this, count, chunkSize](size_t chunk) {
+            size_t out = chunkStarts[chunk];
+            for (size_t i = chunk * chunkSize; i < std::min(count, (chunk + 1) * chunkSize); ++i) {
+                if (particles[i].isAlive()) {
+                    compacted[out] = particles[i];
+                    compactedIds[out] = ids[i];
+                    locations[ids[i]] = static_cast<uint32_t>(out);
+                    ++out;
+                }
+            }
+        });
+        particles.swap(compacted);
+        ids.swap(compactedIds);
+        holes = 0;
+    }
+
+private:
+    // Chunks smaller than this cost more to hand out than to copy
+    static constexpr size_t minChunkSize = 16384;
+
+    std::vector<Particle> particles;
+    std::vector<uint32_t> ids;          // id of the particle at each storage index
+    std::vector<uint32_t> locations;    // storage index of each live id
+    std::vector<uint32_t> generations;  // bumped when an id's particle dies
+    std::vector<uint32_t> freeIds;
+    size_t holes;
+    uint32_t replacements;
+
+    // Kept between compactions so they do not reallocate
+    std::vector<Particle> compacted;
+    std::vector<uint32_t> compactedIds;
+    std::vector<size_t> chunkStarts;
+};
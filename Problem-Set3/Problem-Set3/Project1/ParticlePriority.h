@@ -0,0 +1,204 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/Protocol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+// Chooses which particles go into one client's update.
+//
+// It tracks what the client believes about every particle id:
+// the position and velocity last sent, as the client decoded them, and when. The client moves
+// each particle in a straight line from there (see ParticleTable), so with an
+// error tolerance set a particle is only due when that line has drifted more
+// than the tolerance from the real position, when its velocity has changed
+// (a bounce), when it has never been sent, or when it has not been refreshed
+// for maxRefreshSeconds. The refresh bounds how long a dropped update can
+// leave the client wrong. Without a tolerance every particle is due.
+//
+// When more particles are due than fit in the budget, priority decides.
+// Every particle gains priority each snapshot it is not sent, at a rate that
+// is highest inside the client's view and falls off with distance from it,
+// and that rises with the client's error and with a change of velocity. Sent
+// particles start again from zero, so distant particles are starved for a
+// while but never forever.
+//
+// Ids whose particle has died since it was last sent are reported
+// separately, so the client stops drawing them. An update can be dropped, so
+// each removal goes out again in every update until the client acknowledges
+// one that carried it, or until the client would have let the entry expire.
+// Removals share the budget with the particles: when more are waiting than
+// fit, the oldest go first and the rest wait for a later update.
+class ParticlePriority {
+public:
+    struct Weights {
+        sf::Vector2f viewHalfSize{ 80.0f, 45.0f };  // the explorer's zoomed view around its sprite
+        float inView = 10.0f;                       // gained per snapshot by a visible particle
+        float falloff = 200.0f;                     // px outside the view at which that halves
+        float velocityChange = 4.0f;                // extra multiple for a full reversal
+        float errorScale = 10.0f;                   // px of client error that doubles the rate
+        float maxRefreshSeconds = 3.0f;
+    };
+
+    // Held by whichever sender thread is encoding for this client
+    std::mutex mutex;
+
+    ParticlePriority() : ParticlePriority(Weights()) {}
+
+    explicit ParticlePriority(Weights weights) : weights(weights), sceneVersion(0), hasScene(false) {}
+
+    // Picks at most maxEntries of the live particles that are due, as
+    // positions in the snapshot's particle list, in order. ids gives each
+    // particle's id, or is empty when the ids are just 0, 1, 2 ...
+    // tick and serverTimeMs are the snapshot's, acknowledgedTick the newest
+    // update the client has applied, and viewCenter the client's sprite.
+    // A tolerance of 0 makes every particle due. The removed ids cost some
+    // of maxEntries, and never more than all of it.
+    void select(uint32_t version, uint64_t tick, uint32_t serverTimeMs, uint64_t acknowledgedTick, uint32_t idCount,
+        const std::vector<uint32_t>& ids, const std::vector<sf::Vector2f>& positions, const std::vector<sf::Vector2f>& velocities,
+        sf::Vector2f viewCenter, float tolerance, size_t maxEntries, std::vector<uint32_t>& chosen, std::vector<uint32_t>& removed) {
+        size_t count = positions.size();
+        if (!hasScene || version != sceneVersion) {
+            // A new set of particles: the client knows none of them
+            hasScene = true;
+            sceneVersion = version;
+            accumulated.clear();
+            believed.clear();
+            pending.clear();
+        }
+        // Emitters add ids without changing the scene
+        accumulated.resize(idCount, 0.0f);
+        believed.resize(idCount, Belief());
+
+        // Every id is live when none are missing
+        bool allLive = count >= idCount;
+        if (!allLive) {
+            live.assign(idCount, 0);
+            for (size_t i = 0; i < count; ++i) {
+                live[ids[i]] = 1;
+            }
+            for (uint32_t id = 0; id < idCount; ++id) {
+                Belief& belief = believed[id];
+                if (belief.sent && !live[id]) {
+                    // The client has already dropped one it has not heard of for that long
+                    if (serverTimeMs - belief.timeMs < particleExpiryMs) {
+                        pending.push_back({ id, notSent, serverTimeMs });
+                    }
+                    belief = Belief();
+                    accumulated[id] = 0.0f;
+                }
+            }
+        }
+
+        // Repeat each removal until the client has applied an update that
+        // carried it, or has been sent the id again since
+        auto settled = [&](const Removal& removal) {
+            bool resent = (allLive || live[removal.id]) && believed[removal.id].sent;
+            return acknowledgedTick >= removal.sentTick || serverTimeMs - removal.timeMs >= particleExpiryMs || resent;
+        };
+        pending.erase(std::remove_if(pending.begin(), pending.end(), settled), pending.end());
+
+        // As many as the budget holds, oldest first. One that no longer fits
+        // counts as never sent, so every update from sentTick on carried it.
+        size_t maxRemoved = maxEntries * particleUpdateEntrySize / particleUpdateRemovedSize;
+        removed.clear();
+        for (Removal& removal : pending) {
+            if (removed.size() < maxRemoved) {
+                removal.sentTick = std::min(removal.sentTick, tick);
+                removed.push_back(removal.id);
+            }
+            else {
+                removal.sentTick = notSent;
+            }
+        }
+        size_t removedEntries = (removed.size() * particleUpdateRemovedSize + particleUpdateEntrySize - 1) / particleUpdateEntrySize;
+        maxEntries -= std::min(maxEntries, removedEntries);
+
+        due.clear();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t id = ids.empty() ? i : ids[i];
+            const Belief& belief = believed[id];
+            sf::Vector2f velocity = i < velocities.size() ? velocities[i] : sf::Vector2f();
+
+            // Where the client has the particle now, and how far off that is
+            float seconds = static_cast<int32_t>(serverTimeMs - belief.timeMs) / 1000.0f;
+            sf::Vector2f error = positions[i] - (belief.position + belief.velocity * seconds);
+            float errorLength = std::sqrt(error.x * error.x + error.y * error.y);
+            bool bounced = receivedVelocity(velocity) != belief.velocity;
+
+            float dx = std::max(0.0f, std::abs(positions[i].x - viewCenter.x) - weights.viewHalfSize.x);
+            float dy = std::max(0.0f, std::abs(positions[i].y - viewCenter.y) - weights.viewHalfSize.y);
+            float distance = std::sqrt(dx * dx + dy * dy);
+            float weight = weights.inView * weights.falloff / (weights.falloff + distance);
+
+            // 0 for the velocity the client has, 2 for a reversal
+            sf::Vector2f change = velocity - belief.velocity;
+            float speed = std::max(1.0f, std::sqrt(velocity.x * velocity.x + velocity.y * velocity.y));
+            float relativeChange = std::min(2.0f, std::sqrt(change.x * change.x + change.y * change.y) / speed);
+            weight *= 1.0f + weights.velocityChange * relativeChange * 0.5f;
+            weight *= 1.0f + errorLength / weights.errorScale;
+            accumulated[id] += weight;
+
+            if (tolerance <= 0.0f || !belief.sent || bounced || errorLength > tolerance || seconds >= weights.maxRefreshSeconds) {
+                due.push_back(i);
+            }
+        }
+
+        chosen.clear();
+        if (due.size() <= maxEntries) {
+            chosen.swap(due);
+        }
+        else if (maxEntries > 0) {
+            auto idOf = [&ids](uint32_t i) { return ids.empty() ? i : ids[i]; };
+            std::nth_element(due.begin(), due.begin() + maxEntries, due.end(), [this, &idOf](uint32_t a, uint32_t b) {
+                return accumulated[idOf(a)] > accumulated[idOf(b)];
+            });
+            chosen.assign(due.begin(), due.begin() + maxEntries);
+            std::sort(chosen.begin(), chosen.end());
+        }
+
+        for (uint32_t index : chosen) {
+            uint32_t id = ids.empty() ? index : ids[index];
+            accumulated[id] = 0.0f;
+            Belief& belief = believed[id];
+            belief.position = receivedPosition(positions[index]);
+            belief.velocity = receivedVelocity(index < velocities.size() ? velocities[index] : sf::Vector2f());
+            belief.timeMs = serverTimeMs;
+            belief.sent = true;
+        }
+    }
+
+private:
+    struct Belief {
+        sf::Vector2f position;
+        sf::Vector2f velocity;
+        uint32_t timeMs = 0;
+        bool sent = false;
+    };
+
+    // A removal the client has not yet acknowledged: the first update that
+    // carried it, and when the particle died
+    struct Removal {
+        uint32_t id;
+        uint64_t sentTick;
+        uint32_t timeMs;
+    };
+
+    static constexpr uint64_t notSent = std::numeric_limits<uint64_t>::max();
+
+    Weights weights;
+    uint32_t sceneVersion;
+    bool hasScene;
+    std::vector<float> accumulated;
+    std::vector<Belief> believed;
+    std::vector<Removal> pending;
+    std::vector<uint32_t> due;      // scratch
+    std::vector<uint8_t> live;      // scratch
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Particle.h"
+#include "ThreadPool.h"
+#include "World.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Largest spawn accepted from the viewer or the admin socket. A particle and
+// its pool entries take about 40 bytes on the server, so this is about two
+// gigabytes.
+constexpr size_t maxSpawnCount = 50000000;
+
+// Builds a whole new set of particles on a ThreadPool, off both the UI and
+// the tick thread. The storage is allocated once, then launched in parallel
+// chunks, and the finished vector is handed to a callback that swaps it into
+// the world in one go. One spawn runs at a time.
+class ParticleSpawner {
+public:
+    // Called on a pool thread with the finished particles, which it may take
+    using Ready = std::function<void(std::vector<Particle>& particles)>;
+
+    ParticleSpawner(ThreadPool& pool, size_t numChunks)
+        : pool(pool), numChunks(std::max<size_t>(1, numChunks)), running(false), total(0), launched(0) {}
+
+    // Waits for a running spawn, whose tasks refer to this spawner
+    ~ParticleSpawner() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !running; });
+    }
+
+    ParticleSpawner(const ParticleSpawner&) = delete;
+    ParticleSpawner& operator=(const ParticleSpawner&) = delete;
+
+    // Returns false, and does nothing, while another spawn is running
+    bool start(size_t count, SpawnShape shape, Ready ready) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (running) {
+                return false;
+            }
+            running = true;
+        }
+        total = count;
+        launched = 0;
+
+        auto job = std::make_shared<Job>();
+        job->shape = std::move(shape);
+        job->ready = std::move(ready);
+        pool.enqueue([this, job, count] { allocate(job, count); });
+        return true;
+    }
+
+    bool busy() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running;
+    }
+
+    // Fraction of the running spawn launched so far, 1 when idle
+    float progress() const {
+        size_t count = total.load();
+        if (!busy() || count == 0) {
+            return 1.0f;
+        }
+        return static_cast<float>(static_cast<double>(launched.load()) / count);
+    }
+
+private:
+    struct Job {
+        std::vector<Particle> particles;
+        SpawnShape shape;
+        Ready ready;
+        std::atomic<size_t> chunksLeft{ 0 };
+    };
+
+    // Chunks smaller than this cost more to queue than to fill
+    static constexpr size_t minChunkSize = 4096;
+    // Progress is published after every this many particles
+    static constexpr size_t progressStep = 65536;
+
+    ThreadPool& pool;
+    const size_t numChunks;
+    mutable std::mutex mutex;
+    std::condition_variable idle;
+    bool running;
+    std::atomic<size_t> total;
+    std::atomic<size_t> launched;
+
+    void allocate(const std::shared_ptr<Job>& job, size_t count) {
+        try {
+            job->particles.resize(count);
+        }
+        catch (const std::bad_alloc&) {
+            std::cerr << "Not enough memory to spawn " << count << " particles" << std::endl;
+            finish();
+            return;
+        }
+
+        size_t chunks = std::max<size_t>(1, std::min(numChunks, count / minChunkSize));
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        job->chunksLeft = chunks;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            size_t begin = std::min(count, chunk * chunkSize);
+            size_t end = std::min(count, begin + chunkSize);
+            pool.enqueue([this, job, begin, end] { fill(job, begin, end); });
+        }
+    }
+
+    void fill(const std::shared_ptr<Job>& job, size_t begin, size_t end) {
+        for (size_t stepBegin = begin; stepBegin < end; stepBegin += progressStep) {
+            size_t stepEnd = std::min(end, stepBegin + progressStep);
+            for (size_t i = stepBegin; i < stepEnd; ++i) {
+                job->shape(i, job->particles[i]);
+            }
+            launched += stepEnd - stepBegin;
+        }
+        // The last chunk to finish hands the particles over
+        if (--job->chunksLeft == 0) {
+            job->ready(job->particles);
+            finish();
+        }
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        idle.notify_all();
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/PlayerMovement.h"
+#include "../Common/Protocol.h"
+#include "../Common/SpscRing.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// A connected client, reached either through the TCP reactor or over UDP
+enum class ClientTransport { Tcp, Udp };
+
+struct ClientRef {
+    ClientTransport transport;
+    uint32_t id;
+
+    bool operator==(const ClientRef& other) const {
+        return transport == other.transport && id == other.id;
+    }
+};
+
+struct ClientRefHash {
+    size_t operator()(const ClientRef& client) const {
+        return std::hash<uint64_t>()((static_cast<uint64_t>(client.transport) << 32) | client.id);
+    }
+};
+
+// Every connected explorer and its authoritative position. Player IDs are
+// assigned here and never reused while the server runs. Join and leave are
+// O(1): players live in a dense vector and leaving swaps the last player into
+// the hole.
+//
+// Each player has a bounded input queue with the connection's I/O thread as
+// its only producer and the frame as its only consumer, so receiving input
+// never takes the registry lock.
+class PlayerRegistry {
+public:
+    // About 2.5 s of input at one command per 10 ms tick
+    using InputQueue = SpscRing<InputCommand, 256>;
+
+    PlayerRegistry() : nextId(1) {}
+
+    // inputs receives the queue the caller should push this client's
+    // commands into
+    PlayerId join(ClientRef client, std::shared_ptr<InputQueue>& inputs) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = indices.find(client);
+        if (existing != indices.end()) {
+            inputs = players[existing->second].inputs;
+            return players[existing->second].state.id;
+        }
+        PlayerId id = nextId++;
+        inputs = std::make_shared<InputQueue>();
+        indices[client] = players.size();
+        players.push_back({ client, { id, playerSpawnPoint }, inputs });
+        return id;
+    }
+
+    void leave(ClientRef client) {
+        std::lock_guard<std::mutex> lock(mutex);
+        spectators.erase(std::remove(spectators.begin(), spectators.end(), client), spectators.end());
+        removePlayer(client);
+    }
+
+    // Turn a connected client into a spectator: its player is removed but it
+    // keeps receiving snapshots. Relays subscribe this way.
+    void spectate(ClientRef client) {
+        std::lock_guard<std::mutex> lock(mutex);
+        removePlayer(client);
+        if (std::find(spectators.begin(), spectators.end(), client) == spectators.end()) {
+            spectators.push_back(client);
+        }
+    }
+
+    // The newest particle update the client says it has applied; stale
+    // acknowledgements are ignored
+    void acknowledge(ClientRef client, uint64_t tick) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = indices.find(client);
+        if (it != indices.end()) {
+            Player& player = players[it->second];
+            player.acknowledgedTick = std::max(player.acknowledgedTick, tick);
+        }
+    }
+
+    // Frame only. Drains every input queue and runs each command through
+    // move(position, keys); repeated and stale commands are skipped.
+    template <typename Move>
+    void applyInputs(Move move) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Player& player : players) {
+            PlayerState& state = player.state;
+            player.inputs->drain([&](const InputCommand& command) {
+                if (command.sequence > state.lastInput) {
+                    state.position = move(state.position, command.keys);
+                    state.lastInput = command.sequence;
+                }
+            });
+        }
+    }
+
+    // Copy every connected client and each player's state and acknowledged
+    // update tick for use outside the lock. Spectators come after the
+    // players in clients and have neither.
+    void copyTo(std::vector<ClientRef>& clients, std::vector<PlayerState>& states, std::vector<uint64_t>& acknowledgedTicks) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        clients.clear();
+        states.clear();
+        acknowledgedTicks.clear();
+        for (const Player& player : players) {
+            clients.push_back(player.client);
+            states.push_back(player.state);
+            acknowledgedTicks.push_back(player.acknowledgedTick);
+        }
+        clients.insert(clients.end(), spectators.begin(), spectators.end());
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return players.size();
+    }
+
+    size_t spectatorCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return spectators.size();
+    }
+
+private:
+    struct Player {
+        ClientRef client;
+        PlayerState state;
+        std::shared_ptr<InputQueue> inputs;
+        uint64_t acknowledgedTick = 0;
+    };
+
+    mutable std::mutex mutex;
+    PlayerId nextId;
+    std::unordered_map<ClientRef, size_t, ClientRefHash> indices;
+    std::vector<Player> players;
+    std::vector<ClientRef> spectators;   // a few relays at most
+
+    void removePlayer(ClientRef client) {
+        auto it = indices.find(client);
+        if (it == indices.end()) {
+            return;
+        }
+        size_t index = it->second;
+        indices.erase(it);
+        if (index + 1 != players.size()) {
+            players[index] = players.back();
+            indices[players[index].client] = index;
+        }
+        players.pop_back();
+    }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Recording.h"
+#include "SendStage.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Records the snapshots the tick publishes on a thread of its own, so the
+// tick only pays for queueing a reference. Snapshots are immutable once
+// published, so nothing is copied. If the disk falls behind, snapshots are
+// dropped rather than queued without limit, and the recording starts a new
+// chunk at the next one it gets.
+class Recorder {
+public:
+    Recorder() : stopping(false), dropped(0) {}
+
+    ~Recorder() {
+        stop();
+    }
+
+    Recorder(const Recorder&) = delete;
+    Recorder& operator=(const Recorder&) = delete;
+
+    // Returns false with a message if the file cannot be created
+    bool start(const std::string& recordingPath, float tickRate, std::string& error) {
+        if (!writer.open(recordingPath, tickRate, error)) {
+            return false;
+        }
+        path = recordingPath;
+        thread = std::thread(&Recorder::run, this);
+        return true;
+    }
+
+    // Safe from any thread; never waits for the disk
+    void push(std::shared_ptr<const ServerSnapshot> snapshot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            if (queue.size() >= maxQueued) {
+                ++dropped;
+                return;
+            }
+            queue.push_back(std::move(snapshot));
+        }
+        ready.notify_one();
+    }
+
+    // Writes what is queued, closes the file with its index and waits for
+    // the thread
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+private:
+    // Each queued snapshot keeps its particles alive, so keep few
+    static constexpr size_t maxQueued = 16;
+
+    RecordingWriter writer;
+    std::string path;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::shared_ptr<const ServerSnapshot>> queue;
+    bool stopping;
+    uint64_t dropped;
+
+    void run() {
+        bool failed = false;
+        while (true) {
+            std::shared_ptr<const ServerSnapshot> snapshot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    break;
+                }
+                snapshot = std::move(queue.front());
+                queue.pop_front();
+            }
+            if (!failed && !writer.write(*snapshot)) {
+                std::cerr << "Recording to " << path << " failed; the rest of the run is not recorded" << std::endl;
+                failed = true;
+            }
+        }
+        if (!writer.close() && !failed) {
+            std::cerr << "Recording to " << path << " could not be closed" << std::endl;
+        }
+        std::cout << "Recorded " << writer.frameCount() << " ticks in " << writer.bytesWritten() / 1024 << " KiB to " << path;
+        if (dropped > 0) {
+            std::cout << ", " << dropped << " dropped while the disk caught up";
+        }
+        std::cout << std::endl;
+    }
+};
@@ -0,0 +1,721 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/Protocol.h"
+#include "SendStage.h"
+#include "World.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Recordings of a run, tick by tick, for replay in the viewer. A recording is
+// a file header, a sequence of chunks and, once the recording is closed, a
+// seek index:
+//
+//   header   "PSRC", version, tick rate
+//   chunk    kind, payload size, first tick, frame count, walls offset, payload
+//   ...
+//   index    first tick, frame count and offset of every Frames chunk
+//   footer   index offset, index entry count, "PSRI"
+//
+// A Frames chunk holds up to recordingFramesPerChunk consecutive ticks: a
+// keyframe with every live particle, then one delta per tick. Positions are
+// quantized like the network protocol's and each particle is predicted to
+// move as far as it did last tick, so a delta only stores the ids that came
+// and went and the few particles that did not move as predicted, as varints.
+// A Walls chunk holds the walls, written again only when they change; each
+// Frames chunk points at the one in effect.
+//
+// Any tick is one index lookup and one chunk read away, and a reader only
+// ever holds one chunk. A recording that was never closed has no index; the
+// reader rebuilds it from the chunk headers.
+constexpr char recordingFileMagic[4] = { 'P', 'S', 'R', 'C' };
+constexpr char recordingIndexMagic[4] = { 'P', 'S', 'R', 'I' };
+constexpr uint32_t recordingFileVersion = 1;
+constexpr uint32_t recordingFramesPerChunk = 60;
+constexpr size_t recordingFileHeaderSize = 12;
+constexpr size_t recordingChunkHeaderSize = 25;
+constexpr size_t recordingIndexEntrySize = 20;
+constexpr size_t recordingFooterSize = 16;
+
+enum class RecordingChunkKind : uint8_t {
+    Frames = 1,
+    Walls = 2
+};
+
+struct RecordingChunkHeader {
+    RecordingChunkKind kind = RecordingChunkKind::Frames;
+    uint32_t payloadBytes = 0;
+    uint64_t firstTick = 0;
+    uint32_t frameCount = 0;
+    uint64_t wallsOffset = 0;   // Frames only; 0 when there are no walls
+};
+
+struct RecordingIndexEntry {
+    uint64_t firstTick = 0;
+    uint32_t frameCount = 0;
+    uint64_t offset = 0;
+};
+
+// One tick as replayed
+struct ReplayFrame {
+    uint64_t tick = 0;
+    uint32_t serverTimeMs = 0;
+    std::vector<sf::Vector2f> particles;
+    std::vector<PlayerState> players;
+    std::shared_ptr<const std::vector<sf::VertexArray>> walls;
+};
+
+inline void writeChunkHeader(std::string& out, const RecordingChunkHeader& header) {
+    ByteWriter writer(out);
+    writer.writeU8(static_cast<uint8_t>(header.kind));
+    writer.writeU32(header.payloadBytes);
+    writer.writeU64(header.firstTick);
+    writer.writeU32(header.frameCount);
+    writer.writeU64(header.wallsOffset);
+}
+
+inline bool readChunkHeader(const char* data, size_t size, RecordingChunkHeader& header) {
+    ByteReader reader(data, size);
+    uint8_t kind = reader.readU8();
+    header.kind = static_cast<RecordingChunkKind>(kind);
+    header.payloadBytes = reader.readU32();
+    header.firstTick = reader.readU64();
+    header.frameCount = reader.readU32();
+    header.wallsOffset = reader.readU64();
+    return reader.ok() && (header.kind == RecordingChunkKind::Frames || header.kind == RecordingChunkKind::Walls);
+}
+
+// What the encoder and the decoder both know about every particle id: where
+// it was last tick, quantized, and how far it moved getting there
+struct RecordingState {
+    std::vector<int32_t> x;
+    std::vector<int32_t> y;
+    std::vector<int32_t> dx;
+    std::vector<int32_t> dy;
+    std::vector<uint8_t> live;
+
+    size_t size() const {
+        return live.size();
+    }
+
+    void grow(size_t count) {
+        if (count > live.size()) {
+            x.resize(count);
+            y.resize(count);
+            dx.resize(count);
+            dy.resize(count);
+            live.resize(count);
+        }
+    }
+};
+
+// Builds a recording from snapshots, writing each chunk as it fills. Used
+// from one thread; Recorder runs it in the background.
+class RecordingWriter {
+public:
+    RecordingWriter() : offset(0), wallsOffset(0), lastWalls(nullptr), expectedTick(0), serial(0), frames(0) {}
+
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+
+    bool open(const std::string& path, float tickRate, std::string& error) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            error = "cannot write recording " + path;
+            return false;
+        }
+        std::string header(recordingFileMagic, sizeof(recordingFileMagic));
+        ByteWriter writer(header);
+        writer.writeU32(recordingFileVersion);
+        writer.writeF32(tickRate);
+        file.write(header.data(), header.size());
+        offset = header.size();
+        return static_cast<bool>(file);
+    }
+
+    // Returns false once the file cannot be written
+    bool write(const ServerSnapshot& snapshot) {
+        if (snapshot.walls.get() != lastWalls) {
+            lastWalls = snapshot.walls.get();
+            std::vector<float> walls;
+            if (snapshot.walls) {
+                for (const sf::VertexArray& wall : *snapshot.walls) {
+                    for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+                        walls.insert(walls.end(), { wall[i].position.x, wall[i].position.y, wall[i + 1].position.x, wall[i + 1].position.y });
+                    }
+                }
+            }
+            if (walls != wallCoordinates) {
+                flushChunk();
+                wallCoordinates.swap(walls);
+                writeWalls();
+            }
+        }
+
+        // A dropped tick breaks the chain of deltas, so start over with a
+        // keyframe
+        if (!chunk.empty() && (snapshot.tick != expectedTick || chunkHeader.frameCount == recordingFramesPerChunk)) {
+            flushChunk();
+        }
+        if (chunk.empty()) {
+            chunkHeader = RecordingChunkHeader();
+            chunkHeader.firstTick = snapshot.tick;
+            chunkHeader.wallsOffset = wallsOffset;
+            encodeFrame(snapshot, true);
+        }
+        else {
+            encodeFrame(snapshot, false);
+        }
+        ++chunkHeader.frameCount;
+        ++frames;
+        expectedTick = snapshot.tick + 1;
+        return static_cast<bool>(file);
+    }
+
+    // Writes the last chunk and the index
+    bool close() {
+        if (!file.is_open()) {
+            return true;
+        }
+        flushChunk();
+        std::string tail;
+        ByteWriter writer(tail);
+        for (const RecordingIndexEntry& entry : index) {
+            writer.writeU64(entry.firstTick);
+            writer.writeU32(entry.frameCount);
+            writer.writeU64(entry.offset);
+        }
+        writer.writeU64(offset);
+        writer.writeU32(static_cast<uint32_t>(index.size()));
+        tail.append(recordingIndexMagic, sizeof(recordingIndexMagic));
+        file.write(tail.data(), tail.size());
+        offset += tail.size();
+        file.close();
+        return !file.fail();
+    }
+
+    uint64_t frameCount() const {
+        return frames;
+    }
+
+    uint64_t bytesWritten() const {
+        return offset;
+    }
+
+private:
+    std::ofstream file;
+    uint64_t offset;
+    std::vector<RecordingIndexEntry> index;
+
+    std::vector<float> wallCoordinates;     // x1 y1 x2 y2 of each segment last written
+    uint64_t wallsOffset;
+    const void* lastWalls;
+
+    RecordingChunkHeader chunkHeader;
+    std::string chunk;
+    uint64_t expectedTick;
+
+    RecordingState state;
+    std::vector<int32_t> nowX;
+    std::vector<int32_t> nowY;
+    std::vector<uint64_t> seen;             // serial of the last frame each id was live in
+    uint64_t serial;
+    uint64_t frames;
+
+    // Scratch for the three parts of a delta
+    std::string removed;
+    std::string added;
+    std::string moved;
+
+    void writeChunk(const RecordingChunkHeader& header, const std::string& payload) {
+        std::string bytes;
+        writeChunkHeader(bytes, header);
+        file.write(bytes.data(), bytes.size());
+        file.write(payload.data(), payload.size());
+        file.flush();
+        offset += bytes.size() + payload.size();
+    }
+
+    void flushChunk() {
+        if (chunk.empty()) {
+            return;
+        }
+        chunkHeader.payloadBytes = static_cast<uint32_t>(chunk.size());
+        index.push_back({ chunkHeader.firstTick, chunkHeader.frameCount, offset });
+        writeChunk(chunkHeader, chunk);
+        chunk.clear();
+    }
+
+    void writeWalls() {
+        if (wallCoordinates.empty()) {
+            wallsOffset = 0;
+            return;
+        }
+        std::string payload;
+        ByteWriter writer(payload);
+        writer.writeU32(static_cast<uint32_t>(wallCoordinates.size() / 4));
+        for (float coordinate : wallCoordinates) {
+            writer.writeF32(coordinate);
+        }
+        RecordingChunkHeader header;
+        header.kind = RecordingChunkKind::Walls;
+        header.payloadBytes = static_cast<uint32_t>(payload.size());
+        wallsOffset = offset;
+        writeChunk(header, payload);
+    }
+
+    void encodeFrame(const ServerSnapshot& snapshot, bool keyframe) {
+        size_t idCount = std::max<size_t>(snapshot.idCount, state.size());
+        state.grow(idCount);
+        if (seen.size() < idCount) {
+            nowX.resize(idCount);
+            nowY.resize(idCount);
+            seen.resize(idCount, 0);
+        }
+        ++serial;
+        for (size_t i = 0; i < snapshot.particles.size(); ++i) {
+            uint32_t id = snapshot.ids[i];
+            nowX[id] = quantizePosition(snapshot.particles[i].x);
+            nowY[id] = quantizePosition(snapshot.particles[i].y);
+            seen[id] = serial;
+        }
+
+        ByteWriter out(chunk);
+        out.writeU32(snapshot.serverTimeMs);
+        out.writeVarint(idCount);
+        if (keyframe) {
+            encodeKeyframe(out, idCount);
+        }
+        else {
+            encodeDelta(out, idCount);
+        }
+        out.writeVarint(snapshot.players.size());
+        for (const PlayerState& player : snapshot.players) {
+            out.writeU32(player.id);
+            out.writeF32(player.position.x);
+            out.writeF32(player.position.y);
+        }
+    }
+
+    void encodeKeyframe(ByteWriter& out, size_t idCount) {
+        size_t liveCount = 0;
+        for (size_t id = 0; id < idCount; ++id) {
+            bool now = seen[id] == serial;
+            if (now) {
+                state.dx[id] = state.live[id] ? nowX[id] - state.x[id] : 0;
+                state.dy[id] = state.live[id] ? nowY[id] - state.y[id] : 0;
+                state.x[id] = nowX[id];
+                state.y[id] = nowY[id];
+                ++liveCount;
+            }
+            state.live[id] = now;
+        }
+        out.writeVarint(liveCount);
+        size_t nextId = 0;
+        for (size_t id = 0; id < idCount; ++id) {
+            if (state.live[id]) {
+                out.writeVarint(id - nextId);
+                out.writeVarint(static_cast<uint32_t>(state.x[id]));
+                out.writeVarint(static_cast<uint32_t>(state.y[id]));
+                out.writeSignedVarint(state.dx[id]);
+                out.writeSignedVarint(state.dy[id]);
+                nextId = id + 1;
+            }
+        }
+    }
+
+    void encodeDelta(ByteWriter& out, size_t idCount) {
+        removed.clear();
+        added.clear();
+        moved.clear();
+        ByteWriter removedOut(removed), addedOut(added), movedOut(moved);
+        size_t removedCount = 0, addedCount = 0, movedCount = 0;
+        size_t nextRemoved = 0, nextAdded = 0, unchanged = 0;
+        for (size_t id = 0; id < idCount; ++id) {
+            bool now = seen[id] == serial;
+            if (state.live[id] && !now) {
+                removedOut.writeVarint(id - nextRemoved);
+                nextRemoved = id + 1;
+                ++removedCount;
+                state.live[id] = 0;
+            }
+            else if (!state.live[id] && now) {
+                addedOut.writeVarint(id - nextAdded);
+                addedOut.writeVarint(static_cast<uint32_t>(nowX[id]));
+                addedOut.writeVarint(static_cast<uint32_t>(nowY[id]));
+                nextAdded = id + 1;
+                ++addedCount;
+                state.x[id] = nowX[id];
+                state.y[id] = nowY[id];
+                state.dx[id] = 0;
+                state.dy[id] = 0;
+                state.live[id] = 1;
+            }
+            else if (now) {
+                // Only particles that missed the prediction are written,
+                // each after the number of live ids that did not
+                int32_t missX = nowX[id] - (state.x[id] + state.dx[id]);
+                int32_t missY = nowY[id] - (state.y[id] + state.dy[id]);
+                if (missX != 0 || missY != 0) {
+                    movedOut.writeVarint(unchanged);
+                    movedOut.writeSignedVarint(missX);
+                    movedOut.writeSignedVarint(missY);
+                    unchanged = 0;
+                    ++movedCount;
+                }
+                else {
+                    ++unchanged;
+                }
+                state.dx[id] = nowX[id] - state.x[id];
+                state.dy[id] = nowY[id] - state.y[id];
+                state.x[id] = nowX[id];
+                state.y[id] = nowY[id];
+            }
+        }
+        out.writeVarint(removedCount);
+        chunk += removed;
+        out.writeVarint(addedCount);
+        chunk += added;
+        out.writeVarint(movedCount);
+        chunk += moved;
+    }
+};
+
+// Reads a recording back one chunk at a time, so its size does not matter.
+// Moving forward decodes on from the last frame; moving back or far ahead
+// starts again from the keyframe of the chunk holding the tick.
+class RecordingReader {
+public:
+    RecordingReader() : tickRate(60.0f), loadedChunk(noChunk), loadedWalls(0), decodedTick(0), reader(nullptr, 0), serverTimeMs(0) {}
+
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+
+    // Returns false with a message if the file is not a recording
+    bool open(const std::string& path, std::string& error) {
+        file.open(path, std::ios::binary);
+        if (!file) {
+            error = "cannot open recording " + path;
+            return false;
+        }
+        file.seekg(0, std::ios::end);
+        fileSize = static_cast<uint64_t>(file.tellg());
+        std::string header;
+        if (!readAt(0, recordingFileHeaderSize, header) || std::memcmp(header.data(), recordingFileMagic, sizeof(recordingFileMagic)) != 0) {
+            error = path + " is not a recording";
+            return false;
+        }
+        ByteReader headerReader(header.data() + sizeof(recordingFileMagic), header.size() - sizeof(recordingFileMagic));
+        uint32_t version = headerReader.readU32();
+        tickRate = headerReader.readF32();
+        if (version != recordingFileVersion) {
+            error = "recording version " + std::to_string(version) + " is not supported";
+            return false;
+        }
+        if (!readIndex()) {
+            rebuildIndex();
+        }
+        if (index.empty()) {
+            error = path + " has no complete chunks";
+            return false;
+        }
+        return true;
+    }
+
+    float getTickRate() const {
+        return tickRate;
+    }
+
+    uint64_t firstTick() const {
+        return index.front().firstTick;
+    }
+
+    uint64_t lastTick() const {
+        return index.back().firstTick + index.back().frameCount - 1;
+    }
+
+    // Fills frame with the last recorded tick at or before tick, or the first
+    // one if tick is earlier. Returns false with a message if the file is
+    // damaged.
+    bool readFrame(uint64_t tick, ReplayFrame& frame, std::string& error) {
+        tick = std::max(tick, firstTick());
+        auto next = std::upper_bound(index.begin(), index.end(), tick,
+            [](uint64_t value, const RecordingIndexEntry& entry) { return value < entry.firstTick; });
+        size_t chunkIndex = static_cast<size_t>(next - index.begin()) - 1;
+        const RecordingIndexEntry& entry = index[chunkIndex];
+        uint64_t target = std::min(tick, entry.firstTick + entry.frameCount - 1);
+
+        if (chunkIndex != loadedChunk || target < decodedTick) {
+            if (!loadChunk(chunkIndex, error)) {
+                return false;
+            }
+        }
+        while (decodedTick < target) {
+            if (!decodeFrame(false)) {
+                error = "recording chunk at tick " + std::to_string(entry.firstTick) + " is damaged";
+                loadedChunk = noChunk;
+                return false;
+            }
+            ++decodedTick;
+        }
+
+        frame.tick = decodedTick;
+        frame.serverTimeMs = serverTimeMs;
+        frame.players = players;
+        frame.walls = walls;
+        frame.particles.clear();
+        for (size_t id = 0; id < state.size(); ++id) {
+            if (state.live[id]) {
+                frame.particles.emplace_back(state.x[id] / positionScale, state.y[id] / positionScale);
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t noChunk = static_cast<size_t>(-1);
+
+    std::ifstream file;
+    uint64_t fileSize = 0;
+    float tickRate;
+    std::vector<RecordingIndexEntry> index;
+
+    size_t loadedChunk;
+    std::string payload;
+    uint64_t loadedWalls;
+    std::shared_ptr<const std::vector<sf::VertexArray>> walls;
+    uint64_t decodedTick;
+    ByteReader reader;
+    RecordingState state;
+    uint32_t serverTimeMs;
+    std::vector<PlayerState> players;
+
+    bool readAt(uint64_t position, size_t size, std::string& out) {
+        if (position + size > fileSize) {
+            return false;
+        }
+        out.resize(size);
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(position));
+        file.read(out.data(), static_cast<std::streamsize>(size));
+        return static_cast<bool>(file);
+    }
+
+    bool readIndex() {
+        std::string footer;
+        if (fileSize < recordingFileHeaderSize + recordingFooterSize || !readAt(fileSize - recordingFooterSize, recordingFooterSize, footer)
+            || std::memcmp(footer.data() + 12, recordingIndexMagic, sizeof(recordingIndexMagic)) != 0) {
+            return false;
+        }
+        ByteReader footerReader(footer.data(), footer.size());
+        uint64_t indexOffset = footerReader.readU64();
+        uint32_t count = footerReader.readU32();
+        std::string entries;
+        if (indexOffset + static_cast<uint64_t>(count) * recordingIndexEntrySize + recordingFooterSize != fileSize
+            || !readAt(indexOffset, count * recordingIndexEntrySize, entries)) {
+            return false;
+        }
+        ByteReader entryReader(entries.data(), entries.size());
+        index.resize(count);
+        for (RecordingIndexEntry& entry : index) {
+            entry.firstTick = entryReader.readU64();
+            entry.frameCount = entryReader.readU32();
+            entry.offset = entryReader.readU64();
+        }
+        return entryReader.ok();
+    }
+
+    // For a recording that is still being written or was cut off: walk the
+    // chunk headers and stop at the first incomplete chunk
+    void rebuildIndex() {
+        index.clear();
+        uint64_t position = recordingFileHeaderSize;
+        std::string bytes;
+        RecordingChunkHeader header;
+        while (readAt(position, recordingChunkHeaderSize, bytes) && readChunkHeader(bytes.data(), bytes.size(), header)
+            && position + recordingChunkHeaderSize + header.payloadBytes <= fileSize) {
+            if (header.kind == RecordingChunkKind::Frames && header.frameCount > 0) {
+                index.push_back({ header.firstTick, header.frameCount, position });
+            }
+            position += recordingChunkHeaderSize + header.payloadBytes;
+        }
+    }
+
+    bool loadChunk(size_t chunkIndex, std::string& error) {
+        loadedChunk = noChunk;
+        std::string bytes;
+        RecordingChunkHeader header;
+        uint64_t position = index[chunkIndex].offset;
+        if (!readAt(position, recordingChunkHeaderSize, bytes) || !readChunkHeader(bytes.data(), bytes.size(), header)
+            || !readAt(position + recordingChunkHeaderSize, header.payloadBytes, payload)) {
+            error = "cannot read the recording chunk at tick " + std::to_string(index[chunkIndex].firstTick);
+            return false;
+        }
+        if (!walls || header.wallsOffset != loadedWalls) {
+            if (!loadWalls(header.wallsOffset)) {
+                error = "cannot read the walls of the recording chunk at tick " + std::to_string(index[chunkIndex].firstTick);
+                return false;
+            }
+        }
+        reader = ByteReader(payload.data(), payload.size());
+        if (!decodeFrame(true)) {
+            error = "recording chunk at tick " + std::to_string(index[chunkIndex].firstTick) + " is damaged";
+            return false;
+        }
+        loadedChunk = chunkIndex;
+        decodedTick = header.firstTick;
+        return true;
+    }
+
+    bool loadWalls(uint64_t position) {
+        auto loaded = std::make_shared<std::vector<sf::VertexArray>>();
+        if (position != 0) {
+            std::string bytes;
+            RecordingChunkHeader header;
+            if (!readAt(position, recordingChunkHeaderSize, bytes) || !readChunkHeader(bytes.data(), bytes.size(), header)
+                || header.kind != RecordingChunkKind::Walls || !readAt(position + recordingChunkHeaderSize, header.payloadBytes, bytes)) {
+                return false;
+            }
+            ByteReader wallReader(bytes.data(), bytes.size());
+            uint32_t count = wallReader.readU32();
+            if (static_cast<uint64_t>(count) * 16 != wallReader.remaining()) {
+                return false;
+            }
+            loaded->reserve(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                sf::Vector2f start, end;
+                start.x = wallReader.readF32();
+                start.y = wallReader.readF32();
+                end.x = wallReader.readF32();
+                end.y = wallReader.readF32();
+                loaded->push_back(makeWall(start, end));
+            }
+        }
+        walls = std::move(loaded);
+        loadedWalls = position;
+        return true;
+    }
+
+    // Ids and counts are checked against the id count so a damaged chunk
+    // cannot index out of range
+    bool decodeFrame(bool keyframe) {
+        serverTimeMs = reader.readU32();
+        uint64_t idCount = reader.readVarint();
+        if (!reader.ok() || idCount > reader.remaining() * 8 + state.size()) {
+            return false;
+        }
+        state.grow(static_cast<size_t>(idCount));
+        bool ok = keyframe ? decodeKeyframe(idCount) : decodeDelta(idCount);
+        if (!ok) {
+            return false;
+        }
+
+        uint64_t playerCount = reader.readVarint();
+        if (!reader.ok() || playerCount > reader.remaining() / 12) {
+            return false;
+        }
+        players.resize(static_cast<size_t>(playerCount));
+        for (PlayerState& player : players) {
+            player.id = reader.readU32();
+            player.position.x = reader.readF32();
+            player.position.y = reader.readF32();
+        }
+        return reader.ok();
+    }
+
+    bool decodeKeyframe(uint64_t idCount) {
+        std::fill(state.live.begin(), state.live.end(), 0);
+        uint64_t liveCount = reader.readVarint();
+        uint64_t id = 0;
+        for (uint64_t i = 0; i < liveCount && reader.ok(); ++i, ++id) {
+            id += reader.readVarint();
+            if (id >= idCount) {
+                return false;
+            }
+            state.x[id] = static_cast<int32_t>(reader.readVarint());
+            state.y[id] = static_cast<int32_t>(reader.readVarint());
+            state.dx[id] = static_cast<int32_t>(reader.readSignedVarint());
+            state.dy[id] = static_cast<int32_t>(reader.readSignedVarint());
+            state.live[id] = 1;
+        }
+        return reader.ok();
+    }
+
+    bool decodeDelta(uint64_t idCount) {
+        uint64_t count = reader.readVarint();
+        uint64_t id = 0;
+        for (uint64_t i = 0; i < count && reader.ok(); ++i, ++id) {
+            id += reader.readVarint();
+            if (id >= idCount) {
+                return false;
+            }
+            state.live[id] = 0;
+        }
+
+        count = reader.readVarint();
+        id = 0;
+        for (uint64_t i = 0; i < count && reader.ok(); ++i, ++id) {
+            id += reader.readVarint();
+            if (id >= idCount) {
+                return false;
+            }
+            state.x[id] = static_cast<int32_t>(reader.readVarint());
+            state.y[id] = static_cast<int32_t>(reader.readVarint());
+            state.dx[id] = 0;
+            state.dy[id] = 0;
+            state.live[id] = 2;     // added this tick; not moved below
+        }
+
+        // Every live particle that was not just added moves as predicted,
+        // except those listed, which are off by the given amount
+        count = reader.readVarint();
+        uint64_t listed = 0;
+        uint64_t skip = count > 0 ? reader.readVarint() : 0;
+        int32_t missX = 0, missY = 0;
+        bool haveMiss = count > 0;
+        if (haveMiss) {
+            missX = static_cast<int32_t>(reader.readSignedVarint());
+            missY = static_cast<int32_t>(reader.readSignedVarint());
+        }
+        for (size_t i = 0; i < state.size() && reader.ok(); ++i) {
+            if (state.live[i] == 2) {
+                state.live[i] = 1;
+                continue;
+            }
+            if (!state.live[i]) {
+                continue;
+            }
+            int32_t stepX = state.dx[i];
+            int32_t stepY = state.dy[i];
+            if (haveMiss && skip == 0) {
+                stepX += missX;
+                stepY += missY;
+                if (++listed < count) {
+                    skip = reader.readVarint();
+                    missX = static_cast<int32_t>(reader.readSignedVarint());
+                    missY = static_cast<int32_t>(reader.readSignedVarint());
+                }
+                else {
+                    haveMiss = false;
+                }
+            }
+            else if (haveMiss) {
+                --skip;
+            }
+            state.x[i] += stepX;
+            state.y[i] += stepY;
+            state.dx[i] = stepX;
+            state.dy[i] = stepY;
+        }
+        return reader.ok() && !haveMiss;
+    }
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "AdminCommands.h"
+#include "MappedFile.h"
+#include "World.h"
+
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A layout that can be saved and run again: the canvas size, the walls and
+// the emitters, but not the particles. Scene files come in two formats with
+// the same contents:
+//
+//   binary  a fixed header and arrays of fixed-size records, read in place
+//           from a memory mapping with no parsing; fast for large mazes
+//   text    one command per line in the admin socket's syntax (canvas, wall
+//           and emit) with # comments, for writing and editing by hand
+//
+// loadScene() tells the two apart by the binary magic; saveScene() writes
+// text for paths ending in ".txt" and binary otherwise, so loading one and
+// saving it under the other name converts it.
+struct Scene {
+    float canvasWidth = 1280.0f;
+    float canvasHeight = 720.0f;
+    std::vector<sf::VertexArray> walls;
+    std::vector<Emitter> emitters;
+};
+
+// Binary layout, little-endian, every field 4 bytes: a SceneHeader, then
+// wallCount SceneWallRecords, then emitterCount SceneEmitterRecords, and
+// nothing after. Angles are in radians.
+struct SceneHeader {
+    char magic[4];
+    uint32_t version;
+    float canvasWidth;
+    float canvasHeight;
+    uint32_t wallCount;
+    uint32_t emitterCount;
+};
+
+struct SceneWallRecord {
+    sf::Vector2f start;
+    sf::Vector2f end;
+};
+
+struct SceneEmitterRecord {
+    uint32_t kind;          // ShapeSpec::Kind
+    uint32_t count;
+    float rate;
+    float lifetime;
+    sf::Vector2f start;
+    sf::Vector2f end;
+    float speed;
+    float angle;
+    float endAngle;
+};
+
+static_assert(std::endian::native == std::endian::little, "binary scenes are read in place as little-endian");
+static_assert(sizeof(SceneHeader) == 24 && sizeof(SceneWallRecord) == 16 && sizeof(SceneEmitterRecord) == 44,
+    "scene records must have no padding");
+
+constexpr char sceneFileMagic[4] = { 'P', 'S', 'C', 'N' };
+constexpr uint32_t sceneFileVersion = 1;
+
+// Copies the world's layout. Walls with more than two points are split into
+// segments.
+inline Scene captureScene(const World& world) {
+    Scene scene;
+    scene.canvasWidth = world.canvasWidth;
+    scene.canvasHeight = world.canvasHeight;
+    scene.walls.reserve(world.walls.size());
+    for (const sf::VertexArray& wall : world.walls) {
+        for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+            scene.walls.push_back(makeWall(wall[i].position, wall[i + 1].position));
+        }
+    }
+    scene.emitters = world.emitters;
+    return scene;
+}
+
+// Replaces the world's layout with the scene's, which is left empty. The
+// particles stay where they are.
+inline void applyScene(World& world, Scene& scene) {
+    world.canvasWidth = scene.canvasWidth;
+    world.canvasHeight = scene.canvasHeight;
+    world.walls.swap(scene.walls);
+    world.wallsChanged = true;
+    world.emitters.swap(scene.emitters);
+    scene.walls.clear();
+    scene.emitters.clear();
+}
+
+// Record conversions, shared with checkpoint files
+
+inline void appendWallRecords(const std::vector<sf::VertexArray>& walls, std::vector<SceneWallRecord>& records) {
+    for (const sf::VertexArray& wall : walls) {
+        for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+            records.push_back({ wall[i].position, wall[i + 1].position });
+        }
+    }
+}
+
+// Returns false with a message naming the wall if a record is invalid
+inline bool readWallRecords(const SceneWallRecord* records, size_t count, std::vector<sf::VertexArray>& walls, std::string& error) {
+    walls.clear();
+    walls.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!validPoint(records[i].start) || !validPoint(records[i].end)) {
+            error = "wall " + std::to_string(i) + " has a non-finite coordinate";
+            return false;
+        }
+        walls.push_back(makeWall(records[i].start, records[i].end));
+    }
+    return true;
+}
+
+inline SceneEmitterRecord makeEmitterRecord(const Emitter& emitter) {
+    const ShapeSpec& spec = emitter.spec;
+    return { spec.kind, static_cast<uint32_t>(spec.count), emitter.rate, emitter.lifetime,
+        spec.start, spec.end, spec.speed, spec.angle, spec.endAngle };
+}
+
+// Returns false with a message naming the emitter if the record is invalid
+inline bool readEmitterRecord(const SceneEmitterRecord& record, size_t index, Emitter& emitter, std::string& error) {
+    if (record.kind > ShapeSpec::Ramp) {
+        error = "emitter " + std::to_string(index) + " has an unknown shape";
+        return false;
+    }
+    if (!checkEmitter(record.rate, record.lifetime, record.count, error)) {
+        error = "emitter " + std::to_string(index) + ": " + error;
+        return false;
+    }
+    if (!validPoint(record.start) || !validPoint(record.end) || !std::isfinite(record.speed)
+        || !std::isfinite(record.angle) || !std::isfinite(record.endAngle)) {
+        error = "emitter " + std::to_string(index) + " has a non-finite coordinate";
+        return false;
+    }
+    ShapeSpec spec{ static_cast<ShapeSpec::Kind>(record.kind), record.count, record.start, record.end, record.speed, record.angle, record.endAngle };
+    emitter = makeEmitter(spec, record.rate, record.lifetime);
+    return true;
+}
+
+inline bool isBinaryScene(const char* data, size_t size) {
+    return size >= sizeof(sceneFileMagic) && std::memcmp(data, sceneFileMagic, sizeof(sceneFileMagic)) == 0;
+}
+
+inline bool readBinaryScene(const char* data, size_t size, Scene& scene, std::string& error) {
+    if (size < sizeof(SceneHeader)) {
+        error = "binary scene is too short";
+        return false;
+    }
+    SceneHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != sceneFileVersion) {
+        error = "binary scene version " + std::to_string(header.version) + " is not supported";
+        return false;
+    }
+    uint64_t expected = sizeof(SceneHeader) + static_cast<uint64_t>(header.wallCount) * sizeof(SceneWallRecord)
+        + static_cast<uint64_t>(header.emitterCount) * sizeof(SceneEmitterRecord);
+    if (expected != size) {
+        error = "binary scene is " + std::to_string(size) + " bytes but its header describes " + std::to_string(expected);
+        return false;
+    }
+    if (!validCanvasSize(header.canvasWidth, header.canvasHeight)) {
+        error = "binary scene has no valid canvas size";
+        return false;
+    }
+    scene.canvasWidth = header.canvasWidth;
+    scene.canvasHeight = header.canvasHeight;
+
+    // The records are used where they lie in the mapping
+    const SceneWallRecord* walls = reinterpret_cast<const SceneWallRecord*>(data + sizeof(SceneHeader));
+    if (!readWallRecords(walls, header.wallCount, scene.walls, error)) {
+        return false;
+    }
+
+    const SceneEmitterRecord* emitters = reinterpret_cast<const SceneEmitterRecord*>(walls + header.wallCount);
+    scene.emitters.resize(header.emitterCount);
+    for (uint32_t i = 0; i < header.emitterCount; ++i) {
+        if (!readEmitterRecord(emitters[i], i, scene.emitters[i], error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the lines as commands on a scratch world and keeps its layout
+inline bool readTextScene(const char* data, size_t size, Scene& scene, std::string& error) {
+    World scratch;
+    std::istringstream in(size > 0 ? std::string(data, size) : std::string());
+    std::string line;
+    for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        std::istringstream words(line);
+        std::string verb;
+        words >> verb;
+        WorldCommand command;
+        if (verb != "canvas" && verb != "wall" && verb != "emit") {
+            error = "line " + std::to_string(lineNumber) + ": a scene holds only canvas, wall and emit lines";
+            return false;
+        }
+        if (!parseWorldCommand(line, command, error)) {
+            error = "line " + std::to_string(lineNumber) + ": " + error;
+            return false;
+        }
+        command(scratch);
+    }
+    scene.canvasWidth = scratch.canvasWidth;
+    scene.canvasHeight = scratch.canvasHeight;
+    scene.walls = std::move(scratch.walls);
+    scene.emitters = std::move(scratch.emitters);
+    return true;
+}
+
+// Reads a scene in either format. Returns false with a message if the file
+// cannot be read or is not a valid scene.
+inline bool loadScene(const std::string& path, Scene& scene, std::string& error) {
+    MappedFile file;
+    if (!file.open(path)) {
+        error = "cannot open scene " + path;
+        return false;
+    }
+    if (isBinaryScene(file.data(), file.size())) {
+        return readBinaryScene(file.data(), file.size(), scene, error);
+    }
+    return readTextScene(file.data(), file.size(), scene, error);
+}
+
+inline bool isTextScenePath(const std::string& path) {
+    return path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
+}
+
+inline void writeBinaryScene(std::ostream& out, const Scene& scene) {
+    SceneHeader header;
+    std::memcpy(header.magic, sceneFileMagic, sizeof(sceneFileMagic));
+    header.version = sceneFileVersion;
+    header.canvasWidth = scene.canvasWidth;
+    header.canvasHeight = scene.canvasHeight;
+
+    std::vector<SceneWallRecord> walls;
+    walls.reserve(scene.walls.size());
+    appendWallRecords(scene.walls, walls);
+    std::vector<SceneEmitterRecord> emitters;
+    emitters.reserve(scene.emitters.size());
+    for (const Emitter& emitter : scene.emitters) {
+        emitters.push_back(makeEmitterRecord(emitter));
+    }
+    header.wallCount = static_cast<uint32_t>(walls.size());
+    header.emitterCount = static_cast<uint32_t>(emitters.size());
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(walls.data()), walls.size() * sizeof(SceneWallRecord));
+    out.write(reinterpret_cast<const char*>(emitters.data()), emitters.size() * sizeof(SceneEmitterRecord));
+}
+
+inline void writeTextScene(std::ostream& out, const Scene& scene) {
+    const float degrees = 180.0f / 3.14159265358979323846f;
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << "# Particle simulator scene\n";
+    out << "canvas " << scene.canvasWidth << " " << scene.canvasHeight << "\n";
+    for (const sf::VertexArray& wall : scene.walls) {
+        for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+            sf::Vector2f start = wall[i].position;
+            sf::Vector2f end = wall[i + 1].position;
+            out << "wall " << start.x << " " << start.y << " " << end.x << " " << end.y << "\n";
+        }
+    }
+    for (const Emitter& emitter : scene.emitters) {
+        const ShapeSpec& spec = emitter.spec;
+        out << "emit " << emitter.rate << " " << emitter.lifetime << " ";
+        switch (spec.kind) {
+        case ShapeSpec::Fan:
+            out << "fan " << spec.count << " " << spec.start.x << " " << spec.start.y << " "
+                << spec.angle * degrees << " " << spec.endAngle * degrees << " " << spec.speed << "\n";
+            break;
+        case ShapeSpec::Ramp:
+            out << "ramp " << spec.count << " " << spec.start.x << " " << spec.start.y << " " << spec.angle * degrees << "\n";
+            break;
+        default:
+            out << "line " << spec.count << " " << spec.start.x << " " << spec.start.y << " " << spec.end.x << " " << spec.end.y << " "
+                << spec.speed << " " << spec.angle * degrees << "\n";
+            break;
+        }
+    }
+}
+
+inline bool saveScene(const std::string& path, const Scene& scene, std::string& error) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        error = "cannot write scene " + path;
+        return false;
+    }
+    if (isTextScenePath(path)) {
+        writeTextScene(out, scene);
+    }
+    else {
+        writeBinaryScene(out, scene);
+    }
+    out.close();
+    if (!out) {
+        error = "cannot write scene " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/NetReactor.h"
+#include "../Common/Protocol.h"
+#include "../Common/UdpTransport.h"
+#include "ParticlePriority.h"
+#include "PlayerRegistry.h"
+#include "SharedPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Everything the clients need from one server tick. The tick fills it in,
+// publishes it and only refills it once every reader has dropped it, so
+// sender threads read it without taking any lock.
+struct ServerSnapshot {
+    uint64_t tick = 0;
+    uint32_t serverTimeMs = 0;
+    uint32_t sceneVersion = 0;              // changes whenever the particles are replaced
+    std::vector<sf::Vector2f> particles;    // the live particles, in storage order
+    std::vector<sf::Vector2f> velocities;   // only sent in per-client updates
+    std::vector<uint32_t> ids;              // each particle's id in the ParticlePool
+    uint32_t idCount = 0;
+    std::vector<ClientRef> clients;         // players first, in the same order as players
+    std::vector<PlayerState> players;
+    std::vector<uint64_t> acknowledgedTicks;    // each player's newest applied update
+    // Drawn by the attached viewer and sent to each client once per
+    // version; shared between snapshots until the walls change
+    std::shared_ptr<const std::vector<sf::VertexArray>> walls;
+    uint32_t wallsVersion = 0;              // changes with every wall edit
+};
+
+// Network send stage. The tick calls publish() and returns immediately.
+// Sender threads wake at the snapshot rate and queue the newest snapshot for
+// their share of the clients on the reactor, whose bounded per-client queues
+// keep the newest snapshot and drop stale ones. Each tick is encoded exactly
+// once, by whichever sender thread gets there first, into an immutable buffer
+// that every client's queue then shares; adding a client costs a reference
+// and a 4-byte header, not another encode and copy. A slow or
+// stalled client therefore never costs the frame anything. UDP clients get
+// their snapshots on the unreliable channel, where a lost one is simply
+// replaced by the next.
+//
+// With a client budget or an error tolerance set, each player instead gets
+// its own update: only the particles whose dead-reckoned position on that
+// client is off by more than the tolerance, at most the budget's worth of
+// bytes of them, ranked by ParticlePriority. Spectators such as relays always
+// get the full shared snapshot.
+//
+// The walls go on the reliable channel instead, to each client that has not
+// had the snapshot's version of them: once when it joins and again after
+// every wall edit.
+class SendStage {
+public:
+    SendStage(NetReactor& reactor, UdpTransport* udp, size_t numThreads, float snapshotRate)
+        : reactor(reactor), udp(udp), snapshotRate(snapshotRate), stopping(false) {
+        numThreads = std::max<size_t>(1, numThreads);
+        for (size_t i = 0; i < numThreads; ++i) {
+            threads.emplace_back(&SendStage::run, this, i, numThreads);
+        }
+    }
+
+    ~SendStage() {
+        {
+            std::lock_guard<std::mutex> lock(latestMutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    SendStage(const SendStage&) = delete;
+    SendStage& operator=(const SendStage&) = delete;
+
+    void publish(std::shared_ptr<const ServerSnapshot> snapshot) {
+        std::lock_guard<std::mutex> lock(latestMutex);
+        latest = std::move(snapshot);
+    }
+
+    // Snapshots per second, independent of the frame rate
+    void setSnapshotRate(float hz) {
+        snapshotRate = std::max(1.0f, hz);
+    }
+
+    float getSnapshotRate() const {
+        return snapshotRate;
+    }
+
+    // Bytes per snapshot for each player; 0 sends everything to everyone
+    void setClientBudget(size_t bytes) {
+        clientBudget = bytes;
+    }
+
+    size_t getClientBudget() const {
+        return clientBudget;
+    }
+
+    // Pixels a player's extrapolated particle may drift before it is resent;
+    // 0 resends every particle every snapshot
+    void setErrorTolerance(float pixels) {
+        errorTolerance = std::max(0.0f, pixels);
+    }
+
+    float getErrorTolerance() const {
+        return errorTolerance;
+    }
+
+    // Total time spent encoding snapshots, and how many were encoded. Shared
+    // snapshots count once however many clients they go to; per-client
+    // updates count once per client.
+    double encodeSeconds() const {
+        return encodeNanoseconds.load() / 1e9;
+    }
+
+    uint64_t encodeCount() const {
+        return encodedSnapshots.load();
+    }
+
+private:
+    NetReactor& reactor;
+    UdpTransport* udp;
+    std::atomic<float> snapshotRate;
+    std::atomic<size_t> clientBudget{ 0 };
+    std::atomic<float> errorTolerance{ 0.0f };
+    bool stopping;
+    std::mutex latestMutex;
+    std::condition_variable condition;
+    std::shared_ptr<const ServerSnapshot> latest;
+    std::vector<std::thread> threads;
+
+    std::mutex encodeMutex;
+    uint64_t encodedTick = 0;
+    NetReactor::SharedPayload encoded;
+    // Messages are encoded into strings taken back from the clients' queues
+    // once sent: shared snapshots into these, per-client updates into a pool
+    // on each sender thread
+    static constexpr size_t maxEncodeBuffers = 8;
+    static constexpr size_t maxClientBuffers = 64;
+    SharedPool<std::string> encodeBuffers{ maxEncodeBuffers };
+    std::atomic<uint64_t> encodeNanoseconds{ 0 };
+    std::atomic<uint64_t> encodedSnapshots{ 0 };
+
+    std::mutex prioritiesMutex;
+    std::unordered_map<ClientRef, std::shared_ptr<ParticlePriority>, ClientRefHash> priorities;
+
+    std::mutex wallsMutex;
+    uint32_t encodedWallsVersion = 0;
+    std::vector<std::string> encodedWalls;
+    std::unordered_map<ClientRef, uint32_t, ClientRefHash> wallsSent;   // the version each client has
+
+    // The encoded form of snapshot, shared by all sender threads. The first
+    // thread to ask encodes it; the rest wait for that one instead of
+    // repeating the work.
+    NetReactor::SharedPayload encodedPayload(const ServerSnapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(encodeMutex);
+        if (!encoded || encodedTick != snapshot.tick) {
+            auto start = std::chrono::steady_clock::now();
+            std::shared_ptr<std::string> buffer = encodeBuffers.acquire();
+            encodeSnapshot(snapshot.tick, snapshot.serverTimeMs, snapshot.players, snapshot.particles, snapshot.ids, *buffer);
+            encoded = std::move(buffer);
+            encodedTick = snapshot.tick;
+            encodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            ++encodedSnapshots;
+        }
+        return encoded;
+    }
+
+    std::shared_ptr<ParticlePriority> prioritiesFor(const ServerSnapshot& snapshot, size_t playerIndex) {
+        std::lock_guard<std::mutex> lock(prioritiesMutex);
+        std::shared_ptr<ParticlePriority>& entry = priorities[snapshot.clients[playerIndex]];
+        if (!entry) {
+            entry = std::make_shared<ParticlePriority>();
+        }
+        return entry;
+    }
+
+    // Forget players that have left. There are more entries than players
+    // only when some of them are stale.
+    void prunePriorities(const ServerSnapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(prioritiesMutex);
+        if (priorities.size() <= snapshot.players.size()) {
+            return;
+        }
+        std::unordered_set<ClientRef, ClientRefHash> current(snapshot.clients.begin(), snapshot.clients.begin() + snapshot.players.size());
+        for (auto it = priorities.begin(); it != priorities.end();) {
+            it = current.count(it->first) ? std::next(it) : priorities.erase(it);
+        }
+    }
+
+    // Sends the snapshot's walls to a client that does not have them yet.
+    // They are encoded once per version, by whichever thread needs them first.
+    void sendWalls(const ServerSnapshot& snapshot, const ClientRef& client) {
+        std::lock_guard<std::mutex> lock(wallsMutex);
+        uint32_t& sent = wallsSent[client];
+        if (sent == snapshot.wallsVersion) {
+            return;
+        }
+        if (encodedWallsVersion != snapshot.wallsVersion || encodedWalls.empty()) {
+            std::vector<sf::Vector2f> ends;
+            if (snapshot.walls) {
+                for (const sf::VertexArray& wall : *snapshot.walls) {
+                    for (size_t i = 0; i + 1 < wall.getVertexCount(); ++i) {
+                        ends.push_back(wall[i].position);
+                        ends.push_back(wall[i + 1].position);
+                    }
+                }
+            }
+            encodedWalls = encodeWalls(snapshot.wallsVersion, ends);
+            encodedWallsVersion = snapshot.wallsVersion;
+        }
+        for (const std::string& message : encodedWalls) {
+            if (client.transport == ClientTransport::Udp) {
+                if (udp) {
+                    udp->sendReliable(client.id, message);
+                }
+            }
+            else {
+                reactor.send(client.id, message);
+            }
+        }
+        sent = snapshot.wallsVersion;
+    }
+
+    // Forget clients that have left, as prunePriorities() does
+    void pruneWallsSent(const ServerSnapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(wallsMutex);
+        if (wallsSent.size() <= snapshot.clients.size()) {
+            return;
+        }
+        std::unordered_set<ClientRef, ClientRefHash> current(snapshot.clients.begin(), snapshot.clients.end());
+        for (auto it = wallsSent.begin(); it != wallsSent.end();) {
+            it = current.count(it->first) ? std::next(it) : wallsSent.erase(it);
+        }
+    }
+
+    // One player's update: the particles it needs, cut down to budget bytes
+    // unless the budget is 0
+    NetReactor::SharedPayload clientPayload(const ServerSnapshot& snapshot, size_t playerIndex, size_t budget, float tolerance,
+        SharedPool<std::string>& buffers) {
+        std::shared_ptr<ParticlePriority> state = prioritiesFor(snapshot, playerIndex);
+        std::lock_guard<std::mutex> lock(state->mutex);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t header = particleUpdateHeaderSize(snapshot.players.size());
+        size_t maxEntries = snapshot.particles.size();
+        if (budget > 0) {
+            maxEntries = budget > header ? (budget - header) / particleUpdateEntrySize : 0;
+        }
+        thread_local std::vector<uint32_t> chosen;
+        thread_local std::vector<uint32_t> removed;
+        state->select(snapshot.sceneVersion, snapshot.tick, snapshot.serverTimeMs, snapshot.acknowledgedTicks[playerIndex], snapshot.idCount,
+            snapshot.ids, snapshot.particles, snapshot.velocities, snapshot.players[playerIndex].position, tolerance, maxEntries, chosen, removed);
+        std::shared_ptr<std::string> payload = buffers.acquire();
+        encodeParticleUpdate(snapshot.tick, snapshot.serverTimeMs, snapshot.sceneVersion, snapshot.idCount, snapshot.players,
+            chosen, snapshot.ids, snapshot.particles, snapshot.velocities, removed, *payload);
+        encodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        ++encodedSnapshots;
+        return payload;
+    }
+
+    void run(size_t threadIndex, size_t numThreads) {
+        using clock = std::chrono::steady_clock;
+        auto nextSend = clock::now();
+        bool sentAny = false;
+        uint64_t lastTick = 0;
+        SharedPool<std::string> clientBuffers(maxClientBuffers);
+
+        while (true) {
+            std::shared_ptr<const ServerSnapshot> snapshot;
+            {
+                std::unique_lock<std::mutex> lock(latestMutex);
+                if (condition.wait_until(lock, nextSend, [this] { return stopping; })) {
+                    return;
+                }
+                snapshot = latest;
+            }
+
+            // Schedule the next wakeup without trying to catch up on missed ones
+            auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(1.0f / snapshotRate.load()));
+            nextSend = std::max(nextSend + period, clock::now());
+
+            if (!snapshot || (sentAny && snapshot->tick == lastTick)) {
+                continue;
+            }
+            sentAny = true;
+            lastTick = snapshot->tick;
+
+            size_t budget = clientBudget.load();
+            float tolerance = errorTolerance.load();
+            bool perClient = budget > 0 || tolerance > 0.0f;
+            if (perClient && threadIndex == 0) {
+                prunePriorities(*snapshot);
+            }
+            if (threadIndex == 0) {
+                pruneWallsSent(*snapshot);
+            }
+
+            // Otherwise the same message goes to every client and each
+            // one skips itself. It is only encoded if some client needs it.
+            NetReactor::SharedPayload shared;
+
+            // Each sender thread serves every numThreads-th client
+            for (size_t i = threadIndex; i < snapshot->clients.size(); i += numThreads) {
+                const ClientRef& client = snapshot->clients[i];
+                sendWalls(*snapshot, client);
+                NetReactor::SharedPayload payload;
+                if (perClient && i < snapshot->players.size()) {
+                    payload = clientPayload(*snapshot, i, budget, tolerance, clientBuffers);
+                }
+                else {
+                    if (!shared) {
+                        shared = encodedPayload(*snapshot);
+                    }
+                    payload = shared;
+                }
+                if (client.transport == ClientTransport::Udp) {
+                    if (udp) {
+                        udp->sendUnreliable(client.id, payload);
+                    }
+                }
+                else {
+                    reactor.send(client.id, payload, NetReactor::SendPolicy::Latest);
+                }
+            }
+        }
+    }
+};
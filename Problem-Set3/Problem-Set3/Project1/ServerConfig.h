@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Server settings, read from a config file of "key = value" lines. Blank
+// lines and anything after a '#' are ignored. Command-line options override
+// the file.
+//
+//     headless = true
+//     tcp_port = 55555
+//     udp_port = 55556
+//     admin_port = 55557        # 0 turns the admin socket off
+//     tick_rate = 60
+//     snapshot_rate = 20
+//     send_threads = 2
+//     compact_fraction = 0.25   # compact particle storage once this much is dead, 0 = only past 3/4
+//     client_budget = 0         # bytes per snapshot for each player, 0 = no limit
+//     error_tolerance = 0       # px a player's particle may drift before it is resent, 0 = off
+//     canvas_width = 1280
+//     canvas_height = 720
+//     udp_loss = 0              # percent, for testing
+//     udp_latency = 0           # ms
+//     udp_jitter = 0            # ms
+//     checkpoint_file = server.ckpt # restored at startup if it exists
+//     checkpoint_interval = 0   # seconds between automatic checkpoints, 0 = off
+//     record_file = run.rec     # record every tick from startup for replay
+//     exec = wall 200 100 200 600   # admin command run at startup, repeatable
+//
+// The exec lines only run when no checkpoint was restored.
+struct ServerConfig {
+    bool headless = false;
+    uint16_t tcpPort = 55555;
+    uint16_t udpPort = 55556;
+    uint16_t adminPort = 0;
+    float tickRate = 60.0f;
+    float snapshotRate = 20.0f;
+    size_t sendThreads = 2;
+    float compactFraction = 0.25f;
+    size_t clientBudget = 0;
+    float errorTolerance = 0.0f;
+    float canvasWidth = 1280.0f;
+    float canvasHeight = 720.0f;
+    float udpLoss = 0.0f;
+    int udpLatency = 0;
+    int udpJitter = 0;
+    std::string checkpointFile;
+    float checkpointInterval = 0.0f;
+    std::string recordFile;
+    std::vector<std::string> commands;
+};
+
+inline std::string trimmed(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(first, last - first + 1);
+}
+
+// Returns false with a message naming the line if the file cannot be read or
+// has a bad line; config is left partly filled in that case
+inline bool loadServerConfig(const std::string& path, ServerConfig& config, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        line = trimmed(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            error = path + ":" + std::to_string(lineNumber) + ": expected key = value";
+            return false;
+        }
+        std::string key = trimmed(line.substr(0, equals));
+        std::string value = trimmed(line.substr(equals + 1));
+
+        try {
+            if (key == "headless") {
+                config.headless = value == "true" || value == "1" || value == "yes";
+            }
+            else if (key == "tcp_port") {
+                config.tcpPort = static_cast<uint16_t>(std::stoul(value));
+            }
+            else if (key == "udp_port") {
+                config.udpPort = static_cast<uint16_t>(std::stoul(value));
+            }
+            else if (key == "admin_port") {
+                config.adminPort = static_cast<uint16_t>(std::stoul(value));
+            }
+            else if (key == "tick_rate") {
+                config.tickRate = std::stof(value);
+            }
+            else if (key == "snapshot_rate") {
+                config.snapshotRate = std::stof(value);
+            }
+            else if (key == "send_threads") {
+                config.sendThreads = std::stoul(value);
+            }
+            else if (key == "compact_fraction") {
+                config.compactFraction = std::stof(value);
+            }
+            else if (key == "client_budget") {
+                config.clientBudget = std::stoul(value);
+            }
+            else if (key == "error_tolerance") {
+                config.errorTolerance = std::stof(value);
+            }
+            else if (key == "canvas_width") {
+                config.canvasWidth = std::stof(value);
+            }
+            else if (key == "canvas_height") {
+                config.canvasHeight = std::stof(value);
+            }
+            else if (key == "udp_loss") {
+                config.udpLoss = std::stof(value);
+            }
+            else if (key == "udp_latency") {
+                config.udpLatency = std::stoi(value);
+            }
+            else if (key == "udp_jitter") {
+                config.udpJitter = std::stoi(value);
+            }
+            else if (key == "checkpoint_file") {
+                config.checkpointFile = value;
+            }
+            else if (key == "checkpoint_interval") {
+                config.checkpointInterval = std::stof(value);
+            }
+            else if (key == "record_file") {
+                config.recordFile = value;
+            }
+            else if (key == "exec") {
+                config.commands.push_back(value);
+            }
+            else {
+                error = path + ":" + std::to_string(lineNumber) + ": unknown key '" + key + "'";
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            error = path + ":" + std::to_string(lineNumber) + ": bad value for " + key;
+            return false;
+        }
+    }
+    return true;
+}
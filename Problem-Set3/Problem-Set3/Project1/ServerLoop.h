@@ -0,0 +1,445 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/AllocationCounter.h"
+#include "../Common/NetReactor.h"
+#include "../Common/PlayerMovement.h"
+#include "../Common/UdpTransport.h"
+#include "AdminCommands.h"
+#include "Checkpoint.h"
+#include "ParticleSpawner.h"
+#include "PlayerRegistry.h"
+#include "Recorder.h"
+#include "SceneFile.h"
+#include "SendStage.h"
+#include "ServerConfig.h"
+#include "SharedPool.h"
+#include "ThreadPool.h"
+#include "World.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// The authoritative simulation. It ticks on its own thread at a fixed rate
+// whether or not a window is open: apply queued scene commands, move every
+// player by its input, advance the particles and run the emitters, then
+// publish a snapshot to the send stage and to whoever is viewing.
+//
+// The World belongs to the tick thread. The viewer and the admin socket
+// change it with submit(), which runs the command at the start of the next
+// tick, and read it through latest(). New particles are built on a worker
+// pool by spawn() and swapped in by a command once they are all launched.
+class ServerLoop {
+public:
+    ServerLoop(PlayerRegistry& players, NetReactor& reactor, UdpTransport* udp, const ServerConfig& config)
+        : players(players), sendStage(reactor, udp, config.sendThreads, config.snapshotRate),
+          tickRate(std::max(1.0f, config.tickRate)), compactFraction(config.compactFraction),
+          checkpointFile(config.checkpointFile), checkpointInterval(config.checkpointInterval), running(false),
+          ticks(0), particles(0), walls(0), emitters(0), width(config.canvasWidth), height(config.canvasHeight), tickSeconds(0.0),
+          checkpointWriting(false), isRecording(false),
+          workers(std::max(1u, std::thread::hardware_concurrency())), spawner(workers, workers.size() * 4) {
+        world.canvasWidth = config.canvasWidth;
+        world.canvasHeight = config.canvasHeight;
+        sendStage.setClientBudget(config.clientBudget);
+        sendStage.setErrorTolerance(config.errorTolerance);
+    }
+
+    ~ServerLoop() {
+        stop();
+    }
+
+    ServerLoop(const ServerLoop&) = delete;
+    ServerLoop& operator=(const ServerLoop&) = delete;
+
+    void start() {
+        if (running.exchange(true)) {
+            return;
+        }
+        thread = std::thread(&ServerLoop::run, this);
+    }
+
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    // Safe from any thread
+    void submit(WorldCommand command) {
+        std::lock_guard<std::mutex> lock(commandsMutex);
+        commands.push_back(std::move(command));
+    }
+
+    // Replaces the particles with count new ones launched by shape, built in
+    // the background. Returns false while an earlier spawn is still running.
+    bool spawn(size_t count, SpawnShape shape) {
+        return spawner.start(count, std::move(shape), [this](std::vector<Particle>& built) {
+            auto ready = std::make_shared<std::vector<Particle>>(std::move(built));
+            submit([ready](World& world) { world.particles.replace(*ready); });
+        });
+    }
+
+    // Replaces the scene and the particles together, in the tick the spawn is
+    // ready, so the new walls never run without their particles. Returns
+    // false, changing nothing, while an earlier spawn is still running.
+    bool spawnScene(Scene scene, size_t count, SpawnShape shape) {
+        auto loaded = std::make_shared<Scene>(std::move(scene));
+        return spawner.start(count, std::move(shape), [this, loaded](std::vector<Particle>& built) {
+            auto ready = std::make_shared<std::vector<Particle>>(std::move(built));
+            submit([loaded, ready](World& world) {
+                applyScene(world, *loaded);
+                world.particles.replace(*ready);
+            });
+        });
+    }
+
+    bool spawning() const {
+        return spawner.busy();
+    }
+
+    float spawnProgress() const {
+        return spawner.progress();
+    }
+
+    // Writes the current walls, emitters and canvas size to a scene file on
+    // the worker pool. Failures are reported on stderr.
+    void saveScene(const std::string& path) {
+        submit([this, path](World& world) {
+            auto scene = std::make_shared<Scene>(captureScene(world));
+            workers.enqueue([scene, path] {
+                std::string error;
+                if (!::saveScene(path, *scene, error)) {
+                    std::cerr << error << std::endl;
+                }
+                else {
+                    std::cout << "Saved " << scene->walls.size() << " walls and " << scene->emitters.size() << " emitters to " << path << std::endl;
+                }
+            });
+        });
+    }
+
+    // Replaces the walls, emitters and canvas size at the next tick
+    void loadScene(Scene scene) {
+        auto loaded = std::make_shared<Scene>(std::move(scene));
+        submit([loaded](World& world) { applyScene(world, *loaded); });
+    }
+
+    // Copies the whole state at the next tick and writes it to path on the
+    // worker pool. Skipped, with a message, while the previous checkpoint is
+    // still being written.
+    void checkpoint(const std::string& path) {
+        submit([this, path](World&) { writeCheckpoint(path); });
+    }
+
+    // Records every tick from the next one on, replacing any recording
+    // already running. Returns false with a message if the file cannot be
+    // created.
+    bool startRecording(const std::string& path, std::string& error) {
+        auto started = std::make_shared<Recorder>();
+        if (!started->start(path, tickRate, error)) {
+            return false;
+        }
+        isRecording = true;
+        submit([this, started](World&) {
+            finishRecording();
+            recorder = started;
+        });
+        return true;
+    }
+
+    void stopRecording() {
+        isRecording = false;
+        submit([this](World&) { finishRecording(); });
+    }
+
+    bool recording() const {
+        return isRecording.load();
+    }
+
+    // Where automatic checkpoints go, empty if none is configured
+    const std::string& getCheckpointFile() const {
+        return checkpointFile;
+    }
+
+    // Replaces the whole state at the next tick. The tick counter only moves
+    // forward, since clients drop snapshots older than ones they have seen.
+    void restore(Checkpoint checkpoint) {
+        auto restored = std::make_shared<Checkpoint>(std::move(checkpoint));
+        submit([this, restored](World& world) {
+            applyScene(world, restored->scene);
+            world.particles.replace(restored->particles);
+            ticks = std::max(ticks.load(), restored->tick);
+        });
+    }
+
+    // The snapshot from the most recent tick, or null before the first one
+    std::shared_ptr<const ServerSnapshot> latest() const {
+        std::lock_guard<std::mutex> lock(latestMutex);
+        return latestSnapshot;
+    }
+
+    SendStage& sends() {
+        return sendStage;
+    }
+
+    // As of the last tick; a scene can change it
+    float canvasWidth() const {
+        return width.load();
+    }
+
+    float canvasHeight() const {
+        return height.load();
+    }
+
+    float getTickRate() const {
+        return tickRate;
+    }
+
+    uint64_t tickCount() const {
+        return ticks.load();
+    }
+
+    // Live particles, not counting dead ones waiting for compaction
+    size_t particleCount() const {
+        return particles.load();
+    }
+
+    size_t wallCount() const {
+        return walls.load();
+    }
+
+    size_t emitterCount() const {
+        return emitters.load();
+    }
+
+    // How long the last tick took to run, not counting the wait for the next
+    double lastTickMilliseconds() const {
+        return tickSeconds.load() * 1000.0;
+    }
+
+    // Heap allocations the tick thread made in its last tick; 0 once it is
+    // running steadily. Always 0 unless countingAllocations.
+    uint64_t lastTickAllocations() const {
+        return tickAllocations.load();
+    }
+
+    // Heap allocations in every tick so far that ran no command, compaction
+    // or recording; should stop rising once the scene is running
+    uint64_t steadyTickAllocations() const {
+        return steadyAllocations.load();
+    }
+
+private:
+    PlayerRegistry& players;
+    SendStage sendStage;
+    const float tickRate;
+    const float compactFraction;
+    const std::string checkpointFile;
+    const float checkpointInterval;
+    std::atomic<bool> running;
+    std::thread thread;
+    World world;
+
+    std::mutex commandsMutex;
+    std::vector<WorldCommand> commands;
+
+    mutable std::mutex latestMutex;
+    std::shared_ptr<const ServerSnapshot> latestSnapshot;
+
+    std::atomic<uint64_t> ticks;
+    std::atomic<size_t> particles;
+    std::atomic<size_t> walls;
+    std::atomic<size_t> emitters;
+    std::atomic<float> width;
+    std::atomic<float> height;
+    std::atomic<double> tickSeconds;
+    std::atomic<uint64_t> tickAllocations{ 0 };
+    std::atomic<uint64_t> steadyAllocations{ 0 };
+    std::atomic<bool> checkpointWriting;
+    // Kept between checkpoints so copying into it does not allocate
+    std::shared_ptr<Checkpoint> checkpointState;
+    // Owned by the tick thread
+    std::shared_ptr<Recorder> recorder;
+    std::atomic<bool> isRecording;
+
+    // Fewer dead particles than this are cheaper to skip than to compact
+    static constexpr size_t minCompactHoles = 4096;
+    // Compacted at this share of holes even with compact_fraction 0
+    static constexpr float maxHoleFraction = 0.75f;
+
+    // Snapshots still held by the viewer, the senders or the recorder, plus
+    // one to fill; a recorder falling behind can hold more, which are then
+    // allocated as needed
+    static constexpr size_t maxPooledSnapshots = 8;
+
+    // Last, so a running spawn or checkpoint finishes while the rest of the
+    // loop still exists
+    ThreadPool workers;
+    ParticleSpawner spawner;
+
+    // On the tick thread. Closing the file waits for the recorder to catch
+    // up, so that happens on the worker pool.
+    void finishRecording() {
+        if (recorder) {
+            std::shared_ptr<Recorder> finished = std::move(recorder);
+            workers.enqueue([finished] { finished->stop(); });
+        }
+    }
+
+    // On the tick thread. The copy is the only part that holds up the tick.
+    void writeCheckpoint(const std::string& path) {
+        if (checkpointWriting.exchange(true)) {
+            std::cerr << "Checkpoint to " << path << " skipped; the last one is still being written" << std::endl;
+            return;
+        }
+        if (!checkpointState) {
+            checkpointState = std::make_shared<Checkpoint>();
+        }
+        std::shared_ptr<Checkpoint> state = checkpointState;
+        state->tick = ticks.load();
+        state->scene = captureScene(world);
+        state->particles.assign(world.particles.storage().begin(), world.particles.storage().end());
+        workers.enqueue([this, state, path] {
+            auto start = std::chrono::steady_clock::now();
+            std::string error;
+            if (!saveCheckpoint(path, *state, error)) {
+                std::cerr << error << std::endl;
+            }
+            else {
+                double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                std::cout << "Checkpoint of tick " << state->tick << " written to " << path << " in " << milliseconds << " ms" << std::endl;
+            }
+            checkpointWriting = false;
+        });
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        const float deltaTime = 1.0f / tickRate;
+        const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(deltaTime));
+        const auto startTime = clock::now();
+        auto nextTick = startTime;
+        const auto checkpointPeriod = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(checkpointInterval));
+        auto nextCheckpoint = startTime + checkpointPeriod;
+        auto sharedWalls = std::make_shared<const std::vector<sf::VertexArray>>();
+        uint32_t wallsVersion = 0;
+        std::vector<WorldCommand> pending;
+        // Each tick's snapshot reuses the buffers of one nobody reads any more
+        SharedPool<ServerSnapshot> snapshots(maxPooledSnapshots);
+        AllocationLap allocations;
+
+        while (running) {
+            auto tickStart = clock::now();
+
+            {
+                std::lock_guard<std::mutex> lock(commandsMutex);
+                pending.swap(commands);
+            }
+            for (WorldCommand& command : pending) {
+                command(world);
+            }
+            // Only a tick that runs no command, compaction or recording is
+            // expected not to allocate
+            bool steady = pending.empty() && !recorder;
+            pending.clear();
+            // The viewer's copy of the walls and the collision arrays only
+            // change when a command edited the walls
+            if (world.wallsChanged) {
+                sharedWalls = std::make_shared<const std::vector<sf::VertexArray>>(world.walls);
+                world.wallSegments.assign(world.walls, playerRadius);
+                world.wallsChanged = false;
+                ++wallsVersion;
+            }
+
+            // Move every explorer by the input received since the last tick
+            players.applyInputs([this](sf::Vector2f position, uint8_t keys) {
+                return movePlayer(position, keys, world.wallSegments, world.canvasWidth, world.canvasHeight);
+            });
+
+            updateParticles(world, deltaTime);
+            emitParticles(world, deltaTime);
+            // Squeeze out dead particles once they are a large enough share
+            // of the storage to slow the loops above. Spawns always append,
+            // so storage that is mostly holes is compacted whatever the
+            // setting, or it would grow without bound.
+            size_t holes = world.particles.holeCount();
+            float holeFraction = static_cast<float>(holes) / std::max<size_t>(1, world.particles.storageSize());
+            bool due = compactFraction > 0.0f && holeFraction > compactFraction;
+            if (holes >= minCompactHoles && (due || holeFraction > maxHoleFraction)) {
+                world.particles.compact(workers);
+                steady = false;
+            }
+
+            // Publish an immutable snapshot of this tick and move on
+            std::shared_ptr<ServerSnapshot> snapshot = snapshots.acquire();
+            snapshot->tick = ticks.load();
+            snapshot->serverTimeMs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(tickStart - startTime).count());
+            snapshot->sceneVersion = world.particles.version();
+            // Room for as many particles as the pool has room for, so a
+            // reused snapshot only grows when the pool itself has grown, not
+            // each time the live count sets a new high
+            size_t room = world.particles.storage().capacity();
+            snapshot->particles.clear();
+            snapshot->velocities.clear();
+            snapshot->ids.clear();
+            snapshot->particles.reserve(room);
+            snapshot->velocities.reserve(room);
+            snapshot->ids.reserve(room);
+            for (size_t i = 0; i < world.particles.storageSize(); ++i) {
+                const Particle& particle = world.particles.at(i);
+                if (particle.isAlive()) {
+                    snapshot->particles.push_back(particle.getPosition());
+                    snapshot->velocities.push_back(particle.getVelocity());
+                    snapshot->ids.push_back(world.particles.idAt(i));
+                }
+            }
+            snapshot->idCount = world.particles.idCount();
+            players.copyTo(snapshot->clients, snapshot->players, snapshot->acknowledgedTicks);
+            snapshot->walls = sharedWalls;
+            snapshot->wallsVersion = wallsVersion;
+            {
+                std::lock_guard<std::mutex> lock(latestMutex);
+                latestSnapshot = snapshot;
+            }
+            if (recorder) {
+                recorder->push(snapshot);
+            }
+            sendStage.publish(std::move(snapshot));
+
+            ++ticks;
+            particles = world.particles.size();
+            emitters = world.emitters.size();
+            walls = world.walls.size();
+            width = world.canvasWidth;
+            height = world.canvasHeight;
+            if (checkpointInterval > 0.0f && !checkpointFile.empty() && tickStart >= nextCheckpoint) {
+                writeCheckpoint(checkpointFile);
+                nextCheckpoint = tickStart + checkpointPeriod;
+            }
+            tickSeconds = std::chrono::duration<double>(clock::now() - tickStart).count();
+            uint64_t allocated = allocations.lap();
+            tickAllocations = allocated;
+            if (steady) {
+                steadyAllocations += allocated;
+            }
+
+            // Fixed rate without trying to catch up on missed ticks
+            nextTick = std::max(nextTick + period, clock::now());
+            std::this_thread::sleep_until(nextTick);
+        }
+    }
+};
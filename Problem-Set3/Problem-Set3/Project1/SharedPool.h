@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Objects handed out as shared_ptrs and taken back once every copy has been
+// dropped, so something rebuilt every tick, like a snapshot or an encoded
+// message, keeps its buffers instead of being allocated again. An object
+// comes back as it was left; whoever acquires it clears what it refills.
+//
+// Only one thread may acquire from a pool, though the copies it hands out go
+// anywhere. At most capacity objects are kept; past that, acquire() makes
+// ones that are freed as usual, so a burst of readers cannot pin more.
+template <typename T>
+class SharedPool {
+public:
+    explicit SharedPool(size_t capacity) : capacity(capacity) {
+        entries.reserve(capacity);
+    }
+
+    std::shared_ptr<T> acquire() {
+        for (const std::shared_ptr<T>& entry : entries) {
+            // The pool's copy is the only one left, and no one can make
+            // another from it
+            if (entry.use_count() == 1) {
+                // Pairs with the release in the last reader's drop, so its
+                // reads finish before the caller writes
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return entry;
+            }
+        }
+        auto created = std::make_shared<T>();
+        if (entries.size() < capacity) {
+            entries.push_back(created);
+        }
+        return created;
+    }
+
+private:
+    size_t capacity;
+    std::vector<std::shared_ptr<T>> entries;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "AdminCommands.h"
+#include "ParticleSpawner.h"
+#include "SceneFile.h"
+#include "World.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Generated worst cases for measuring the wall, collision and rendering code
+// against the same scenes every time. Each preset takes the number of wall
+// segments, the number of particles and a seed, and the same three always
+// give the same walls and spawn command on every platform, bit for bit:
+//
+//   maze       a random maze filling the canvas, particles fanning out
+//              from its middle cell
+//   grid       a closed lattice of cells with jittered corners, particles
+//              on a diagonal line
+//   corridors  rows of narrow, wavy corridors, particles shot down them from
+//              the left edge
+//   fan        short walls scattered at random, particles fanning out from
+//              the centre at high speed
+//
+// The wall count is approximate: a maze or grid is rounded to whole cells.
+// Launching the spawn turns its angles into velocities with std::cos and
+// std::sin, as every spawn does, so those can still differ in the last bit
+// between standard libraries.
+struct StressScene {
+    Scene scene;
+    SpawnCommand spawn;
+};
+
+constexpr const char* stressPresetNames[] = { "maze", "grid", "corridors", "fan" };
+constexpr size_t stressPresetCount = sizeof(stressPresetNames) / sizeof(stressPresetNames[0]);
+
+// Each wall is its own vertex array, so a scene this large takes a few
+// hundred megabytes
+constexpr size_t maxStressWalls = 2000000;
+
+// The distributions in <random> give different numbers on different standard
+// libraries, so values are made from mt19937's output, which does not
+class StressRandom {
+public:
+    explicit StressRandom(uint32_t seed) : engine(seed) {}
+
+    // In [0, 1)
+    float unit() {
+        return static_cast<float>(engine() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    float between(float low, float high) {
+        return low + (high - low) * unit();
+    }
+
+    // In [0, count)
+    size_t below(size_t count) {
+        return static_cast<size_t>(engine() % count);
+    }
+
+    // A direction of length 1, even over the circle, from a point picked in
+    // the unit disc. Unlike std::cos and std::sin, the arithmetic and
+    // std::sqrt used are rounded the same way by every standard library.
+    sf::Vector2f direction() {
+        while (true) {
+            float x = between(-1.0f, 1.0f);
+            float y = between(-1.0f, 1.0f);
+            float lengthSquared = x * x + y * y;
+            if (lengthSquared > 0.0001f && lengthSquared <= 1.0f) {
+                float length = std::sqrt(lengthSquared);
+                return sf::Vector2f(x / length, y / length);
+            }
+        }
+    }
+
+private:
+    std::mt19937 engine;
+};
+
+// Rows and columns of about cellCount cells with the canvas's shape
+inline std::pair<size_t, size_t> stressCells(size_t cellCount, float width, float height) {
+    size_t rows = std::max<size_t>(1, static_cast<size_t>(std::lround(std::sqrt(cellCount * height / width))));
+    size_t columns = std::max<size_t>(1, (cellCount + rows / 2) / rows);
+    return { rows, columns };
+}
+
+// A spanning tree of the cell grid, carved by a depth-first walk, leaves
+// cells + rows + columns + 1 segments including the border
+inline void generateMaze(StressScene& generated, size_t wallCount, size_t particles, StressRandom& random) {
+    Scene& scene = generated.scene;
+    // The border and the walls between cells add about rows + columns to the
+    // cell count
+    std::pair<size_t, size_t> cells = stressCells(std::max<size_t>(1, wallCount), scene.canvasWidth, scene.canvasHeight);
+    size_t extra = cells.first + cells.second + 1;
+    cells = stressCells(wallCount > extra ? wallCount - extra : 1, scene.canvasWidth, scene.canvasHeight);
+    size_t rows = cells.first;
+    size_t columns = cells.second;
+    float cellWidth = scene.canvasWidth / columns;
+    float cellHeight = scene.canvasHeight / rows;
+
+    std::vector<uint8_t> openRight(rows * columns, 0);
+    std::vector<uint8_t> openDown(rows * columns, 0);
+    std::vector<uint8_t> visited(rows * columns, 0);
+    std::vector<size_t> path;
+    path.push_back(0);
+    visited[0] = 1;
+    while (!path.empty()) {
+        size_t cell = path.back();
+        size_t row = cell / columns;
+        size_t column = cell % columns;
+        size_t neighbours[4];
+        size_t count = 0;
+        if (column > 0 && !visited[cell - 1]) {
+            neighbours[count++] = cell - 1;
+        }
+        if (column + 1 < columns && !visited[cell + 1]) {
+            neighbours[count++] = cell + 1;
+        }
+        if (row > 0 && !visited[cell - columns]) {
+            neighbours[count++] = cell - columns;
+        }
+        if (row + 1 < rows && !visited[cell + columns]) {
+            neighbours[count++] = cell + columns;
+        }
+        if (count == 0) {
+            path.pop_back();
+            continue;
+        }
+        size_t next = neighbours[random.below(count)];
+        if (next == cell + 1 || next + 1 == cell) {
+            openRight[std::min(cell, next)] = 1;
+        }
+        else {
+            openDown[std::min(cell, next)] = 1;
+        }
+        visited[next] = 1;
+        path.push_back(next);
+    }
+
+    scene.walls.reserve(rows * columns + rows + columns + 1);
+    for (size_t column = 0; column < columns; ++column) {
+        scene.walls.push_back(makeWall({ column * cellWidth, 0.0f }, { (column + 1) * cellWidth, 0.0f }));
+    }
+    for (size_t row = 0; row < rows; ++row) {
+        scene.walls.push_back(makeWall({ 0.0f, row * cellHeight }, { 0.0f, (row + 1) * cellHeight }));
+        for (size_t column = 0; column < columns; ++column) {
+            size_t cell = row * columns + column;
+            float left = column * cellWidth;
+            float top = row * cellHeight;
+            if (!openRight[cell]) {
+                scene.walls.push_back(makeWall({ left + cellWidth, top }, { left + cellWidth, top + cellHeight }));
+            }
+            if (!openDown[cell]) {
+                scene.walls.push_back(makeWall({ left, top + cellHeight }, { left + cellWidth, top + cellHeight }));
+            }
+        }
+    }
+
+    sf::Vector2f middle((columns / 2 + 0.5f) * cellWidth, (rows / 2 + 0.5f) * cellHeight);
+    generated.spawn.spec = fanSpec(particles, middle, 0.0f, 2.0f * 3.14159265f, 100.0f);
+}
+
+// Every cell edge of a lattice, with the inner corners moved up to a quarter
+// of a cell so no two cells are the same
+inline void generateGrid(StressScene& generated, size_t wallCount, size_t particles, StressRandom& random) {
+    Scene& scene = generated.scene;
+    std::pair<size_t, size_t> cells = stressCells(std::max<size_t>(1, wallCount / 2), scene.canvasWidth, scene.canvasHeight);
+    size_t rows = cells.first;
+    size_t columns = cells.second;
+    float cellWidth = scene.canvasWidth / columns;
+    float cellHeight = scene.canvasHeight / rows;
+
+    std::vector<sf::Vector2f> corners((rows + 1) * (columns + 1));
+    for (size_t row = 0; row <= rows; ++row) {
+        for (size_t column = 0; column <= columns; ++column) {
+            sf::Vector2f corner(column * cellWidth, row * cellHeight);
+            if (row > 0 && row < rows && column > 0 && column < columns) {
+                corner.x += random.between(-0.25f, 0.25f) * cellWidth;
+                corner.y += random.between(-0.25f, 0.25f) * cellHeight;
+            }
+            corners[row * (columns + 1) + column] = corner;
+        }
+    }
+    scene.walls.reserve(rows * (columns + 1) + columns * (rows + 1));
+    for (size_t row = 0; row <= rows; ++row) {
+        for (size_t column = 0; column <= columns; ++column) {
+            const sf::Vector2f& corner = corners[row * (columns + 1) + column];
+            if (column < columns) {
+                scene.walls.push_back(makeWall(corner, corners[row * (columns + 1) + column + 1]));
+            }
+            if (row < rows) {
+                scene.walls.push_back(makeWall(corner, corners[(row + 1) * (columns + 1) + column]));
+            }
+        }
+    }
+
+    const float degrees = 3.14159265f / 180.0f;
+    generated.spawn.spec = lineSpec(particles, { 0.0f, 0.0f }, { scene.canvasWidth, scene.canvasHeight }, 150.0f, 30.0f * degrees);
+}
+
+// Horizontal walls across the canvas, each a chain of segments whose inner
+// points wander up and down by a quarter of the corridor height
+inline void generateCorridors(StressScene& generated, size_t wallCount, size_t particles, StressRandom& random) {
+    Scene& scene = generated.scene;
+    size_t lines = std::clamp<size_t>(static_cast<size_t>(std::sqrt(static_cast<double>(wallCount)) / 2), 2, std::max<size_t>(2, wallCount / 2));
+    size_t segments = std::max<size_t>(1, wallCount / lines);
+    float corridorHeight = scene.canvasHeight / (lines - 1);
+    float segmentWidth = scene.canvasWidth / segments;
+
+    scene.walls.reserve(lines * segments);
+    for (size_t line = 0; line < lines; ++line) {
+        float y = line * corridorHeight;
+        bool inner = line > 0 && line + 1 < lines;
+        sf::Vector2f start(0.0f, y);
+        for (size_t segment = 0; segment < segments; ++segment) {
+            sf::Vector2f end((segment + 1) * segmentWidth, y);
+            if (inner && segment + 1 < segments) {
+                end.y += random.between(-0.25f, 0.25f) * corridorHeight;
+            }
+            scene.walls.push_back(makeWall(start, end));
+            start = end;
+        }
+    }
+
+    generated.spawn.spec = lineSpec(particles, { 1.0f, 0.0f }, { 1.0f, scene.canvasHeight }, 600.0f, 0.0f);
+}
+
+// Short walls at random places and angles, cut off at the canvas edge
+inline void generateFan(StressScene& generated, size_t wallCount, size_t particles, StressRandom& random) {
+    Scene& scene = generated.scene;
+    scene.walls.reserve(wallCount);
+    for (size_t i = 0; i < wallCount; ++i) {
+        sf::Vector2f start(random.between(0.0f, scene.canvasWidth), random.between(0.0f, scene.canvasHeight));
+        sf::Vector2f direction = random.direction();
+        float length = random.between(10.0f, 60.0f);
+        sf::Vector2f end = start + direction * length;
+        end.x = std::clamp(end.x, 0.0f, scene.canvasWidth);
+        end.y = std::clamp(end.y, 0.0f, scene.canvasHeight);
+        scene.walls.push_back(makeWall(start, end));
+    }
+
+    sf::Vector2f centre(scene.canvasWidth / 2.0f, scene.canvasHeight / 2.0f);
+    generated.spawn.spec = fanSpec(particles, centre, 0.0f, 2.0f * 3.14159265f, 2000.0f);
+}
+
+// Returns false with a message if the preset is unknown or a count is out of
+// range
+inline bool generateStressScene(const std::string& preset, size_t wallCount, size_t particles, uint32_t seed,
+    StressScene& generated, std::string& error) {
+    if (wallCount > maxStressWalls || particles > maxSpawnCount) {
+        error = "a stress scene takes up to " + std::to_string(maxStressWalls) + " walls and " + std::to_string(maxSpawnCount) + " particles";
+        return false;
+    }
+    generated = StressScene();
+    StressRandom random(seed);
+    if (preset == "maze") {
+        generateMaze(generated, wallCount, particles, random);
+    }
+    else if (preset == "grid") {
+        generateGrid(generated, wallCount, particles, random);
+    }
+    else if (preset == "corridors") {
+        generateCorridors(generated, wallCount, particles, random);
+    }
+    else if (preset == "fan") {
+        generateFan(generated, wallCount, particles, random);
+    }
+    else {
+        error = "unknown stress scene '" + preset + "'; use maze, grid, corridors or fan";
+        return false;
+    }
+    generated.spawn.count = particles;
+    generated.spawn.shape = makeShape(generated.spawn.spec);
+    return true;
+}
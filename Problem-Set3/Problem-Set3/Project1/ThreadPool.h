@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks in FIFO order. The
+// destructor runs whatever is still queued before joining.
+class ThreadPool {
+public:
+    ThreadPool(size_t numThreads) : stop(false) {
+        for (size_t i = 0; i < numThreads; ++i) {
+            threads.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+
+                    {
+                        std::unique_lock<std::mutex> lock(queueMutex);
+                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+
+                    task();
+                }
+                });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : threads) {
+            worker.join();
+        }
+    }
+
+    template <class F, class... Args>
+    void enqueue(F&& f, Args&&... args) {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            tasks.emplace([=]() mutable { std::forward<F>(f)(std::forward<Args>(args)...); });
+        }
+        condition.notify_one();
+    }
+
+    size_t size() const {
+        return threads.size();
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queueMutex;
+    std::condition_variable condition;
+    bool stop;
+};
+
+// Runs body(0) ... body(count - 1) across the pool and the calling thread and
+// returns once all have finished. The caller works through the items too, so
+// this finishes even while the pool is busy with something else; helpers
+// that start after the last item was taken return without touching body.
+inline void parallelFor(ThreadPool& pool, size_t count, const std::function<void(size_t)>& body) {
+    struct Progress {
+        std::atomic<size_t> next{ 0 };
+        size_t finished = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto progress = std::make_shared<Progress>();
+    auto work = [progress, count, &body] {
+        for (size_t i = progress->next++; i < count; i = progress->next++) {
+            body(i);
+            std::lock_guard<std::mutex> lock(progress->mutex);
+            if (++progress->finished == count) {
+                progress->done.notify_all();
+            }
+        }
+    };
+
+    size_t helpers = std::min(pool.size(), count > 0 ? count - 1 : 0);
+    for (size_t i = 0; i < helpers; ++i) {
+        pool.enqueue(work);
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(progress->mutex);
+    progress->done.wait(lock, [&progress, count] { return progress->finished == count; });
+}
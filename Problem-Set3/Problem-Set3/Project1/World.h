@@ -0,0 +1,200 @@
+#pragma once
+
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/Protocol.h"
+#include "../Common/WallSegments.h"
+#include "Particle.h"
+#include "ParticlePool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Particle spawn shapes used by both the viewer's settings tabs and the admin
+// socket. A shape launches the index-th of its count particles and may be
+// called from several threads at once; ParticleSpawner builds a burst of
+// particles with it and an Emitter a stream. Angles are in radians.
+using SpawnShape = std::function<void(size_t index, Particle& particle)>;
+
+// count particles spread evenly from start to end, all moving the same way
+inline SpawnShape lineShape(size_t count, sf::Vector2f start, sf::Vector2f end, float speed, float angle) {
+    return [=](size_t index, Particle& particle) {
+        float t = 0.0f;
+        if (count > 1) {
+            t = static_cast<float>(static_cast<double>(index) / (count - 1));
+        }
+        particle.launch(start + t * (end - start), speed, angle);
+    };
+}
+
+// count particles from one point, fanned out from startAngle to endAngle
+inline SpawnShape fanShape(size_t count, sf::Vector2f origin, float startAngle, float endAngle, float speed) {
+    double angleIncrement = 0.0;
+    if (count > 1) {
+        angleIncrement = (static_cast<double>(endAngle) - startAngle) / (count - 1);
+    }
+    return [=](size_t index, Particle& particle) {
+        particle.launch(origin, speed, static_cast<float>(startAngle + index * angleIncrement));
+    };
+}
+
+// count particles from one point in the same direction, with speeds rising
+// from 50 to 500 px/s
+inline SpawnShape speedRampShape(size_t count, sf::Vector2f origin, float angle) {
+    double speedIncrement = count > 0 ? 450.0 / count : 0.0;
+    return [=](size_t index, Particle& particle) {
+        particle.launch(origin, static_cast<float>(50.0 + index * speedIncrement), angle);
+    };
+}
+
+// The parameters a shape was made from, so an emitter can be written to a
+// scene file and made again when it is read back
+struct ShapeSpec {
+    enum Kind : uint32_t { Line = 0, Fan = 1, Ramp = 2 };
+
+    Kind kind = Line;
+    size_t count = 0;
+    sf::Vector2f start;     // start of a line, or the origin of a fan or ramp
+    sf::Vector2f end;       // end of a line
+    float speed = 0.0f;     // line and fan
+    float angle = 0.0f;     // line and ramp, or where a fan starts
+    float endAngle = 0.0f;  // where a fan ends
+};
+
+inline ShapeSpec lineSpec(size_t count, sf::Vector2f start, sf::Vector2f end, float speed, float angle) {
+    return { ShapeSpec::Line, count, start, end, speed, angle, 0.0f };
+}
+
+inline ShapeSpec fanSpec(size_t count, sf::Vector2f origin, float startAngle, float endAngle, float speed) {
+    return { ShapeSpec::Fan, count, origin, {}, speed, startAngle, endAngle };
+}
+
+inline ShapeSpec speedRampSpec(size_t count, sf::Vector2f origin, float angle) {
+    return { ShapeSpec::Ramp, count, origin, {}, 0.0f, angle, 0.0f };
+}
+
+inline SpawnShape makeShape(const ShapeSpec& spec) {
+    switch (spec.kind) {
+    case ShapeSpec::Fan:
+        return fanShape(spec.count, spec.start, spec.angle, spec.endAngle, spec.speed);
+    case ShapeSpec::Ramp:
+        return speedRampShape(spec.count, spec.start, spec.angle);
+    default:
+        return lineShape(spec.count, spec.start, spec.end, spec.speed, spec.angle);
+    }
+}
+
+// Spawns particles continuously instead of all at once: rate particles a
+// second, launched by shape at index 0, 1, ... count - 1 and round again,
+// each living for lifetime seconds. Once the first ones die the number alive
+// stays near rate * lifetime.
+struct Emitter {
+    ShapeSpec spec;
+    SpawnShape shape;       // made from spec
+    size_t count = 1;
+    float rate = 0.0f;
+    float lifetime = 1.0f;
+    double owed = 0.0;      // fraction of a particle carried to the next tick
+    size_t next = 0;        // index in the shape of the next particle
+};
+
+inline Emitter makeEmitter(const ShapeSpec& spec, float rate, float lifetime) {
+    Emitter emitter;
+    emitter.spec = spec;
+    emitter.shape = makeShape(spec);
+    emitter.count = spec.count;
+    emitter.rate = rate;
+    emitter.lifetime = lifetime;
+    return emitter;
+}
+
+// The longest canvas side that both the particle storage and the network's
+// positions can hold
+constexpr float largestCanvasSide = std::min(maxCanvasSize, maxEncodedPosition);
+
+// Every canvas side must be above 0 and at most largestCanvasSide
+inline bool validCanvasSize(float width, float height) {
+    return width > 0.0f && height > 0.0f && width <= largestCanvasSide && height <= largestCanvasSide;
+}
+
+// A position or velocity read from a file, which must be finite
+inline bool validPoint(sf::Vector2f point) {
+    return std::isfinite(point.x) && std::isfinite(point.y);
+}
+
+// Everything the server simulates apart from the players. Only the tick
+// thread touches a World; anything else changes it by submitting a command.
+struct World {
+    float canvasWidth = 1280.0f;
+    float canvasHeight = 720.0f;
+    ParticlePool particles;
+    std::vector<Emitter> emitters;
+    std::vector<sf::VertexArray> walls;
+    WallSegments wallSegments;      // walls as the collision code reads them; refilled after every edit
+    bool wallsChanged = true;       // set by every wall edit, cleared once wallSegments is refilled
+};
+
+// Advances every live particle by deltaTime and kills those whose lifetime
+// ran out
+inline void updateParticles(World& world, float deltaTime) {
+    ParticleTick tick(deltaTime, world.canvasWidth, world.canvasHeight, world.wallSegments);
+    for (size_t i = 0; i < world.particles.storageSize(); ++i) {
+        Particle& particle = world.particles.at(i);
+        if (!particle.isAlive()) {
+            continue;
+        }
+        particle.update(tick);
+        if (particle.age(deltaTime)) {
+            world.particles.killAt(i);
+        }
+    }
+}
+
+// Most particles all emitters together spawn in one tick, so a fast emitter
+// or a long stall cannot stretch a tick by spawning millions at once
+constexpr size_t maxEmittedPerTick = 100000;
+
+// Runs every emitter for deltaTime seconds. Particles over the tick's limit
+// stay owed for later ticks, up to one second's worth per emitter.
+inline void emitParticles(World& world, float deltaTime) {
+    size_t budget = maxEmittedPerTick;
+    for (Emitter& emitter : world.emitters) {
+        emitter.owed = std::min(emitter.owed + static_cast<double>(emitter.rate) * deltaTime, std::max(1.0, static_cast<double>(emitter.rate)));
+        for (; emitter.owed >= 1.0 && budget > 0; emitter.owed -= 1.0, --budget) {
+            Particle& particle = *world.particles.find(world.particles.spawn());
+            emitter.shape(emitter.next, particle);
+            particle.setLifetime(emitter.lifetime);
+            emitter.next = (emitter.next + 1) % emitter.count;
+        }
+    }
+}
+
+// One straight wall segment
+inline sf::VertexArray makeWall(sf::Vector2f start, sf::Vector2f end) {
+    sf::VertexArray wall(sf::LinesStrip, 2);
+    wall[0].position = start;
+    wall[1].position = end;
+    return wall;
+}
+
+inline void addWall(World& world, sf::Vector2f start, sf::Vector2f end) {
+    world.walls.push_back(makeWall(start, end));
+    world.wallsChanged = true;
+}
+
+inline void removeLastWall(World& world) {
+    if (!world.walls.empty()) {
+        world.walls.pop_back();
+        world.wallsChanged = true;
+    }
+}
+
+inline void clearWalls(World& world) {
+    world.walls.clear();
+    world.wallsChanged = true;
+}
@@ -0,0 +1,245 @@
+// Snapshot relay. Subscribes to one server as a spectator and forwards every
+// snapshot it receives, byte for byte, to its own TCP and UDP clients. Each
+// snapshot is copied once into a shared buffer that all downstream queues
+// reference, so a relay never decodes or re-encodes anything. The walls are
+// forwarded reliably, and kept so that clients joining later get them too.
+//
+// A relay listens with the same protocol as the server, so its upstream can
+// be another relay and relays chain into a tree. Clients of a relay are
+// spectators: they get no player and their input is dropped.
+#include "../Common/NetReactor.h"
+#include "../Common/Protocol.h"
+#include "../Common/ServerLink.h"
+#include "../Common/UdpTransport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Connected downstream clients, added and removed on the transports' I/O
+// threads and read by the upstream receive thread. Clients that have not yet
+// been sent the walls are listed again under joined.
+struct Downstream {
+    std::mutex mutex;
+    std::vector<uint32_t> tcp;
+    std::vector<uint32_t> udp;
+    std::vector<uint32_t> joinedTcp;
+    std::vector<uint32_t> joinedUdp;
+
+    static void remove(std::vector<uint32_t>& ids, uint32_t id) {
+        ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+    }
+};
+
+std::atomic<bool> running(true);
+
+void stopRunning(int) {
+    running = false;
+}
+
+int main(int argc, char* argv[]) {
+    SocketLibrary sockets;
+    if (!sockets.ok()) {
+        std::cout << "The socket library could not be started" << std::endl;
+        return 1;
+    }
+
+    // Command line: [--upstream <ip>] [--upstream-port <port>] [--upstream-udp]
+    //               [--port <port>] [--report <s>]
+    // The UDP port is always one above the TCP port, upstream and down.
+    std::string upstreamAddress = "127.0.0.1";
+    uint16_t upstreamPort = 55555;
+    bool upstreamUdp = false;
+    uint16_t port = 55565;
+    double reportInterval = 5;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--upstream" && i + 1 < argc) {
+            upstreamAddress = argv[++i];
+        }
+        else if (arg == "--upstream-port" && i + 1 < argc) {
+            upstreamPort = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--upstream-udp") {
+            upstreamUdp = true;
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--report" && i + 1 < argc) {
+            reportInterval = std::max(0.1, std::stod(argv[++i]));
+        }
+    }
+    std::signal(SIGINT, stopRunning);
+
+    Downstream downstream;
+
+    NetReactor reactor;
+    reactor.onConnect = [&downstream](NetReactor::ConnectionId id) {
+        std::lock_guard<std::mutex> lock(downstream.mutex);
+        downstream.tcp.push_back(id);
+        downstream.joinedTcp.push_back(id);
+    };
+    reactor.onDisconnect = [&downstream](NetReactor::ConnectionId id) {
+        std::lock_guard<std::mutex> lock(downstream.mutex);
+        Downstream::remove(downstream.tcp, id);
+        Downstream::remove(downstream.joinedTcp, id);
+    };
+    reactor.onMessage = [](NetReactor::ConnectionId, const char*, size_t) {};
+    if (!reactor.listen(port)) {
+        return 1;
+    }
+
+    UdpSocketIo udpSocket;
+    if (!udpSocket.open(port + 1)) {
+        return 1;
+    }
+    UdpTransport udp(udpSocket);
+    udp.onConnect = [&downstream](UdpTransport::ConnectionId id) {
+        std::lock_guard<std::mutex> lock(downstream.mutex);
+        downstream.udp.push_back(id);
+        downstream.joinedUdp.push_back(id);
+    };
+    udp.onDisconnect = [&downstream](UdpTransport::ConnectionId id) {
+        std::lock_guard<std::mutex> lock(downstream.mutex);
+        Downstream::remove(downstream.udp, id);
+        Downstream::remove(downstream.joinedUdp, id);
+    };
+
+    reactor.start();
+    udp.start();
+
+    std::atomic<uint64_t> snapshotsIn(0);
+    std::atomic<uint64_t> bytesIn(0);
+    std::atomic<uint64_t> bytesOut(0);
+
+    // The messages carrying the newest complete or arriving walls, only
+    // touched by the upstream receive thread
+    std::vector<std::string> walls;
+
+    // Upstream receive thread: forward each snapshot as it arrives
+    ServerLink upstream;
+    upstream.setMessageHandler([&](const char* data, size_t size) {
+        MessageType type;
+        if (!peekMessageType(data, size, type) || (type != MessageType::Snapshot && type != MessageType::Walls)) {
+            return;
+        }
+        bytesIn += size;
+
+        thread_local std::vector<uint32_t> tcpIds;
+        thread_local std::vector<uint32_t> udpIds;
+        thread_local std::vector<uint32_t> joinedTcpIds;
+        thread_local std::vector<uint32_t> joinedUdpIds;
+        {
+            std::lock_guard<std::mutex> lock(downstream.mutex);
+            tcpIds = downstream.tcp;
+            udpIds = downstream.udp;
+            joinedTcpIds.swap(downstream.joinedTcp);
+            joinedUdpIds.swap(downstream.joinedUdp);
+            downstream.joinedTcp.clear();
+            downstream.joinedUdp.clear();
+        }
+
+        // New clients first get every wall message so far, then the rest
+        // arrive in order behind them
+        for (const std::string& message : walls) {
+            for (uint32_t id : joinedTcpIds) {
+                reactor.send(id, message);
+            }
+            for (uint32_t id : joinedUdpIds) {
+                udp.sendReliable(id, message);
+            }
+        }
+        if (type == MessageType::Walls) {
+            WallsMessage message;
+            if (!decodeWalls(data, size, message)) {
+                return;
+            }
+            if (message.firstSegment == 0) {
+                walls.clear();
+            }
+            walls.emplace_back(data, size);
+            for (uint32_t id : tcpIds) {
+                reactor.send(id, walls.back());
+            }
+            for (uint32_t id : udpIds) {
+                udp.sendReliable(id, walls.back());
+            }
+            return;
+        }
+        ++snapshotsIn;
+
+        if (tcpIds.empty() && udpIds.empty()) {
+            return;
+        }
+        NetReactor::SharedPayload payload = std::make_shared<const std::string>(data, size);
+        for (uint32_t id : tcpIds) {
+            reactor.send(id, payload, NetReactor::SendPolicy::Latest);
+        }
+        for (uint32_t id : udpIds) {
+            udp.sendUnreliable(id, payload);
+        }
+        bytesOut += size * (tcpIds.size() + udpIds.size());
+    });
+    bool linked = upstreamUdp ? upstream.connectUdp(upstreamAddress, upstreamPort + 1) : upstream.connectTcp(upstreamAddress, upstreamPort);
+    if (!linked || !upstream.send(encodeSubscribe())) {
+        std::cout << "Could not subscribe to " << upstreamAddress << ":" << upstreamPort << std::endl;
+        udp.stop();
+        reactor.stop();
+        return 1;
+    }
+    std::cout << "Relaying " << upstreamAddress << ":" << upstreamPort << (upstreamUdp ? " (UDP)" : " (TCP)")
+        << " to port " << port << " (TCP) and " << port + 1 << " (UDP)" << std::endl;
+
+    using Clock = std::chrono::steady_clock;
+    auto lastReport = Clock::now();
+    uint64_t lastSnapshots = 0;
+    uint64_t lastBytesIn = 0;
+    uint64_t lastBytesOut = 0;
+    // A UDP link only reports connected once the handshake completes
+    auto connectDeadline = Clock::now() + std::chrono::seconds(5);
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto now = Clock::now();
+        if (!upstream.isConnected() && (!upstreamUdp || now > connectDeadline)) {
+            std::cout << "Lost the upstream connection." << std::endl;
+            break;
+        }
+
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds >= reportInterval) {
+            size_t tcpCount, udpCount;
+            {
+                std::lock_guard<std::mutex> lock(downstream.mutex);
+                tcpCount = downstream.tcp.size();
+                udpCount = downstream.udp.size();
+            }
+            uint64_t snapshots = snapshotsIn.load();
+            uint64_t in = bytesIn.load();
+            uint64_t out = bytesOut.load();
+            std::cout << tcpCount << " TCP + " << udpCount << " UDP downstream, " << std::fixed << std::setprecision(1)
+                << (snapshots - lastSnapshots) / seconds << " snapshots/s, "
+                << (in - lastBytesIn) / seconds / 1024.0 << " KiB/s in, "
+                << (out - lastBytesOut) / seconds / 1024.0 << " KiB/s out, "
+                << reactor.droppedFrameCount() << " dropped" << std::endl;
+            lastSnapshots = snapshots;
+            lastBytesIn = in;
+            lastBytesOut = out;
+            lastReport = now;
+        }
+    }
+
+    upstream.close();
+    udp.stop();
+    reactor.stop();
+    return 0;
+}
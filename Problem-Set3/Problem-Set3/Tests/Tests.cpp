@@ -0,0 +1,147 @@
+// Checks that run after every build. The project's post-build step runs this
+// program, so a failing check fails the build. Each test prints what went
+// wrong and the program exits with the number of failed tests.
+//
+// Allocations are always counted here, so the steady-tick check runs in
+// every configuration. On Linux, with SFML installed:
+//
+//     g++ -std=c++20 -O2 -pthread -I../../SFML-2.6.1-windows-vc17-64-bit/SFML-2.6.1/include Tests/Tests.cpp -o tests -lsfml-graphics -lsfml-system
+#define COUNT_ALLOCATIONS
+
+#include <SFML/System/Vector2.hpp>
+
+#include "../Common/AllocationCounter.h"
+#include "../Common/Protocol.h"
+#include "../Project1/ParticlePriority.h"
+#include "../Project1/ServerLoop.h"
+#include "../Project1/StressScenes.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Set by check() when a condition fails; reset before each test
+bool testFailed = false;
+
+void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cout << "  failed: " << what << std::endl;
+        testFailed = true;
+    }
+}
+
+// A burst of deaths must not push an update past the client's budget. The
+// removals that do not fit wait for later updates, and every one of them
+// still reaches the client.
+void removalBurstStaysWithinBudget() {
+    const uint32_t particleCount = 2000;
+    const size_t budget = 600;
+    const std::vector<PlayerState> players = { { 1, sf::Vector2f(640.0f, 360.0f), 0 } };
+    size_t header = particleUpdateHeaderSize(players.size());
+    size_t maxEntries = (budget - header) / particleUpdateEntrySize;
+
+    std::vector<uint32_t> ids(particleCount);
+    std::vector<sf::Vector2f> positions(particleCount);
+    std::vector<sf::Vector2f> velocities(particleCount, sf::Vector2f(0.0f, 0.0f));
+    for (uint32_t id = 0; id < particleCount; ++id) {
+        ids[id] = id;
+        positions[id] = sf::Vector2f(static_cast<float>(id % 1280), static_cast<float>(id / 1280 * 10));
+    }
+
+    // Every particle reaches the client, with no budget, before the burst
+    ParticlePriority priority;
+    std::vector<uint32_t> chosen;
+    std::vector<uint32_t> removed;
+    priority.select(1, 1, 0, 0, particleCount, ids, positions, velocities, players[0].position, 1.0f, particleCount, chosen, removed);
+    check(chosen.size() == particleCount, "every particle is sent before the burst");
+
+    // All but the first 100 die at once
+    ids.resize(100);
+    positions.resize(100);
+    velocities.resize(100);
+
+    std::set<uint32_t> delivered;
+    std::string out;
+    uint64_t acknowledged = 1;
+    for (uint64_t tick = 2; tick < 200 && delivered.size() < particleCount - 100; ++tick) {
+        uint32_t timeMs = static_cast<uint32_t>(tick * 50);
+        priority.select(1, tick, timeMs, acknowledged, particleCount, ids, positions, velocities, players[0].position, 1.0f,
+            maxEntries, chosen, removed);
+        encodeParticleUpdate(tick, timeMs, 1, particleCount, players, chosen, ids, positions, velocities, removed, out);
+        check(out.size() <= budget, "update " + std::to_string(tick) + " is " + std::to_string(out.size()) + " bytes, over the budget");
+        delivered.insert(removed.begin(), removed.end());
+        acknowledged = tick;
+    }
+    check(delivered.size() == particleCount - 100, std::to_string(delivered.size()) + " of 1900 removals delivered");
+    check(delivered.empty() || (*delivered.begin() == 100 && *delivered.rbegin() == particleCount - 1), "only dead particles are removed");
+}
+
+// Once warmed up, a tick that runs no command, compaction or recording must
+// not allocate, with walls, an emitter and a player to send to
+void steadyTicksDoNotAllocate() {
+    SocketLibrary sockets;
+    NetReactor reactor;
+    // Any free port; the player below has no connection, so its updates are
+    // encoded and then dropped
+    check(reactor.listen(0), "the reactor listens");
+    reactor.start();
+
+    PlayerRegistry players;
+    std::shared_ptr<PlayerRegistry::InputQueue> inputs;
+    players.join({ ClientTransport::Tcp, 1 }, inputs);
+
+    ServerConfig config;
+    config.snapshotRate = 30.0f;
+    config.clientBudget = 1400;
+    config.errorTolerance = 1.0f;
+    ServerLoop loop(players, reactor, nullptr, config);
+    loop.start();
+
+    StressScene generated;
+    std::string error;
+    check(generateStressScene("maze", 300, 20000, 1, generated, error), "the stress scene is made: " + error);
+    check(loop.spawnScene(generated.scene, generated.spawn.count, generated.spawn.shape), "the scene is loaded");
+    loop.submit([](World& world) {
+        world.emitters.push_back(makeEmitter(fanSpec(36, { 300.0f, 300.0f }, 0.0f, 3.14f, 200.0f), 300.0f, 1.5f));
+    });
+
+    // Long enough for the emitter to fill out and the buffers to reach
+    // their largest size
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    uint64_t startTick = loop.tickCount();
+    uint64_t startAllocations = loop.steadyTickAllocations();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    uint64_t ticks = loop.tickCount() - startTick;
+    uint64_t allocations = loop.steadyTickAllocations() - startAllocations;
+    loop.stop();
+    reactor.stop();
+
+    check(ticks > 0, "the loop ticked");
+    check(allocations == 0, std::to_string(allocations) + " allocations in " + std::to_string(ticks) + " ticks");
+}
+
+int main() {
+    struct Test {
+        const char* name;
+        std::function<void()> run;
+    };
+    const std::vector<Test> tests = {
+        { "removal burst stays within budget", removalBurstStaysWithinBudget },
+        { "steady ticks do not allocate", steadyTicksDoNotAllocate },
+    };
+
+    int failures = 0;
+    for (const Test& test : tests) {
+        testFailed = false;
+        test.run();
+        std::cout << (testFailed ? "FAIL " : "ok   ") << test.name << std::endl;
+        failures += testFailed ? 1 : 0;
+    }
+    std::cout << tests.size() - failures << " of " << tests.size() << " tests passed" << std::endl;
+    return failures;
+}